@@ -0,0 +1,331 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+//
+// Streaming benchmark: sustained readStream throughput, per call latency and
+// CPU cost for every format, buffer length and sample rate, against the
+// simulated radio or a replayed capture, reported as JSON on stdout.
+//
+// icr8600Bench [--duration=<s>] [--formats=CS16,CF32] [--bufflen=<bytes>,...]
+//              [--rates=<Hz>,...] [--replay=<file>] [--paced] [--agc] [--iq_correction]
+//              [--out=<file>]
+//
+// icr8600Bench --startup=<n> [--sim_latency=<ms>] [--out=<file>]
+//
+// Startup benchmark: time to open n simulated radios and have each answer its
+// first command, one after another and all at once like Device::make(list).
+//
+
+#include "SoapyICR8600.hpp"
+#include <SoapySDR/Formats.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <future>
+#include <sstream>
+
+struct BenchResult
+{
+	std::string format;
+	size_t bufflen;
+	size_t mtu;
+	double sampleRate;
+	unsigned long long samples;
+	unsigned long long reads;
+	unsigned long long errors;
+	unsigned long long overflows;
+	unsigned long long syncFlags;
+	unsigned long long droppedTransfers;
+	unsigned long long syncErrors;
+	double seconds;
+	double cpuSeconds;
+	std::vector<double> latencyUs;
+};
+
+static std::vector<std::string> splitList(const std::string &s)
+{
+	std::vector<std::string> out;
+	std::stringstream ss(s);
+	std::string item;
+	while (std::getline(ss, item, ',')) {
+		if (!item.empty()) out.push_back(item);
+	}
+	return out;
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+	if (sorted.empty()) return 0.0;
+	size_t i = (size_t)(p * (sorted.size() - 1) + 0.5);
+	return sorted[std::min(i, sorted.size() - 1)];
+}
+
+static BenchResult runCase(SoapyICR8600 &dev, const std::string &format, size_t bufflen, double rate, double duration)
+{
+	typedef std::chrono::steady_clock clock;
+
+	BenchResult r;
+	r.format = format;
+	r.bufflen = bufflen;
+	r.sampleRate = rate;
+	r.samples = r.reads = r.errors = r.overflows = r.syncFlags = 0;
+
+	dev.setSampleRate(SOAPY_SDR_RX, 0, rate);
+	SoapySDR::Kwargs streamArgs;
+	streamArgs["bufflen"] = std::to_string(bufflen);
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, format, std::vector<size_t>(1, 0), streamArgs);
+
+	size_t mtu = dev.getStreamMTU(stream);
+	r.mtu = mtu;
+	std::vector<float> buff(mtu * 2);
+	void *buffs[] = { buff.data() };
+	int flags = 0;
+	long long timeNs = 0;
+
+	dev.activateStream(stream);
+
+	// warm up: fill the ring and fault in every page before measuring
+	clock::time_point warmEnd = clock::now() + std::chrono::milliseconds(100);
+	while (clock::now() < warmEnd) {
+		dev.readStream(stream, buffs, mtu, flags, timeNs);
+	}
+
+	r.latencyUs.reserve(1 << 20);
+	unsigned long long droppedStart = std::stoull(dev.readSetting("dropped_transfers"));
+	unsigned long long syncErrorsStart = std::stoull(dev.readSetting("sync_errors"));
+	std::clock_t cpuStart = std::clock();
+	clock::time_point start = clock::now();
+	clock::time_point end = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration));
+	clock::time_point now = start;
+	while (now < end) {
+		clock::time_point t0 = now;
+		int ret = dev.readStream(stream, buffs, mtu, flags, timeNs);
+		now = clock::now();
+		r.latencyUs.push_back(std::chrono::duration<double, std::micro>(now - t0).count());
+		r.reads++;
+		if (ret == SOAPY_SDR_OVERFLOW) {
+			r.overflows++;
+			continue;
+		}
+		if (ret < 0) {
+			r.errors++;
+			continue;
+		}
+		r.samples += ret;
+		if (flags & ICR8600_FLAG_SYNC_WORD) r.syncFlags++;
+	}
+	r.seconds = std::chrono::duration<double>(now - start).count();
+	r.cpuSeconds = (double)(std::clock() - cpuStart) / CLOCKS_PER_SEC;
+	r.droppedTransfers = std::stoull(dev.readSetting("dropped_transfers")) - droppedStart;
+	r.syncErrors = std::stoull(dev.readSetting("sync_errors")) - syncErrorsStart;
+
+	dev.deactivateStream(stream);
+	dev.closeStream(stream);
+
+	std::sort(r.latencyUs.begin(), r.latencyUs.end());
+	return r;
+}
+
+struct StartupResult
+{
+	double openMs;
+	double readyMs;
+};
+
+// open one radio and tune it, the first command also reads the remote on ack
+static double openRadio(const SoapySDR::Kwargs &devArgs, std::chrono::steady_clock::time_point start, double &readyMs, SoapyICR8600 *&dev)
+{
+	typedef std::chrono::steady_clock clock;
+	dev = new SoapyICR8600(devArgs);
+	double openMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	dev->setFrequency(SOAPY_SDR_RX, 0, "RF", 100e6, SoapySDR::Kwargs());
+	readyMs = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+	return openMs;
+}
+
+static StartupResult runStartup(const SoapySDR::Kwargs &devArgs, size_t numRadios, bool parallel)
+{
+	typedef std::chrono::steady_clock clock;
+
+	StartupResult r;
+	r.openMs = r.readyMs = 0.0;
+	std::vector<SoapyICR8600 *> devs(numRadios, NULL);
+	std::vector<double> readyMs(numRadios, 0.0);
+	std::vector<double> openMs(numRadios, 0.0);
+	clock::time_point start = clock::now();
+	if (parallel) {
+		std::vector<std::future<double> > futures;
+		for (size_t i = 0; i < numRadios; i++) {
+			futures.push_back(std::async(std::launch::async, &openRadio, std::cref(devArgs), start, std::ref(readyMs[i]), std::ref(devs[i])));
+		}
+		for (size_t i = 0; i < numRadios; i++) openMs[i] = futures[i].get();
+	}
+	else {
+		for (size_t i = 0; i < numRadios; i++) openMs[i] = openRadio(devArgs, start, readyMs[i], devs[i]);
+	}
+	for (size_t i = 0; i < numRadios; i++) {
+		r.openMs = std::max(r.openMs, openMs[i]);
+		r.readyMs = std::max(r.readyMs, readyMs[i]);
+		delete devs[i];
+	}
+	return r;
+}
+
+static void writeStartupJson(FILE *out, size_t numRadios, double latencyMs, const StartupResult &serial, const StartupResult &parallel)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"benchmark\": \"icr8600Bench\",\n");
+	fprintf(out, "  \"transport\": \"sim\",\n");
+	fprintf(out, "  \"radios\": %zu,\n", numRadios);
+	fprintf(out, "  \"sim_latency_ms\": %.3f,\n", latencyMs);
+	fprintf(out, "  \"serial\": {\"open_ms\": %.3f, \"ready_ms\": %.3f},\n", serial.openMs, serial.readyMs);
+	fprintf(out, "  \"parallel\": {\"open_ms\": %.3f, \"ready_ms\": %.3f}\n", parallel.openMs, parallel.readyMs);
+	fprintf(out, "}\n");
+}
+
+static void writeJson(FILE *out, const SoapySDR::Kwargs &devArgs, bool agc, bool correction, double duration, const std::vector<BenchResult> &results)
+{
+	fprintf(out, "{\n");
+	fprintf(out, "  \"benchmark\": \"icr8600Bench\",\n");
+	fprintf(out, "  \"transport\": \"%s\",\n", devArgs.count("replay") ? "replay" : "sim");
+	fprintf(out, "  \"paced\": %s,\n", devArgs.at("sim_paced") == "1" ? "true" : "false");
+	fprintf(out, "  \"digital_agc\": %s,\n", agc ? "true" : "false");
+	fprintf(out, "  \"iq_correction\": %s,\n", correction ? "true" : "false");
+	fprintf(out, "  \"duration_s\": %.3f,\n", duration);
+	fprintf(out, "  \"results\": [\n");
+	for (size_t i = 0; i < results.size(); i++) {
+		const BenchResult &r = results[i];
+		double msamples = r.samples / 1e6;
+		fprintf(out, "    {\"format\": \"%s\", \"bufflen\": %zu, \"mtu\": %zu, \"sample_rate\": %.0f, ", r.format.c_str(), r.bufflen, r.mtu, r.sampleRate);
+		fprintf(out, "\"samples\": %llu, \"reads\": %llu, \"errors\": %llu, \"overflows\": %llu, \"sync_flags\": %llu, ", r.samples, r.reads, r.errors, r.overflows, r.syncFlags);
+		fprintf(out, "\"dropped_transfers\": %llu, \"sync_errors\": %llu, ", r.droppedTransfers, r.syncErrors);
+		fprintf(out, "\"seconds\": %.6f, \"msps\": %.3f, ", r.seconds, r.seconds > 0 ? msamples / r.seconds : 0.0);
+		fprintf(out, "\"cpu_ms_per_msample\": %.4f, ", msamples > 0 ? 1e3 * r.cpuSeconds / msamples : 0.0);
+		fprintf(out, "\"latency_us\": {\"p50\": %.2f, \"p90\": %.2f, \"p99\": %.2f, \"p999\": %.2f, \"max\": %.2f}}%s\n",
+			percentile(r.latencyUs, 0.50), percentile(r.latencyUs, 0.90), percentile(r.latencyUs, 0.99),
+			percentile(r.latencyUs, 0.999), r.latencyUs.empty() ? 0.0 : r.latencyUs.back(),
+			(i + 1 < results.size()) ? "," : "");
+	}
+	fprintf(out, "  ]\n}\n");
+}
+
+int main(int argc, char **argv)
+{
+	double duration = 1.0;
+	std::vector<std::string> formats;
+	formats.push_back(SOAPY_SDR_CS16);
+	formats.push_back(SOAPY_SDR_CF32);
+	std::vector<size_t> bufflens;
+	bufflens.push_back(0);
+	bufflens.push_back(DEFAULT_BUFFER_LENGTH);
+	bufflens.push_back(16 * 1024);
+	bufflens.push_back(64 * 1024);
+	std::vector<double> rates;
+	std::string outPath;
+	bool agc = false;
+	bool correction = false;
+	size_t startupRadios = 0;
+	double simLatency = 2.0;
+
+	SoapySDR::Kwargs devArgs;
+	devArgs["sim"] = "1";
+	devArgs["sim_paced"] = "0";
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg(argv[i]);
+		std::string key = arg.substr(0, arg.find('='));
+		std::string value = (arg.find('=') != std::string::npos) ? arg.substr(arg.find('=') + 1) : "";
+		if (key == "--duration") duration = atof(value.c_str());
+		else if (key == "--formats") formats = splitList(value);
+		else if (key == "--bufflen") {
+			bufflens.clear();
+			std::vector<std::string> l = splitList(value);
+			for (size_t j = 0; j < l.size(); j++) bufflens.push_back((size_t)atol(l[j].c_str()));
+		}
+		else if (key == "--rates") {
+			std::vector<std::string> l = splitList(value);
+			for (size_t j = 0; j < l.size(); j++) rates.push_back(atof(l[j].c_str()));
+		}
+		else if (key == "--replay") devArgs["replay"] = value;
+		else if (key == "--paced") devArgs["sim_paced"] = "1";
+		else if (key == "--agc") agc = true;
+		else if (key == "--iq_correction") correction = true;
+		else if (key == "--out") outPath = value;
+		else if (key == "--startup") startupRadios = (size_t)atol(value.c_str());
+		else if (key == "--sim_latency") simLatency = atof(value.c_str());
+		else {
+			fprintf(stderr, "usage: %s [--duration=<s>] [--formats=CS16,CF32] [--bufflen=<bytes>,...] [--rates=<Hz>,...] [--replay=<file>] [--paced] [--agc] [--iq_correction] [--out=<file>]\n", argv[0]);
+			fprintf(stderr, "       %s --startup=<n> [--sim_latency=<ms>] [--out=<file>]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	SoapySDR_setLogLevel(SOAPY_SDR_WARNING);
+
+	FILE *out = stdout;
+	if (!outPath.empty()) {
+		out = fopen(outPath.c_str(), "w");
+		if (out == NULL) {
+			fprintf(stderr, "icr8600Bench: cannot write %s\n", outPath.c_str());
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (startupRadios > 0) {
+		devArgs["sim_latency"] = std::to_string(simLatency);
+		try {
+			StartupResult serial = runStartup(devArgs, startupRadios, false);
+			StartupResult parallel = runStartup(devArgs, startupRadios, true);
+			writeStartupJson(out, startupRadios, simLatency, serial, parallel);
+		}
+		catch (const std::exception &ex) {
+			fprintf(stderr, "icr8600Bench: %s\n", ex.what());
+			return EXIT_FAILURE;
+		}
+		if (out != stdout) fclose(out);
+		return EXIT_SUCCESS;
+	}
+
+	std::vector<BenchResult> results;
+	try {
+		SoapyICR8600 dev(devArgs);
+		if (rates.empty()) rates = dev.listSampleRates(SOAPY_SDR_RX, 0);
+		if (agc) dev.writeSetting("digital_agc", "true");
+		if (correction) {
+			dev.setDCOffsetMode(SOAPY_SDR_RX, 0, true);
+			dev.setIQBalanceMode(SOAPY_SDR_RX, 0, true);
+		}
+
+		for (size_t f = 0; f < formats.size(); f++) {
+			for (size_t b = 0; b < bufflens.size(); b++) {
+				for (size_t s = 0; s < rates.size(); s++) {
+					fprintf(stderr, "%s bufflen=%zu rate=%.0f\n", formats[f].c_str(), bufflens[b], rates[s]);
+					results.push_back(runCase(dev, formats[f], bufflens[b], rates[s], duration));
+				}
+			}
+		}
+	}
+	catch (const std::exception &ex) {
+		fprintf(stderr, "icr8600Bench: %s\n", ex.what());
+		return EXIT_FAILURE;
+	}
+
+	writeJson(out, devArgs, agc, correction, duration, results);
+	if (out != stdout) fclose(out);
+
+	return EXIT_SUCCESS;
+}
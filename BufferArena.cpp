@@ -0,0 +1,201 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include "BufferArena.h"
+#include <SoapySDR/Logger.h>
+#include <cstdio>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#endif
+
+// mbind policy, numaif.h is part of libnuma which the module does not link
+#define ARENA_MPOL_PREFERRED 1
+
+// used when the huge page size can not be read
+#define ARENA_DEFAULT_HUGE_PAGE (2 * 1024 * 1024)
+
+static size_t roundUp(const size_t size, const size_t unit)
+{
+	return (size + unit - 1) / unit * unit;
+}
+
+size_t BufferArena::pageSize(void)
+{
+#ifdef _WIN32
+	SYSTEM_INFO si;
+	GetSystemInfo(&si);
+	return si.dwPageSize;
+#else
+	return (size_t)sysconf(_SC_PAGESIZE);
+#endif
+}
+
+#if !defined(_WIN32) && defined(MAP_HUGETLB)
+static size_t hugePageSize(void)
+{
+	size_t size = ARENA_DEFAULT_HUGE_PAGE;
+	FILE *f = fopen("/proc/meminfo", "r");
+	if (f == NULL) return size;
+	char line[128];
+	unsigned long kb;
+	while (fgets(line, sizeof(line), f) != NULL) {
+		if (sscanf(line, "Hugepagesize: %lu kB", &kb) == 1) {
+			size = (size_t)kb * 1024;
+			break;
+		}
+	}
+	fclose(f);
+	return size;
+}
+#endif
+
+BufferArena::BufferArena(void) :
+	_base(NULL),
+	_size(0),
+	_used(0),
+	_hugePages(false),
+	_locked(false),
+	_requestHuge(false),
+	_numaNode(-1)
+{
+}
+
+BufferArena::~BufferArena(void)
+{
+	this->release();
+}
+
+bool BufferArena::reserve(const size_t size, const bool hugePages, const int numaNode)
+{
+	if (_base != NULL && size <= _size && hugePages == _requestHuge && numaNode == _numaNode) {
+		this->rewind();
+		return true;
+	}
+	this->release();
+
+	void *p = NULL;
+	size_t mapSize = 0;
+	bool huge = false;
+	bool locked = false;
+
+#ifdef _WIN32
+	const DWORD type = MEM_COMMIT | MEM_RESERVE;
+	const SIZE_T largePage = hugePages ? GetLargePageMinimum() : 0;
+	if (largePage != 0) {
+		// large pages are never paged out, but need SeLockMemoryPrivilege
+		mapSize = roundUp(size, largePage);
+		p = (numaNode >= 0)
+			? VirtualAllocExNuma(GetCurrentProcess(), NULL, mapSize, type | MEM_LARGE_PAGES, PAGE_READWRITE, (DWORD)numaNode)
+			: VirtualAlloc(NULL, mapSize, type | MEM_LARGE_PAGES, PAGE_READWRITE);
+		huge = locked = (p != NULL);
+	}
+	if (p == NULL) {
+		mapSize = roundUp(size, pageSize());
+		p = (numaNode >= 0)
+			? VirtualAllocExNuma(GetCurrentProcess(), NULL, mapSize, type, PAGE_READWRITE, (DWORD)numaNode)
+			: VirtualAlloc(NULL, mapSize, type, PAGE_READWRITE);
+		if (p == NULL) return false;
+		locked = (VirtualLock(p, mapSize) != 0);
+	}
+#else
+#ifdef MAP_HUGETLB
+	if (hugePages) {
+		mapSize = roundUp(size, hugePageSize());
+		p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p == MAP_FAILED) {
+			p = NULL;
+		}
+		huge = (p != NULL);
+	}
+#endif
+	if (p == NULL) {
+		mapSize = roundUp(size, pageSize());
+		p = mmap(NULL, mapSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED) return false;
+#ifdef MADV_HUGEPAGE
+		// no huge pages reserved, transparent ones are the next best thing
+		if (hugePages) madvise(p, mapSize, MADV_HUGEPAGE);
+#endif
+	}
+	if (numaNode >= 0) {
+		// bind before mlock faults the pages in
+#if defined(__linux__) && defined(SYS_mbind)
+		unsigned long mask = 1UL << (numaNode % (8 * sizeof(unsigned long)));
+		if (numaNode >= (int)(8 * sizeof(unsigned long)) ||
+			syscall(SYS_mbind, p, mapSize, ARENA_MPOL_PREFERRED, &mask, 8 * sizeof(unsigned long) + 1, 0) != 0) {
+			SoapySDR_logf(SOAPY_SDR_WARNING, "BufferArena: can not bind the buffers to NUMA node %d", numaNode);
+		}
+#else
+		SoapySDR_logf(SOAPY_SDR_WARNING, "BufferArena: NUMA binding is not supported on this platform");
+#endif
+	}
+	locked = (mlock(p, mapSize) == 0);
+#endif
+
+	if (hugePages && !huge) {
+		SoapySDR_logf(SOAPY_SDR_INFO, "BufferArena: no huge pages available, using normal pages");
+	}
+	if (!locked) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "BufferArena: lock failed, buffers are not pinned");
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "BufferArena: mapped %d bytes%s", (int)mapSize, huge ? " of huge pages" : "");
+
+	_base = (unsigned char *)p;
+	_size = mapSize;
+	_used = 0;
+	_hugePages = huge;
+	_locked = locked;
+	_requestHuge = hugePages;
+	_numaNode = numaNode;
+	return true;
+}
+
+unsigned char *BufferArena::alloc(const size_t bytes, const size_t align)
+{
+	const size_t offset = (_used + align - 1) & ~(align - 1);
+	if (_base == NULL || offset + bytes > _size) return NULL;
+	_used = offset + bytes;
+	return _base + offset;
+}
+
+void BufferArena::rewind(void)
+{
+	_used = 0;
+}
+
+void BufferArena::release(void)
+{
+	if (_base == NULL) return;
+#ifdef _WIN32
+	if (_locked && !_hugePages) VirtualUnlock(_base, _size);
+	VirtualFree(_base, 0, MEM_RELEASE);
+#else
+	if (_locked) munlock(_base, _size);
+	munmap(_base, _size);
+#endif
+	_base = NULL;
+	_size = 0;
+	_used = 0;
+	_hugePages = false;
+	_locked = false;
+}
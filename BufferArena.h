@@ -0,0 +1,64 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include <stddef.h>
+
+// Alignment of the blocks the stream path runs SIMD kernels on
+#define ARENA_ALIGN 64
+
+//
+// One mapping of page aligned memory, locked into RAM, that the stream carves its
+// ring and scratch buffers from. It is optionally backed by huge pages and bound
+// to a NUMA node. The mapping outlives closeStream and is reused by the next
+// setupStream when it is large enough and the placement is the same.
+//
+class BufferArena
+{
+public:
+	BufferArena(void);
+	~BufferArena(void);
+
+	// map at least size bytes, keeping the current mapping when it fits,
+	// false when the memory can not be allocated. numaNode < 0 for no binding
+	bool reserve(const size_t size, const bool hugePages, const int numaNode);
+
+	// a block of bytes aligned to align (a power of two), NULL when the arena is full
+	unsigned char *alloc(const size_t bytes, const size_t align);
+
+	// give back every block, the mapping is kept
+	void rewind(void);
+
+	// unmap
+	void release(void);
+
+	static size_t pageSize(void);
+
+	size_t size(void) const { return _size; }
+	size_t used(void) const { return _used; }
+	bool hugePages(void) const { return _hugePages; }
+	bool locked(void) const { return _locked; }
+
+private:
+	unsigned char *_base;
+	size_t _size;
+	size_t _used;
+	bool _hugePages;
+	bool _locked;
+	bool _requestHuge;
+	int _numaNode;
+};
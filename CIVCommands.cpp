@@ -0,0 +1,675 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "CIVCommands.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+#define decToBcd(val) (UCHAR)((((val) / 10 * 16) + ((val) % 10)))
+#define bcdToDec(val) (ULONG)((val>>4)*10 + (val & 0x0f))
+
+static std::atomic<bool> latencyLog(false);
+
+void ICR8600SetLatencyLog(BOOL enable)
+{
+	latencyLog = (enable != FALSE);
+}
+
+BOOL ICR8600GetLatencyLog(void)
+{
+	return latencyLog ? TRUE : FALSE;
+}
+
+//
+// Take the first complete FE FE ... FD frame out of Pending, with the padding
+// byte the radio adds to odd length frames. Bytes in front of it are dropped.
+//
+static BOOL TakeFrame(std::vector<UCHAR> &Pending, std::vector<UCHAR> &Frame)
+{
+	std::vector<UCHAR>::iterator begin = std::search_n(Pending.begin(), Pending.end(), 2, 0xFE);
+	std::vector<UCHAR>::iterator end = std::find(begin, Pending.end(), 0xFD);
+	if (end == Pending.end()) {
+		Pending.erase(Pending.begin(), begin);
+		return FALSE;
+	}
+	++end;
+	if ((end - begin) % 2 && end != Pending.end() && *end == 0xFF) {
+		++end;
+	}
+	Frame.assign(begin, end);
+	Pending.erase(Pending.begin(), end);
+	return TRUE;
+}
+
+//
+// Frames addressed to the controller (E0) are replies, anything else is a
+// transceive broadcast and goes to the transport's notify callback
+//
+static BOOL IsReply(ICR8600Transport *transport, const std::vector<UCHAR> &Frame)
+{
+	if (Frame.size() >= 6 && Frame[2] == 0xE0 && Frame[3] == 0x96) {
+		return TRUE;
+	}
+	if (transport->NotifyCallback != NULL && Frame.size() >= 6 && Frame[3] == 0x96) {
+		transport->NotifyCallback(Frame.data(), (ULONG)Frame.size(), transport->NotifyContext);
+	}
+	return FALSE;
+}
+
+//
+// Take the first reply out of Pending, transceive frames in front of it go
+// to the notify callback
+//
+static BOOL TakeReply(ICR8600Transport *transport, std::vector<UCHAR> &Pending, std::vector<UCHAR> &Frame)
+{
+	while (TakeFrame(Pending, Frame)) {
+		if (IsReply(transport, Frame)) {
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+//
+// Wait for the next reply until Deadline. While the reader thread owns the
+// response pipe it hands the reply over in Replies; otherwise the pipe is read
+// here, and frames that arrived in the same read are left in Pending.
+//
+static BOOL NextReply(ICR8600Transport *transport, std::vector<UCHAR> &Pending, std::vector<UCHAR> &Frame, std::chrono::steady_clock::time_point Deadline)
+{
+	{
+		std::unique_lock<std::mutex> lock(transport->ReplyMutex);
+		if (transport->ReaderRunning && !transport->ReplyCond.wait_until(lock, Deadline, [transport] { return !transport->Replies.empty(); })) {
+			return FALSE;
+		}
+		if (!transport->Replies.empty()) {
+			Frame.swap(transport->Replies.front());
+			transport->Replies.pop_front();
+			return TRUE;
+		}
+	}
+
+	while (!TakeReply(transport, Pending, Frame)) {
+		long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(Deadline - std::chrono::steady_clock::now()).count();
+		if (remaining <= 0) {
+			return FALSE;
+		}
+		UCHAR szBuffer[64];
+		ULONG n = transport->ReadResponse(szBuffer, sizeof(szBuffer), (ULONG)remaining);
+		if (n == 0) {
+			return FALSE;
+		}
+		Pending.insert(Pending.end(), szBuffer, szBuffer + n);
+	}
+	return TRUE;
+}
+
+//
+// Read one CI-V reply. The radio answers as soon as the command is processed,
+// so this waits until a reply has arrived or CIV_REPLY_TIMEOUT_MS runs out
+// rather than sleeping a fixed time before reading.
+//
+static ULONG ReadReply(ICR8600Transport *transport, PUCHAR Buffer, ULONG Length)
+{
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CIV_REPLY_TIMEOUT_MS);
+	std::vector<UCHAR> pending;
+	std::vector<UCHAR> frame;
+	if (!NextReply(transport, pending, frame, deadline)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "ReadReply: no reply within %d ms", CIV_REPLY_TIMEOUT_MS);
+		return 0;
+	}
+
+	// notifications that came along with the reply go to the notify
+	// callback, acks of posted commands still waited for are kept
+	std::vector<UCHAR> other;
+	while (TakeReply(transport, pending, other)) {
+		std::lock_guard<std::mutex> lock(transport->ReplyMutex);
+		if ((other[4] == 0xFB || other[4] == 0xFA) && transport->Replies.size() < transport->PendingAcks) {
+			transport->Replies.push_back(other);
+		}
+		else {
+			SoapySDR_logf(SOAPY_SDR_DEBUG, "ReadReply: reply %02X with no command waiting, dropped", other[4]);
+		}
+	}
+	ULONG cbRead = std::min<ULONG>(Length, (ULONG)frame.size());
+	std::memcpy(Buffer, frame.data(), cbRead);
+	return cbRead;
+}
+
+//
+// Before a command goes out with no posted acks left, replies that no command
+// waits for any more (late answers to one that timed out) are dropped, so they
+// are not taken for its reply
+//
+static void DropStaleReplies(ICR8600Transport *transport)
+{
+	std::lock_guard<std::mutex> lock(transport->ReplyMutex);
+	if (transport->PendingAcks > 0) {
+		return;
+	}
+	while (!transport->Replies.empty()) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "DropStaleReplies: reply %02X with no command waiting, dropped", transport->Replies.front()[4]);
+		transport->Replies.pop_front();
+	}
+}
+
+static void LogLatency(const UCHAR *cmd, ULONG cmdLen, std::chrono::steady_clock::time_point start, ULONG cbRead)
+{
+	if (!latencyLog) {
+		return;
+	}
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	// opcode and sub-command; the sub-command byte is FD for bare opcodes
+	SoapySDR_logf(SOAPY_SDR_INFO, "CI-V %02X %02X: %s in %.2f ms", cmd[4], cmdLen > 5 ? cmd[5] : 0xFD, cbRead ? "reply" : "timeout", ms);
+}
+
+static BOOL CheckAck(PUCHAR szBuffer, ULONG cbRead)
+{
+	if (cbRead == 0) {
+		SoapySDR_logf(SOAPY_SDR_FATAL, "CheckAck: Read Failed");
+		return FALSE;
+	}
+
+	BOOL bResult = TRUE;
+	if (cbRead == 6) {
+		// FE FE E0 96 FB FD - OK
+		if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFB)
+			SoapySDR_logf(SOAPY_SDR_TRACE, "CheckAck: Valid Command");
+		// FE FE E0 96 FA FD - Fail
+		else if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFA)
+		{
+			SoapySDR_logf(SOAPY_SDR_ERROR, "CheckAck: Invalid Command");
+			bResult = FALSE;
+		}
+		else
+		{
+			SoapySDR_logf(SOAPY_SDR_ERROR, "CheckAck: Unexpected Response %Xh %Xh %Xh %Xh %Xh %Xh", szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5]);
+			bResult = FALSE;
+		}
+	}
+	else {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "CheckAck: Unexpected Response (%d) %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh", cbRead, szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5], szBuffer[6], szBuffer[7],
+			szBuffer[8], szBuffer[9], szBuffer[10], szBuffer[11], szBuffer[12], szBuffer[13], szBuffer[14], szBuffer[15]);
+		bResult = FALSE;
+	}
+
+	return bResult;
+}
+
+BOOL ICR8600CollectAcks(ICR8600Transport *transport)
+{
+	BOOL bResult = TRUE;
+	while (transport->PendingAcks > 0) {
+		transport->PendingAcks--;
+		UCHAR szBuffer[64] = { 0 };
+		if (!CheckAck(szBuffer, ReadReply(transport, szBuffer, sizeof(szBuffer)))) {
+			bResult = FALSE;
+		}
+	}
+	return bResult;
+}
+
+//
+// Write a set command and leave its FB/FA for ICR8600CollectAcks
+//
+static BOOL PostCommand(ICR8600Transport *transport, PUCHAR cmd, ULONG cmdLen)
+{
+	DropStaleReplies(transport);
+	ULONG sent = 0;
+	if (!transport->WriteControl(cmd, cmdLen, &sent)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "PostCommand: Write Failed");
+		return FALSE;
+	}
+	transport->PendingAcks++;
+	return TRUE;
+}
+
+//
+// Write a set command and wait for its FB/FA
+//
+static BOOL SendCommand(ICR8600Transport *transport, PUCHAR cmd, ULONG cmdLen)
+{
+	// replies come back in order, so earlier ones are taken off the pipe first
+	ICR8600CollectAcks(transport);
+	DropStaleReplies(transport);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	ULONG sent = 0;
+	if (!transport->WriteControl(cmd, cmdLen, &sent)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "SendCommand: Write Failed");
+		return FALSE;
+	}
+	UCHAR szBuffer[64] = { 0 };
+	ULONG cbRead = ReadReply(transport, szBuffer, sizeof(szBuffer));
+	LogLatency(cmd, cmdLen, start, cbRead);
+	return CheckAck(szBuffer, cbRead);
+}
+
+//
+// Write a get command and return the length of its reply, 0 on failure
+//
+static ULONG SendQuery(ICR8600Transport *transport, PUCHAR cmd, ULONG cmdLen, PUCHAR response, ULONG responseLen)
+{
+	ICR8600CollectAcks(transport);
+	DropStaleReplies(transport);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	ULONG sent = 0;
+	if (!transport->WriteControl(cmd, cmdLen, &sent)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "SendQuery: Write Failed");
+		return 0;
+	}
+	ULONG cbRead = ReadReply(transport, response, responseLen);
+	LogLatency(cmd, cmdLen, start, cbRead);
+	return cbRead;
+}
+
+
+BOOL ICR8600PostRemoteOn(ICR8600Transport *transport)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600PostRemoteOn");
+	UCHAR remote_on_cmd[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x00, 0x01,  0xFD, 0xFF };
+	return PostCommand(transport, remote_on_cmd, sizeof(remote_on_cmd));
+}
+
+BOOL ICR8600SetRemoteOff(ICR8600Transport *transport)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetRemoteOff");
+	UCHAR remote_off_cmd[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x00, 0x00,  0xFD, 0xFF };
+	return SendCommand(transport, remote_off_cmd, sizeof(remote_off_cmd));
+}
+
+BOOL ICR8600SetSampleRate(ICR8600Transport *transport, ULONG sampleRate)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetSampleRate");
+	UCHAR iq_5120_16bit[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x01,  0xFD, 0xFF };
+	UCHAR iq_3840_16bit[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x02,  0xFD, 0xFF };
+	UCHAR iq_1920_16bit[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x03,  0xFD, 0xFF };
+	UCHAR iq_960_16bit[]  = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x04,  0xFD, 0xFF };
+	UCHAR iq_480_16bit[]  = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x05,  0xFD, 0xFF };
+	UCHAR iq_240_16bit[]  = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x06,  0xFD, 0xFF };
+	if (sampleRate == 240000) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 240000");
+		return SendCommand(transport, iq_240_16bit, sizeof(iq_240_16bit));
+	}
+	if (sampleRate == 480000) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 480000\n");
+		return SendCommand(transport, iq_480_16bit, sizeof(iq_480_16bit));
+	}
+	if (sampleRate == 960000) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 960000\n");
+		return SendCommand(transport, iq_960_16bit, sizeof(iq_960_16bit));
+	}
+	if (sampleRate == 1920000) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 1920000\n");
+		return SendCommand(transport, iq_1920_16bit, sizeof(iq_1920_16bit));
+	}
+	if (sampleRate == 3840000) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 3840000\n");
+		return SendCommand(transport, iq_3840_16bit, sizeof(iq_3840_16bit));
+	}
+	if (sampleRate == 5120000) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 5120000\n");
+		return SendCommand(transport, iq_5120_16bit, sizeof(iq_5120_16bit));
+	}
+	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetSampleRate: Undefined Sample Rate"); 
+	return FALSE;
+}
+
+BOOL ICR8600SetFrequency(ICR8600Transport *transport, ULONG frequency)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetFrequency");
+	ULONG f1 = frequency % 100, f2 = (frequency / 100) % 100, f3 = (frequency / 10000) % 100, f4 = (frequency / 1000000) % 100, f5 = (frequency / 100000000) % 100;
+	UCHAR set_freq[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x05,  decToBcd(f1),decToBcd(f2),decToBcd(f3),decToBcd(f4),decToBcd(f5),  0xFD, 0xFF };
+	return SendCommand(transport, set_freq, sizeof(set_freq));
+}
+
+BOOL ICR8600GetFrequency(ICR8600Transport *transport, PULONG frequency)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetFrequency");
+	UCHAR get_freq[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x03, 0xFD };
+	UCHAR response[64];
+	ULONG recv = 0;
+	recv = SendQuery(transport, get_freq, sizeof(get_freq), response, sizeof(response));
+	if (recv == 12) {
+		*frequency = 0;
+		for (int i = 9; i >= 5; i--) *frequency = *frequency * 100 + bcdToDec(response[i]);
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetFrequency: Frequency = %d", *frequency);
+		return true;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetFrequency: Invalid Command");
+	return false;
+}
+
+//
+// Antenna commands, both Set and Get, will only work if the R8600
+// is tuned to the HF band, otherwise the R8600 will respond 'Invalid Command'
+//
+BOOL ICR8600SetAntenna(ICR8600Transport *transport, ULONG antennaIndex)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetAntenna");
+	UCHAR set_ant[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x12, (UCHAR)(antennaIndex & 0xff),  0xFD, 0xFF };
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetAntenna: Index = %d", antennaIndex);
+	return SendCommand(transport, set_ant, sizeof(set_ant));
+}
+
+BOOL ICR8600GetAntenna(ICR8600Transport *transport, PULONG antennaIndex)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetAntenna");
+	UCHAR set_ant[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x12, 0xFD };
+	UCHAR response[64];
+	ULONG recv = 0;
+	recv = SendQuery(transport, set_ant, sizeof(set_ant), response, sizeof(response));
+	if (recv == 8) {
+		*antennaIndex = (ULONG)response[5];
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAntenna: Index = %d", *antennaIndex);
+		return true;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAntenna: Invalid Command");
+	return false;
+}
+
+BOOL ICR8600SetPreAmpOn(ICR8600Transport *transport)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetPreAmpOn");
+	UCHAR set_preamp[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x16, 0x02, 0x01, 0xFD };
+	return SendCommand(transport, set_preamp, sizeof(set_preamp));
+}
+
+BOOL ICR8600SetPreAmpOff(ICR8600Transport *transport)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetPreAmpOff");
+	UCHAR set_preamp[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x16, 0x02, 0x00, 0xFD };
+	return SendCommand(transport, set_preamp, sizeof(set_preamp));
+}
+
+BOOL ICR8600SetGainRF(ICR8600Transport *transport, ULONG gain)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetGainRF");
+	ULONG g1 = gain % 100, g2 = (gain / 100) % 100;
+	UCHAR set_gain[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x14, 0x02, decToBcd(g2), decToBcd(g1),  0xFD, 0xFF };
+	return SendCommand(transport, set_gain, sizeof(set_gain));
+}
+
+BOOL ICR8600SetAttenuator(ICR8600Transport *transport, ULONG atten)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetAttenuator");
+	UCHAR set_atten[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x11, decToBcd(atten), 0xFD, 0xFF };
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetAttenuator: Attenuator = %d", atten);
+	return SendCommand(transport, set_atten, sizeof(set_atten));
+}
+
+BOOL ICR8600GetGainRF(ICR8600Transport *transport, PULONG gain)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetGainRF");
+	UCHAR set_gain[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x14, 0x02, 0xFD, 0xFF };
+	UCHAR response[64];
+	ULONG recv = 0;
+	recv = SendQuery(transport, set_gain, sizeof(set_gain), response, sizeof(response));
+	if (recv == 10) {
+		ULONG g1 = bcdToDec(response[6]);
+		ULONG g2 = bcdToDec(response[7]);
+		*gain = (g1 * 100) +  g2;
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetGainRF: RF Gain = %d", *gain);
+		return true;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetGainRF: Invalid Command");
+	return false;
+}
+
+BOOL ICR8600GetPreAmpState(ICR8600Transport *transport, PBOOL on)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetPreAmpState");
+	UCHAR set_preamp[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x16, 0x02, 0xFD, 0xFF };
+	UCHAR response[64];
+	ULONG recv = 0;
+	recv = SendQuery(transport, set_preamp, sizeof(set_preamp), response, sizeof(response));
+	if (recv == 8) {
+		if (response[6] == 0x00) {
+			*on = false;
+			SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: OFF");
+			return true;
+		}
+		else if (response[6] == 0x01) {
+			*on = true;
+			SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: ON");
+			return true;
+		}
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: Unexpected Response %Xh", response[6]);
+		return false;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: Invalid Command %d", recv);
+	return false;
+}
+
+BOOL ICR8600GetAttenuator(ICR8600Transport *transport, PULONG gain)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetAttenuator");
+	UCHAR set_gain[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x11, 0xFD };
+	UCHAR response[64];
+	ULONG recv = 0;
+	recv = SendQuery(transport, set_gain, sizeof(set_gain), response, sizeof(response));
+	if (recv == 8) {
+		*gain = bcdToDec(response[5]);
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAttenuator: Gain = %d", *gain);
+		return true;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAttenuator: Invalid Command");
+	return false;
+}
+
+
+/*******************************************************************
+ * Response pipe reader
+ ******************************************************************/
+
+static void ReaderLoop(ICR8600Transport *transport)
+{
+	std::vector<UCHAR> pending;
+	std::vector<UCHAR> frame;
+	while (transport->ReaderRunning) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		UCHAR szBuffer[64];
+		ULONG n = transport->ReadResponse(szBuffer, sizeof(szBuffer), CIV_READER_POLL_MS);
+		if (n == 0) {
+			// a failed read returns at once, do not spin on a radio that is gone
+			std::this_thread::sleep_until(start + std::chrono::milliseconds(CIV_READER_POLL_MS));
+			continue;
+		}
+		pending.insert(pending.end(), szBuffer, szBuffer + n);
+		while (TakeReply(transport, pending, frame)) {
+			std::lock_guard<std::mutex> lock(transport->ReplyMutex);
+			transport->Replies.push_back(frame);
+			transport->ReplyCond.notify_all();
+		}
+	}
+}
+
+void ICR8600StartReader(ICR8600Transport *transport)
+{
+	if (transport->Reader.joinable()) {
+		return;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600StartReader");
+	transport->ReaderRunning = true;
+	transport->Reader = std::thread(&ReaderLoop, transport);
+}
+
+void ICR8600StopReader(ICR8600Transport *transport)
+{
+	if (!transport->Reader.joinable()) {
+		return;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600StopReader");
+	{
+		std::lock_guard<std::mutex> lock(transport->ReplyMutex);
+		transport->ReaderRunning = false;
+	}
+	transport->Reader.join();
+}
+
+
+/*******************************************************************
+ * Command queue
+ ******************************************************************/
+
+size_t CIVCommandQueue::Push(const UCHAR *Payload, size_t Length)
+{
+	std::vector<UCHAR> cmd = { 0xFE, 0xFE, 0x96, 0xE0 };
+	cmd.insert(cmd.end(), Payload, Payload + Length);
+	cmd.push_back(0xFD);
+	if (cmd.size() % 2) {
+		cmd.push_back(0xFF);
+	}
+	commands.push_back(cmd);
+	return commands.size() - 1;
+}
+
+size_t CIVCommandQueue::PushFrequency(ULONG frequency)
+{
+	ULONG f1 = frequency % 100, f2 = (frequency / 100) % 100, f3 = (frequency / 10000) % 100, f4 = (frequency / 1000000) % 100, f5 = (frequency / 100000000) % 100;
+	UCHAR payload[] = { 0x05,  decToBcd(f1),decToBcd(f2),decToBcd(f3),decToBcd(f4),decToBcd(f5) };
+	return Push(payload, sizeof(payload));
+}
+
+size_t CIVCommandQueue::PushPreAmp(BOOL on)
+{
+	UCHAR payload[] = { 0x16, 0x02, (UCHAR)(on ? 0x01 : 0x00) };
+	return Push(payload, sizeof(payload));
+}
+
+size_t CIVCommandQueue::PushGainRF(ULONG gain)
+{
+	ULONG g1 = gain % 100, g2 = (gain / 100) % 100;
+	UCHAR payload[] = { 0x14, 0x02, decToBcd(g2), decToBcd(g1) };
+	return Push(payload, sizeof(payload));
+}
+
+size_t CIVCommandQueue::PushAttenuator(ULONG atten)
+{
+	UCHAR payload[] = { 0x11, decToBcd(atten) };
+	return Push(payload, sizeof(payload));
+}
+
+BOOL CIVCommandQueue::Result(size_t Index) const
+{
+	return Index < results.size() ? results[Index] : FALSE;
+}
+
+BOOL CIVCommandQueue::Submit(ICR8600Transport *transport)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "CIVCommandQueue::Submit: %d commands", (int)commands.size());
+	results.assign(commands.size(), FALSE);
+	ICR8600CollectAcks(transport);
+	DropStaleReplies(transport);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// all commands go out before the first reply is read
+	size_t written = 0;
+	for (; written < commands.size(); written++) {
+		ULONG sent = 0;
+		if (!transport->WriteControl(commands[written].data(), (ULONG)commands[written].size(), &sent)) {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "CIVCommandQueue::Submit: Write Failed at command %d", (int)written);
+			break;
+		}
+	}
+
+	// the radio answers in order, the deadline restarts with every reply
+	std::vector<UCHAR> pending;
+	std::vector<UCHAR> frame;
+	size_t matched = 0;
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CIV_REPLY_TIMEOUT_MS);
+	while (matched < written && NextReply(transport, pending, frame, deadline)) {
+		// FE FE E0 96 FB FD - OK, FE FE E0 96 FA FD - Fail
+		const std::vector<UCHAR> &cmd = commands[matched];
+		results[matched] = (frame[4] == 0xFB && frame[5] == 0xFD);
+		if (!results[matched]) {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "CIVCommandQueue::Submit: command %02X %02X rejected", cmd[4], cmd[5]);
+		}
+		LogLatency(cmd.data(), (ULONG)cmd.size(), start, (ULONG)frame.size());
+		deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(CIV_REPLY_TIMEOUT_MS);
+		matched++;
+	}
+	while (TakeFrame(pending, frame)) {
+		IsReply(transport, frame);
+	}
+
+	if (matched < commands.size()) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "CIVCommandQueue::Submit: %d of %d commands answered", (int)matched, (int)commands.size());
+		return FALSE;
+	}
+	return std::find(results.begin(), results.end(), FALSE) == results.end();
+}
+
+
+/*******************************************************************
+ * Radio state
+ ******************************************************************/
+
+ULONG ICR8600ParseState(const UCHAR *Frame, ULONG Length, PICR8600_STATE State)
+{
+	// FE FE xx 96 cmd [sub] data FD
+	if (Length < 6 || Frame[0] != 0xFE || Frame[1] != 0xFE || Frame[3] != 0x96) {
+		return 0;
+	}
+	const UCHAR *end = std::find(Frame, Frame + Length, 0xFD);
+	const UCHAR *d = Frame + 4;
+	size_t n = end - d;
+
+	if ((d[0] == 0x00 || d[0] == 0x03 || d[0] == 0x05) && n == 6) {
+		ULONG f = 0;
+		for (int i = 5; i >= 1; i--) f = f * 100 + bcdToDec(d[i]);
+		State->Frequency = f;
+		return ICR8600_STATE_FREQUENCY;
+	}
+	if (d[0] == 0x11 && n == 2) {
+		State->Attenuator = bcdToDec(d[1]);
+		return ICR8600_STATE_ATTENUATOR;
+	}
+	if (d[0] == 0x12 && n == 2) {
+		State->AntennaIndex = d[1];
+		return ICR8600_STATE_ANTENNA;
+	}
+	if (d[0] == 0x14 && n == 4 && d[1] == 0x02) {
+		State->GainRF = bcdToDec(d[2]) * 100 + bcdToDec(d[3]);
+		return ICR8600_STATE_GAIN_RF;
+	}
+	if (d[0] == 0x16 && n == 3 && d[1] == 0x02) {
+		State->PreAmpOn = (d[2] != 0x00);
+		return ICR8600_STATE_PREAMP;
+	}
+	return 0;
+}
+
+ULONG ICR8600GetState(ICR8600Transport *transport, PICR8600_STATE State)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetState");
+	ULONG fields = 0;
+	if (ICR8600GetFrequency(transport, &State->Frequency)) fields |= ICR8600_STATE_FREQUENCY;
+	if (ICR8600GetPreAmpState(transport, &State->PreAmpOn)) fields |= ICR8600_STATE_PREAMP;
+	if (ICR8600GetAttenuator(transport, &State->Attenuator)) fields |= ICR8600_STATE_ATTENUATOR;
+	if (ICR8600GetGainRF(transport, &State->GainRF)) fields |= ICR8600_STATE_GAIN_RF;
+
+	// antenna commands only work in the HF band, ANT 1 is used above it
+	if ((fields & ICR8600_STATE_FREQUENCY) && State->Frequency >= 30000000) {
+		State->AntennaIndex = 0;
+		fields |= ICR8600_STATE_ANTENNA;
+	}
+	else if (ICR8600GetAntenna(transport, &State->AntennaIndex)) {
+		fields |= ICR8600_STATE_ANTENNA;
+	}
+	return fields;
+}
@@ -0,0 +1,113 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include "ICR8600Transport.h"
+
+//
+// CI-V commands of the IC-R8600 I/Q port, see the IC-R8600 I/Q reference
+//
+
+// How long a command waits for its reply on the response pipe
+#define CIV_REPLY_TIMEOUT_MS 500
+
+// Log the round trip of every command, per opcode, at INFO level
+void ICR8600SetLatencyLog(BOOL enable);
+BOOL ICR8600GetLatencyLog(void);
+
+// Write remote on without waiting for the radio; the ack is read by the next
+// command or ICR8600CollectAcks, so opening a radio costs no round trip
+BOOL ICR8600PostRemoteOn(ICR8600Transport *transport);
+
+// Read the acks of posted commands, FALSE when one was missing or rejected
+BOOL ICR8600CollectAcks(ICR8600Transport *transport);
+
+// Give the response pipe a reader thread of its own: it hands replies to the
+// command waiting for them and transceive frames to the notify callback as
+// they arrive, also while no command is sent. Without it, every command reads
+// the pipe itself and transceive frames only come in along with replies.
+// The reader has to be stopped before the transport is closed.
+void ICR8600StartReader(ICR8600Transport *transport);
+void ICR8600StopReader(ICR8600Transport *transport);
+
+// How long the reader waits on the pipe at a time, and so at most to stop
+#define CIV_READER_POLL_MS 100
+
+BOOL ICR8600SetRemoteOff(ICR8600Transport *transport);
+BOOL ICR8600SetSampleRate(ICR8600Transport *transport, ULONG sampleRate);
+BOOL ICR8600SetFrequency(ICR8600Transport *transport, ULONG frequency);
+BOOL ICR8600GetFrequency(ICR8600Transport *transport, PULONG frequency);
+BOOL ICR8600SetAntenna(ICR8600Transport *transport, ULONG antennaIndex);
+BOOL ICR8600GetAntenna(ICR8600Transport *transport, PULONG antennaIndex);
+BOOL ICR8600SetPreAmpOn(ICR8600Transport *transport);
+BOOL ICR8600SetPreAmpOff(ICR8600Transport *transport);
+BOOL ICR8600GetPreAmpState(ICR8600Transport *transport, PBOOL on);
+BOOL ICR8600SetGainRF(ICR8600Transport *transport, ULONG gain);
+BOOL ICR8600GetGainRF(ICR8600Transport *transport, PULONG gain);
+BOOL ICR8600SetAttenuator(ICR8600Transport *transport, ULONG atten);
+BOOL ICR8600GetAttenuator(ICR8600Transport *transport, PULONG gain);
+
+//
+// Receiver state, as read back with ICR8600GetState or carried by a transceive
+// frame; both return which of the ICR8600_STATE_* fields they filled in
+//
+typedef struct _ICR8600_STATE {
+	ULONG Frequency;
+	ULONG AntennaIndex;
+	BOOL PreAmpOn;
+	ULONG Attenuator;
+	ULONG GainRF;
+} ICR8600_STATE, *PICR8600_STATE;
+
+#define ICR8600_STATE_FREQUENCY  0x01
+#define ICR8600_STATE_ANTENNA    0x02
+#define ICR8600_STATE_PREAMP     0x04
+#define ICR8600_STATE_ATTENUATOR 0x08
+#define ICR8600_STATE_GAIN_RF    0x10
+#define ICR8600_STATE_ALL        0x1F
+
+ULONG ICR8600GetState(ICR8600Transport *transport, PICR8600_STATE State);
+ULONG ICR8600ParseState(const UCHAR *Frame, ULONG Length, PICR8600_STATE State);
+
+//
+// Set commands written back to back with their FB/FA replies matched in order,
+// so a retune together with its gain plan, or a burst of gain changes, costs
+// about one round trip instead of one per command. Replies not addressed to the controller (transceive
+// broadcasts) are skipped.
+//
+class CIVCommandQueue
+{
+public:
+	// Queue one command, Payload is the opcode and its data; returns its index
+	size_t Push(const UCHAR *Payload, size_t Length);
+
+	size_t PushFrequency(ULONG frequency);
+	size_t PushPreAmp(BOOL on);
+	size_t PushGainRF(ULONG gain);
+	size_t PushAttenuator(ULONG atten);
+
+	// Send everything queued, TRUE when every command was accepted
+	BOOL Submit(ICR8600Transport *transport);
+
+	// Outcome of command Index in the last Submit
+	BOOL Result(size_t Index) const;
+
+	size_t Size(void) const { return commands.size(); }
+
+private:
+	std::vector<std::vector<UCHAR> > commands;
+	std::vector<BOOL> results;
+};
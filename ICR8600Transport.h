@@ -0,0 +1,159 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <SoapySDR/Types.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "WinUSBDevice.h"
+
+//
+// Byte level access to the receiver: CI-V commands go out on the control pipe,
+// replies come back on the response pipe and I/Q samples on the I/Q pipe.
+// The CI-V helpers and the streaming code only talk to the radio through this.
+//
+typedef VOID (*ICR8600_NOTIFY_CALLBACK)(const UCHAR *Frame, ULONG Length, PVOID Context);
+
+class ICR8600Transport
+{
+public:
+	ICR8600Transport(void) : NotifyCallback(NULL), NotifyContext(NULL), PendingAcks(0), ReaderRunning(false) {}
+	virtual ~ICR8600Transport(void) {}
+
+	// CI-V frames the radio sends on its own (transceive), handed over by the
+	// CI-V layer when it finds them among the replies
+	ICR8600_NOTIFY_CALLBACK NotifyCallback;
+	PVOID NotifyContext;
+
+	// FB/FA replies of commands written without waiting for them, collected
+	// by the CI-V layer before the next command goes out
+	ULONG PendingAcks;
+
+	// Replies no command has taken yet, oldest first: acks of posted commands
+	// that arrived in one read with an earlier reply, or, while the CI-V reader
+	// thread owns the response pipe, every reply it read (see ICR8600StartReader)
+	std::mutex ReplyMutex;
+	std::condition_variable ReplyCond;
+	std::deque<std::vector<UCHAR> > Replies;
+	std::thread Reader;
+	std::atomic<bool> ReaderRunning;
+
+	virtual BOOL GetDescriptor(USB_DEVICE_DESCRIPTOR *Desc) = 0;
+
+	// CI-V command, padded by the caller
+	virtual BOOL WriteControl(PUCHAR Buffer, ULONG Length, PULONG Written) = 0;
+
+	// CI-V reply bytes that arrived within TimeoutMs, returns their count or 0 on failure or timeout
+	virtual ULONG ReadResponse(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs) = 0;
+
+	// Raw I/Q words, sync words included, whatever arrived within TimeoutMs (0 waits forever)
+	virtual ULONG ReadIQ(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs) = 0;
+
+	// Same contract as ICR8600ReadPipeAsync
+	virtual BOOL ReadIQAsync(ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength) = 0;
+
+	virtual VOID CancelIQAsync(void) = 0;
+};
+
+//
+// IC-R8600 on USB, WinUSB on Windows and libusb elsewhere
+//
+class USBTransport : public ICR8600Transport
+{
+public:
+	USBTransport(void);
+	~USBTransport(void);
+
+	// Serial and Path as in ICR8600_DEVICE_INFO, empty for any radio
+	HRESULT Open(PBOOL FailureDeviceNotFound, const char *Serial, const char *Path);
+	const ICR8600_DEVICE_INFO &GetInfo(void) const { return deviceData.Info; }
+
+	BOOL GetDescriptor(USB_DEVICE_DESCRIPTOR *Desc);
+	BOOL WriteControl(PUCHAR Buffer, ULONG Length, PULONG Written);
+	ULONG ReadResponse(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs);
+	ULONG ReadIQ(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs);
+	BOOL ReadIQAsync(ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength);
+	VOID CancelIQAsync(void);
+
+private:
+	DEVICE_DATA deviceData;
+};
+
+//
+// In-process IC-R8600: answers CI-V commands like the radio does (FB/FA, get replies
+// padded to an even length) and produces I/Q at the configured sample rate with a
+// sync word every SIM_SYNC_INTERVAL words. Selected with the "sim=1" device argument.
+//
+//   sim_paced=0     produce I/Q as fast as it is read instead of in real time
+//   replay=<file>   loop a raw capture of the I/Q pipe instead of the test tone
+//   sim_latency=<ms> delay every CI-V reply by a round trip, replies stay in order
+//   sim_dial=<ms>   turn the tuning dial 1 kHz up every <ms>, broadcast as transceive
+//
+#define SIM_SYNC_INTERVAL 1024
+
+class SimTransport : public ICR8600Transport
+{
+public:
+	SimTransport(const SoapySDR::Kwargs &args);
+
+	BOOL GetDescriptor(USB_DEVICE_DESCRIPTOR *Desc);
+	BOOL WriteControl(PUCHAR Buffer, ULONG Length, PULONG Written);
+	ULONG ReadResponse(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs);
+	ULONG ReadIQ(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs);
+	BOOL ReadIQAsync(ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength);
+	VOID CancelIQAsync(void);
+
+private:
+	void reply(const std::vector<UCHAR> &payload, UCHAR to = 0xE0);
+	void ack(BOOL ok);
+	void handleCommand(const UCHAR *cmd, size_t len);
+	void turnDial(void);
+	void fillIQ(PUCHAR Buffer, ULONG Length);
+
+	// radio state, as set over CI-V or with the dial, under replyMutex
+	ULONG sampleRate;
+	ULONG frequency;
+	UCHAR antenna;
+	UCHAR preamp;
+	UCHAR attenuator;
+	ULONG gainRF;
+	BOOL remoteOn;
+
+	std::mutex replyMutex;
+	std::condition_variable replyCond;
+	std::deque<std::vector<UCHAR> > replies;
+	std::deque<std::chrono::steady_clock::time_point> replyTimes;
+	std::chrono::steady_clock::duration latency;
+	std::chrono::steady_clock::duration dialPeriod;
+	std::chrono::steady_clock::time_point dialNext;
+
+	// I/Q source: a test tone or a replayed capture, both looped
+	bool paced;
+	bool replay;
+	std::vector<uint32_t> source;
+	size_t sourcePos;
+	size_t syncPos;
+	unsigned long long wordsSent;
+	std::atomic<bool> cancelAsync;
+	std::atomic<bool> asyncRunning;
+};
@@ -0,0 +1,891 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "IQConvert.h"
+#include <math.h>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define IQ_CONVERT_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define IQ_CONVERT_NEON
+#include <arm_neon.h>
+#endif
+
+// GCC and clang need the instruction set enabled per function,
+// MSVC accepts the intrinsics without it
+#if defined(__GNUC__) || defined(__clang__)
+#define IQ_TARGET(x) __attribute__((target(x)))
+#else
+#define IQ_TARGET(x)
+#endif
+
+// 1/32768 is a power of two, so multiplying gives exactly the same result as dividing
+#define CS16_SCALE (1.0f / 32768)
+
+struct SyncWordList
+{
+	size_t *pos;
+	size_t max;
+	size_t count;
+};
+
+typedef void (*ConvertCS16ToCF32Fn)(const int16_t *in, float *out, size_t numElems);
+typedef void (*ConvertCorrectedFn)(const int16_t *in, float *out, size_t numElems, const IQCorrectionCoeffs &coeffs, IQMoments &moments);
+typedef void (*ConvertCF32ToCS16Fn)(const float *in, int16_t *out, size_t numElems);
+typedef float (*SumSquaresFn)(const float *in, size_t numElems);
+typedef void (*ScaleRampFn)(float *iq, size_t numElems, float gain, float step);
+typedef void (*RotateFn)(float *iq, const float *rot, size_t numElems, float re, float im);
+typedef void (*FirFn)(const float *in, const float *taps, size_t numTaps, float *out, size_t numOut);
+typedef void (*FirInterpFn)(const float *in, const float *taps0, const float *taps1, float frac, size_t numTaps, float *out);
+typedef size_t (*RemoveSyncWordsFn)(uint32_t *words, size_t numWords, SyncWordList &markers);
+
+static inline void addMarker(SyncWordList &markers, size_t pos)
+{
+	if (markers.count < markers.max) markers.pos[markers.count] = pos;
+	markers.count++;
+}
+
+// Record the sync words of one block: bit b of drop is set for each one.
+// n is the output index of the block, so a word lands at n plus the kept words before it.
+static inline void addMarkers(SyncWordList &markers, size_t n, unsigned drop)
+{
+	unsigned dropped = 0;
+	for (unsigned b = 0; (drop >> b) != 0; b++) {
+		if (drop & (1u << b)) addMarker(markers, n + b - dropped++);
+	}
+}
+
+/*******************************************************************
+ * Scalar
+ ******************************************************************/
+
+static void convertCS16ToCF32Scalar(const int16_t *in, float *out, size_t numElems)
+{
+	for (size_t i = 0; i < 2 * numElems; i++) {
+		out[i] = (float)(in[i]) / 32768;
+	}
+}
+
+static void convertCorrectedScalar(const int16_t *in, float *out, size_t numElems, const IQCorrectionCoeffs &coeffs, IQMoments &moments)
+{
+	float sumI = 0, sumQ = 0, sumII = 0, sumQQ = 0, sumIQ = 0;
+	for (size_t k = 0; k < numElems; k++) {
+		float i = (float)(in[2 * k]) * CS16_SCALE;
+		float q = (float)(in[2 * k + 1]) * CS16_SCALE;
+		sumI += i;
+		sumQ += q;
+		sumII += i * i;
+		sumQQ += q * q;
+		sumIQ += i * q;
+		float yi = i - coeffs.dcI;
+		float yq = q - coeffs.dcQ;
+		out[2 * k] = yi;
+		out[2 * k + 1] = coeffs.gain * yq + coeffs.cross * yi;
+	}
+	moments.sumI += sumI;
+	moments.sumQ += sumQ;
+	moments.sumII += sumII;
+	moments.sumQQ += sumQQ;
+	moments.sumIQ += sumIQ;
+}
+
+static void convertCF32ToCS16Scalar(const float *in, int16_t *out, size_t numElems)
+{
+	for (size_t i = 0; i < 2 * numElems; i++) {
+		float v = in[i] * 32768.0f;
+		v = v < -32768.0f ? -32768.0f : (v > 32767.0f ? 32767.0f : v);
+		out[i] = (int16_t)lrintf(v);
+	}
+}
+
+static float sumSquaresScalar(const float *in, size_t numElems)
+{
+	float sum = 0;
+	for (size_t i = 0; i < 2 * numElems; i++) {
+		sum += in[i] * in[i];
+	}
+	return sum;
+}
+
+static void scaleRampScalar(float *iq, size_t numElems, float gain, float step)
+{
+	for (size_t k = 0; k < numElems; k++) {
+		float g = gain + (float)k * step;
+		iq[2 * k] *= g;
+		iq[2 * k + 1] *= g;
+	}
+}
+
+static void rotateScalar(float *iq, const float *rot, size_t numElems, float re, float im)
+{
+	for (size_t k = 0; k < numElems; k++) {
+		float wr = rot[2 * k] * re - rot[2 * k + 1] * im;
+		float wi = rot[2 * k] * im + rot[2 * k + 1] * re;
+		float xr = iq[2 * k], xi = iq[2 * k + 1];
+		iq[2 * k] = xr * wr - xi * wi;
+		iq[2 * k + 1] = xr * wi + xi * wr;
+	}
+}
+
+static void firScalar(const float *in, const float *taps, size_t numTaps, float *out, size_t numOut)
+{
+	for (size_t m = 0; m < numOut; m++) {
+		const float *x = in + 2 * m;
+		float re = 0, im = 0;
+		for (size_t k = 0; k < numTaps; k++) {
+			re += taps[k] * x[2 * k];
+			im += taps[k] * x[2 * k + 1];
+		}
+		out[2 * m] = re;
+		out[2 * m + 1] = im;
+	}
+}
+
+static void firInterpScalar(const float *in, const float *taps0, const float *taps1, float frac, size_t numTaps, float *out)
+{
+	float re = 0, im = 0;
+	for (size_t k = 0; k < numTaps; k++) {
+		float t = taps0[k] + frac * (taps1[k] - taps0[k]);
+		re += t * in[2 * k];
+		im += t * in[2 * k + 1];
+	}
+	out[0] = re;
+	out[1] = im;
+}
+
+// Compacts words [i, end) to output index n, every word is written and only kept ones advance n
+static size_t removeSyncWordsRange(uint32_t *words, size_t i, size_t end, size_t n, SyncWordList &markers)
+{
+	for (; i < end; i++) {
+		uint32_t w = words[i];
+		bool sync = (w == IQ_SYNC_WORD);
+		words[n] = w;
+		if (sync) addMarker(markers, n);
+		n += !sync;
+	}
+	return n;
+}
+
+static size_t removeSyncWordsScalar(uint32_t *words, size_t numWords, SyncWordList &markers)
+{
+	return removeSyncWordsRange(words, 0, numWords, 0, markers);
+}
+
+/*******************************************************************
+ * x86: SSE2, AVX2, AVX-512
+ ******************************************************************/
+
+#ifdef IQ_CONVERT_X86
+
+IQ_TARGET("sse2")
+static void convertCS16ToCF32SSE2(const int16_t *in, float *out, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	const __m128 scale = _mm_set1_ps(CS16_SCALE);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		// sign extend by unpacking into the upper half and shifting down
+		__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+		__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+		_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+		_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+	}
+	convertCS16ToCF32Scalar(in + i, out + i, (n - i) / 2);
+}
+
+IQ_TARGET("avx2")
+static void convertCS16ToCF32AVX2(const int16_t *in, float *out, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	const __m256 scale = _mm256_set1_ps(CS16_SCALE);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i lo = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)));
+		__m256i hi = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i + 8)));
+		_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(lo), scale));
+		_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(hi), scale));
+	}
+	convertCS16ToCF32Scalar(in + i, out + i, (n - i) / 2);
+}
+
+IQ_TARGET("avx512f")
+static void convertCS16ToCF32AVX512(const int16_t *in, float *out, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	const __m512 scale = _mm512_set1_ps(CS16_SCALE);
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32) {
+		__m512i lo = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(in + i)));
+		__m512i hi = _mm512_cvtepi16_epi32(_mm256_loadu_si256((const __m256i *)(in + i + 16)));
+		_mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(lo), scale));
+		_mm512_storeu_ps(out + i + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(hi), scale));
+	}
+	convertCS16ToCF32Scalar(in + i, out + i, (n - i) / 2);
+}
+
+// Vectors hold I, Q, I, Q: the moments are summed per lane and the lanes of
+// the same parity added at the end, I*Q comes from multiplying with the pair swapped
+IQ_TARGET("sse2")
+static void convertCorrectedSSE2(const int16_t *in, float *out, size_t numElems, const IQCorrectionCoeffs &coeffs, IQMoments &moments)
+{
+	const size_t n = 2 * numElems;
+	const __m128 scale = _mm_set1_ps(CS16_SCALE);
+	const __m128 dc = _mm_setr_ps(coeffs.dcI, coeffs.dcQ, coeffs.dcI, coeffs.dcQ);
+	const __m128 diag = _mm_setr_ps(1.0f, coeffs.gain, 1.0f, coeffs.gain);
+	const __m128 cross = _mm_setr_ps(0.0f, coeffs.cross, 0.0f, coeffs.cross);
+	__m128 sum = _mm_setzero_ps(), sq = _mm_setzero_ps(), prod = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+		__m128 x[2];
+		x[0] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale);
+		x[1] = _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale);
+		for (int h = 0; h < 2; h++) {
+			__m128 xs = _mm_shuffle_ps(x[h], x[h], _MM_SHUFFLE(2, 3, 0, 1));
+			sum = _mm_add_ps(sum, x[h]);
+			sq = _mm_add_ps(sq, _mm_mul_ps(x[h], x[h]));
+			prod = _mm_add_ps(prod, _mm_mul_ps(x[h], xs));
+			__m128 y = _mm_sub_ps(x[h], dc);
+			__m128 ys = _mm_shuffle_ps(y, y, _MM_SHUFFLE(2, 3, 0, 1));
+			_mm_storeu_ps(out + i + 4 * h, _mm_add_ps(_mm_mul_ps(y, diag), _mm_mul_ps(ys, cross)));
+		}
+	}
+	float s[4], q[4], p[4];
+	_mm_storeu_ps(s, sum);
+	_mm_storeu_ps(q, sq);
+	_mm_storeu_ps(p, prod);
+	moments.sumI += s[0] + s[2];
+	moments.sumQ += s[1] + s[3];
+	moments.sumII += q[0] + q[2];
+	moments.sumQQ += q[1] + q[3];
+	moments.sumIQ += (p[0] + p[1] + p[2] + p[3]) / 2;
+	convertCorrectedScalar(in + i, out + i, (n - i) / 2, coeffs, moments);
+}
+
+IQ_TARGET("sse2")
+static void convertCF32ToCS16SSE2(const float *in, int16_t *out, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	const __m128 scale = _mm_set1_ps(32768.0f);
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		// round to nearest, out of range values become 0x80000000 and are clamped by the pack
+		__m128 lo = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i), scale), _mm_set1_ps(32767.0f));
+		__m128 hi = _mm_min_ps(_mm_mul_ps(_mm_loadu_ps(in + i + 4), scale), _mm_set1_ps(32767.0f));
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(lo), _mm_cvtps_epi32(hi)));
+	}
+	convertCF32ToCS16Scalar(in + i, out + i, (n - i) / 2);
+}
+
+IQ_TARGET("sse2")
+static float sumSquaresSSE2(const float *in, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m128 a = _mm_loadu_ps(in + i);
+		__m128 b = _mm_loadu_ps(in + i + 4);
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(a, a));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(b, b));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+	return lanes[0] + lanes[1] + lanes[2] + lanes[3] + sumSquaresScalar(in + i, (n - i) / 2);
+}
+
+IQ_TARGET("sse2")
+static void scaleRampSSE2(float *iq, size_t numElems, float gain, float step)
+{
+	// gains of two complex samples, each repeated for I and Q
+	__m128 g = _mm_setr_ps(gain, gain, gain + step, gain + step);
+	const __m128 dg = _mm_set1_ps(2 * step);
+	size_t k = 0;
+	for (; k + 2 <= numElems; k += 2) {
+		_mm_storeu_ps(iq + 2 * k, _mm_mul_ps(_mm_loadu_ps(iq + 2 * k), g));
+		g = _mm_add_ps(g, dg);
+	}
+	scaleRampScalar(iq + 2 * k, numElems - k, gain + (float)k * step, step);
+}
+
+IQ_TARGET("avx2")
+static void convertCorrectedAVX2(const int16_t *in, float *out, size_t numElems, const IQCorrectionCoeffs &coeffs, IQMoments &moments)
+{
+	const size_t n = 2 * numElems;
+	const __m256 scale = _mm256_set1_ps(CS16_SCALE);
+	const __m256 dc = _mm256_setr_ps(coeffs.dcI, coeffs.dcQ, coeffs.dcI, coeffs.dcQ, coeffs.dcI, coeffs.dcQ, coeffs.dcI, coeffs.dcQ);
+	const __m256 diag = _mm256_setr_ps(1.0f, coeffs.gain, 1.0f, coeffs.gain, 1.0f, coeffs.gain, 1.0f, coeffs.gain);
+	const __m256 cross = _mm256_setr_ps(0.0f, coeffs.cross, 0.0f, coeffs.cross, 0.0f, coeffs.cross, 0.0f, coeffs.cross);
+	__m256 sum = _mm256_setzero_ps(), sq = _mm256_setzero_ps(), prod = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		__m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(in + i)))), scale);
+		__m256 xs = _mm256_permute_ps(x, 0xB1);
+		sum = _mm256_add_ps(sum, x);
+		sq = _mm256_add_ps(sq, _mm256_mul_ps(x, x));
+		prod = _mm256_add_ps(prod, _mm256_mul_ps(x, xs));
+		__m256 y = _mm256_sub_ps(x, dc);
+		__m256 ys = _mm256_permute_ps(y, 0xB1);
+		_mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(y, diag), _mm256_mul_ps(ys, cross)));
+	}
+	float s[8], q[8], p[8];
+	_mm256_storeu_ps(s, sum);
+	_mm256_storeu_ps(q, sq);
+	_mm256_storeu_ps(p, prod);
+	for (int l = 0; l < 8; l += 2) {
+		moments.sumI += s[l];
+		moments.sumQ += s[l + 1];
+		moments.sumII += q[l];
+		moments.sumQQ += q[l + 1];
+		moments.sumIQ += p[l];
+	}
+	// GCC leaves the vzeroupper out before this tail call, the SSE code after it
+	// would run with the upper halves dirty
+	_mm256_zeroupper();
+	convertCorrectedScalar(in + i, out + i, (n - i) / 2, coeffs, moments);
+}
+
+IQ_TARGET("avx2")
+static void convertCF32ToCS16AVX2(const float *in, int16_t *out, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	const __m256 scale = _mm256_set1_ps(32768.0f);
+	const __m256 max = _mm256_set1_ps(32767.0f);
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256i lo = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i), scale), max));
+		__m256i hi = _mm256_cvtps_epi32(_mm256_min_ps(_mm256_mul_ps(_mm256_loadu_ps(in + i + 8), scale), max));
+		// the pack works per 128 bit lane, put the quarters back in order
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i *)(out + i), packed);
+	}
+	convertCF32ToCS16Scalar(in + i, out + i, (n - i) / 2);
+}
+
+IQ_TARGET("avx2")
+static float sumSquaresAVX2(const float *in, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16) {
+		__m256 a = _mm256_loadu_ps(in + i);
+		__m256 b = _mm256_loadu_ps(in + i + 8);
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(a, a));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(b, b));
+	}
+	float lanes[8];
+	_mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+	float sum = 0;
+	for (int l = 0; l < 8; l++) sum += lanes[l];
+	return sum + sumSquaresScalar(in + i, (n - i) / 2);
+}
+
+IQ_TARGET("avx2")
+static void scaleRampAVX2(float *iq, size_t numElems, float gain, float step)
+{
+	__m256 g = _mm256_setr_ps(gain, gain, gain + step, gain + step,
+		gain + 2 * step, gain + 2 * step, gain + 3 * step, gain + 3 * step);
+	const __m256 dg = _mm256_set1_ps(4 * step);
+	size_t k = 0;
+	for (; k + 4 <= numElems; k += 4) {
+		_mm256_storeu_ps(iq + 2 * k, _mm256_mul_ps(_mm256_loadu_ps(iq + 2 * k), g));
+		g = _mm256_add_ps(g, dg);
+	}
+	scaleRampScalar(iq + 2 * k, numElems - k, gain + (float)k * step, step);
+}
+
+// Complex multiply of two I, Q, I, Q vectors: the real parts of b repeated times a,
+// plus the imaginary parts repeated times a with the pairs swapped and I negated
+IQ_TARGET("sse2")
+static inline __m128 complexMulSSE2(__m128 a, __m128 b)
+{
+	const __m128 negI = _mm_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f);
+	__m128 br = _mm_shuffle_ps(b, b, _MM_SHUFFLE(2, 2, 0, 0));
+	__m128 bi = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 3, 1, 1));
+	__m128 as = _mm_xor_ps(_mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1)), negI);
+	return _mm_add_ps(_mm_mul_ps(a, br), _mm_mul_ps(as, bi));
+}
+
+IQ_TARGET("sse2")
+static void rotateSSE2(float *iq, const float *rot, size_t numElems, float re, float im)
+{
+	const __m128 w = _mm_setr_ps(re, im, re, im);
+	size_t k = 0;
+	for (; k + 2 <= numElems; k += 2) {
+		__m128 r = complexMulSSE2(_mm_loadu_ps(rot + 2 * k), w);
+		_mm_storeu_ps(iq + 2 * k, complexMulSSE2(_mm_loadu_ps(iq + 2 * k), r));
+	}
+	rotateScalar(iq + 2 * k, rot + 2 * k, numElems - k, re, im);
+}
+
+// The FIR kernels keep consecutive outputs in the lanes and broadcast one tap at
+// a time, even and odd taps go to separate sums to shorten the add chains
+IQ_TARGET("sse2")
+static void firSSE2(const float *in, const float *taps, size_t numTaps, float *out, size_t numOut)
+{
+	size_t m = 0;
+	for (; m + 4 <= numOut; m += 4) {
+		const float *x = in + 2 * m;
+		__m128 a0 = _mm_setzero_ps(), a1 = _mm_setzero_ps(), b0 = _mm_setzero_ps(), b1 = _mm_setzero_ps();
+		size_t k = 0;
+		for (; k + 2 <= numTaps; k += 2) {
+			__m128 ta = _mm_set1_ps(taps[k]);
+			__m128 tb = _mm_set1_ps(taps[k + 1]);
+			a0 = _mm_add_ps(a0, _mm_mul_ps(ta, _mm_loadu_ps(x + 2 * k)));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(ta, _mm_loadu_ps(x + 2 * k + 4)));
+			b0 = _mm_add_ps(b0, _mm_mul_ps(tb, _mm_loadu_ps(x + 2 * k + 2)));
+			b1 = _mm_add_ps(b1, _mm_mul_ps(tb, _mm_loadu_ps(x + 2 * k + 6)));
+		}
+		if (k < numTaps) {
+			__m128 ta = _mm_set1_ps(taps[k]);
+			a0 = _mm_add_ps(a0, _mm_mul_ps(ta, _mm_loadu_ps(x + 2 * k)));
+			a1 = _mm_add_ps(a1, _mm_mul_ps(ta, _mm_loadu_ps(x + 2 * k + 4)));
+		}
+		_mm_storeu_ps(out + 2 * m, _mm_add_ps(a0, b0));
+		_mm_storeu_ps(out + 2 * m + 4, _mm_add_ps(a1, b1));
+	}
+	firScalar(in + 2 * m, taps, numTaps, out + 2 * m, numOut - m);
+}
+
+// A single output: the taps are repeated for I and Q, four at a time
+IQ_TARGET("sse2")
+static void firInterpSSE2(const float *in, const float *taps0, const float *taps1, float frac, size_t numTaps, float *out)
+{
+	const __m128 f = _mm_set1_ps(frac);
+	__m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+	size_t k = 0;
+	for (; k + 4 <= numTaps; k += 4) {
+		__m128 t0 = _mm_loadu_ps(taps0 + k);
+		__m128 t = _mm_add_ps(t0, _mm_mul_ps(f, _mm_sub_ps(_mm_loadu_ps(taps1 + k), t0)));
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_unpacklo_ps(t, t), _mm_loadu_ps(in + 2 * k)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_unpackhi_ps(t, t), _mm_loadu_ps(in + 2 * k + 4)));
+	}
+	float lanes[4];
+	_mm_storeu_ps(lanes, _mm_add_ps(acc0, acc1));
+	float rest[2];
+	firInterpScalar(in + 2 * k, taps0 + k, taps1 + k, frac, numTaps - k, rest);
+	out[0] = lanes[0] + lanes[2] + rest[0];
+	out[1] = lanes[1] + lanes[3] + rest[1];
+}
+
+IQ_TARGET("sse2")
+static size_t removeSyncWordsSSE2(uint32_t *words, size_t numWords, SyncWordList &markers)
+{
+	const __m128i sync = _mm_set1_epi32((int)IQ_SYNC_WORD);
+	size_t i = 0, n = 0;
+	for (; i + 4 <= numWords; i += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(words + i));
+		int drop = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(v, sync)));
+		if (drop == 0) {
+			_mm_storeu_si128((__m128i *)(words + n), v);
+			n += 4;
+		}
+		else {
+			// SSE2 has no lane shuffle by mask, blocks with a sync word are rare
+			n = removeSyncWordsRange(words, i, i + 4, n, markers);
+		}
+	}
+	return removeSyncWordsRange(words, i, numWords, n, markers);
+}
+
+IQ_TARGET("avx2")
+static inline __m256 complexMulAVX2(__m256 a, __m256 b)
+{
+	const __m256 negI = _mm256_setr_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f);
+	__m256 br = _mm256_moveldup_ps(b);
+	__m256 bi = _mm256_movehdup_ps(b);
+	__m256 as = _mm256_xor_ps(_mm256_permute_ps(a, 0xB1), negI);
+	return _mm256_add_ps(_mm256_mul_ps(a, br), _mm256_mul_ps(as, bi));
+}
+
+IQ_TARGET("avx2")
+static void rotateAVX2(float *iq, const float *rot, size_t numElems, float re, float im)
+{
+	const __m256 w = _mm256_setr_ps(re, im, re, im, re, im, re, im);
+	size_t k = 0;
+	for (; k + 4 <= numElems; k += 4) {
+		__m256 r = complexMulAVX2(_mm256_loadu_ps(rot + 2 * k), w);
+		_mm256_storeu_ps(iq + 2 * k, complexMulAVX2(_mm256_loadu_ps(iq + 2 * k), r));
+	}
+	_mm256_zeroupper();
+	rotateScalar(iq + 2 * k, rot + 2 * k, numElems - k, re, im);
+}
+
+IQ_TARGET("avx2")
+static void firAVX2(const float *in, const float *taps, size_t numTaps, float *out, size_t numOut)
+{
+	size_t m = 0;
+	for (; m + 8 <= numOut; m += 8) {
+		const float *x = in + 2 * m;
+		__m256 a0 = _mm256_setzero_ps(), a1 = _mm256_setzero_ps(), b0 = _mm256_setzero_ps(), b1 = _mm256_setzero_ps();
+		size_t k = 0;
+		for (; k + 2 <= numTaps; k += 2) {
+			__m256 ta = _mm256_set1_ps(taps[k]);
+			__m256 tb = _mm256_set1_ps(taps[k + 1]);
+			a0 = _mm256_add_ps(a0, _mm256_mul_ps(ta, _mm256_loadu_ps(x + 2 * k)));
+			a1 = _mm256_add_ps(a1, _mm256_mul_ps(ta, _mm256_loadu_ps(x + 2 * k + 8)));
+			b0 = _mm256_add_ps(b0, _mm256_mul_ps(tb, _mm256_loadu_ps(x + 2 * k + 2)));
+			b1 = _mm256_add_ps(b1, _mm256_mul_ps(tb, _mm256_loadu_ps(x + 2 * k + 10)));
+		}
+		if (k < numTaps) {
+			__m256 ta = _mm256_set1_ps(taps[k]);
+			a0 = _mm256_add_ps(a0, _mm256_mul_ps(ta, _mm256_loadu_ps(x + 2 * k)));
+			a1 = _mm256_add_ps(a1, _mm256_mul_ps(ta, _mm256_loadu_ps(x + 2 * k + 8)));
+		}
+		_mm256_storeu_ps(out + 2 * m, _mm256_add_ps(a0, b0));
+		_mm256_storeu_ps(out + 2 * m + 8, _mm256_add_ps(a1, b1));
+	}
+	_mm256_zeroupper();
+	firScalar(in + 2 * m, taps, numTaps, out + 2 * m, numOut - m);
+}
+
+IQ_TARGET("avx2")
+static void firInterpAVX2(const float *in, const float *taps0, const float *taps1, float frac, size_t numTaps, float *out)
+{
+	const __m256 f = _mm256_set1_ps(frac);
+	__m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+	size_t k = 0;
+	for (; k + 8 <= numTaps; k += 8) {
+		__m256 t0 = _mm256_loadu_ps(taps0 + k);
+		__m256 t = _mm256_add_ps(t0, _mm256_mul_ps(f, _mm256_sub_ps(_mm256_loadu_ps(taps1 + k), t0)));
+		// t0 t0 t1 t1 t2 t2 t3 t3 and t4 t4 ... t7 t7
+		__m256 lo = _mm256_unpacklo_ps(t, t);
+		__m256 hi = _mm256_unpackhi_ps(t, t);
+		acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(_mm256_permute2f128_ps(lo, hi, 0x20), _mm256_loadu_ps(in + 2 * k)));
+		acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(_mm256_permute2f128_ps(lo, hi, 0x31), _mm256_loadu_ps(in + 2 * k + 8)));
+	}
+	float lanes[8];
+	_mm256_storeu_ps(lanes, _mm256_add_ps(acc0, acc1));
+	_mm256_zeroupper();
+	float rest[2];
+	firInterpScalar(in + 2 * k, taps0 + k, taps1 + k, frac, numTaps - k, rest);
+	out[0] = lanes[0] + lanes[2] + lanes[4] + lanes[6] + rest[0];
+	out[1] = lanes[1] + lanes[3] + lanes[5] + lanes[7] + rest[1];
+}
+
+// Left-pack permutations for AVX2: entry k moves the lanes set in k to the front
+struct LeftPackTable
+{
+	alignas(32) uint32_t idx[256][8];
+	uint8_t popcount[256];
+
+	LeftPackTable(void)
+	{
+		for (unsigned k = 0; k < 256; k++) {
+			unsigned n = 0;
+			for (unsigned b = 0; b < 8; b++) {
+				if (k & (1u << b)) idx[k][n++] = b;
+			}
+			popcount[k] = (uint8_t)n;
+			for (; n < 8; n++) idx[k][n] = 0;
+		}
+	}
+};
+
+static const LeftPackTable &getLeftPackTable(void)
+{
+	static const LeftPackTable table;
+	return table;
+}
+
+IQ_TARGET("avx2")
+static size_t removeSyncWordsAVX2(uint32_t *words, size_t numWords, SyncWordList &markers)
+{
+	const LeftPackTable &table = getLeftPackTable();
+	const __m256i sync = _mm256_set1_epi32((int)IQ_SYNC_WORD);
+	size_t i = 0, n = 0;
+	for (; i + 8 <= numWords; i += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(words + i));
+		unsigned drop = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(v, sync)));
+		unsigned keep = ~drop & 0xFF;
+		if (drop != 0) addMarkers(markers, n, drop);
+		// the full store stays inside the block just read, so compacting in place is safe
+		__m256i perm = _mm256_load_si256((const __m256i *)table.idx[keep]);
+		_mm256_storeu_si256((__m256i *)(words + n), _mm256_permutevar8x32_epi32(v, perm));
+		n += table.popcount[keep];
+	}
+	return removeSyncWordsRange(words, i, numWords, n, markers);
+}
+
+IQ_TARGET("avx512f")
+static size_t removeSyncWordsAVX512(uint32_t *words, size_t numWords, SyncWordList &markers)
+{
+	const LeftPackTable &table = getLeftPackTable();
+	const __m512i sync = _mm512_set1_epi32((int)IQ_SYNC_WORD);
+	size_t i = 0, n = 0;
+	for (; i + 16 <= numWords; i += 16) {
+		__m512i v = _mm512_loadu_si512((const void *)(words + i));
+		unsigned drop = (unsigned)_mm512_cmpeq_epi32_mask(v, sync);
+		if (drop != 0) addMarkers(markers, n, drop);
+		_mm512_mask_compressstoreu_epi32((void *)(words + n), (__mmask16)~drop, v);
+		n += 16 - table.popcount[drop & 0xFF] - table.popcount[drop >> 8];
+	}
+	return removeSyncWordsRange(words, i, numWords, n, markers);
+}
+
+#ifdef _MSC_VER
+// CPU feature bits and the register state the OS saves on context switches
+static bool cpuHasAVX2(void)
+{
+	int regs[4];
+	__cpuid(regs, 1);
+	if ((regs[2] & (1 << 27)) == 0) return false; // OSXSAVE
+	if ((_xgetbv(0) & 0x6) != 0x6) return false; // XMM, YMM
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 5)) != 0;
+}
+
+static bool cpuHasAVX512F(void)
+{
+	int regs[4];
+	if (!cpuHasAVX2()) return false;
+	if ((_xgetbv(0) & 0xE6) != 0xE6) return false; // XMM, YMM, opmask, ZMM
+	__cpuidex(regs, 7, 0);
+	return (regs[1] & (1 << 16)) != 0;
+}
+
+static bool cpuHasSSE2(void)
+{
+	int regs[4];
+	__cpuid(regs, 1);
+	return (regs[3] & (1 << 26)) != 0;
+}
+#else
+static bool cpuHasAVX2(void) { return __builtin_cpu_supports("avx2"); }
+static bool cpuHasAVX512F(void) { return __builtin_cpu_supports("avx512f"); }
+static bool cpuHasSSE2(void) { return __builtin_cpu_supports("sse2"); }
+#endif
+
+#endif // IQ_CONVERT_X86
+
+/*******************************************************************
+ * ARM: NEON
+ ******************************************************************/
+
+#ifdef IQ_CONVERT_NEON
+
+static void convertCS16ToCF32NEON(const int16_t *in, float *out, size_t numElems)
+{
+	const size_t n = 2 * numElems;
+	size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		int16x8_t v = vld1q_s16(in + i);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(v)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(v)));
+		vst1q_f32(out + i, vmulq_n_f32(lo, CS16_SCALE));
+		vst1q_f32(out + i + 4, vmulq_n_f32(hi, CS16_SCALE));
+	}
+	convertCS16ToCF32Scalar(in + i, out + i, (n - i) / 2);
+}
+
+static size_t removeSyncWordsNEON(uint32_t *words, size_t numWords, SyncWordList &markers)
+{
+	const uint32x4_t sync = vdupq_n_u32(IQ_SYNC_WORD);
+	size_t i = 0, n = 0;
+	for (; i + 4 <= numWords; i += 4) {
+		uint32x4_t v = vld1q_u32(words + i);
+		uint32x4_t eq = vceqq_u32(v, sync);
+		uint32x2_t any = vorr_u32(vget_low_u32(eq), vget_high_u32(eq));
+		if ((vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0) {
+			vst1q_u32(words + n, v);
+			n += 4;
+		}
+		else {
+			n = removeSyncWordsRange(words, i, i + 4, n, markers);
+		}
+	}
+	return removeSyncWordsRange(words, i, numWords, n, markers);
+}
+
+#endif // IQ_CONVERT_NEON
+
+/*******************************************************************
+ * Dispatch
+ ******************************************************************/
+
+// The float kernels have no AVX-512 or NEON versions, the AVX2 ones resp. the
+// scalar ones (which compilers vectorize for NEON) are used there
+struct IQKernels
+{
+	ConvertCS16ToCF32Fn convert;
+	ConvertCorrectedFn convertCorrected;
+	ConvertCF32ToCS16Fn convertBack;
+	SumSquaresFn sumSquares;
+	ScaleRampFn scaleRamp;
+	RotateFn rotate;
+	FirFn fir;
+	FirInterpFn firInterp;
+	RemoveSyncWordsFn removeSync;
+	const char *name;
+};
+
+static IQKernels selectKernels(void)
+{
+	IQKernels kernels = { &convertCS16ToCF32Scalar, &convertCorrectedScalar, &convertCF32ToCS16Scalar, &sumSquaresScalar, &scaleRampScalar, &rotateScalar, &firScalar, &firInterpScalar, &removeSyncWordsScalar, "scalar" };
+#ifdef IQ_CONVERT_X86
+	if (cpuHasAVX2()) {
+		kernels.convertCorrected = &convertCorrectedAVX2;
+		kernels.convertBack = &convertCF32ToCS16AVX2;
+		kernels.sumSquares = &sumSquaresAVX2;
+		kernels.scaleRamp = &scaleRampAVX2;
+		kernels.rotate = &rotateAVX2;
+		kernels.fir = &firAVX2;
+		kernels.firInterp = &firInterpAVX2;
+	}
+	else if (cpuHasSSE2()) {
+		kernels.convertCorrected = &convertCorrectedSSE2;
+		kernels.convertBack = &convertCF32ToCS16SSE2;
+		kernels.sumSquares = &sumSquaresSSE2;
+		kernels.scaleRamp = &scaleRampSSE2;
+		kernels.rotate = &rotateSSE2;
+		kernels.fir = &firSSE2;
+		kernels.firInterp = &firInterpSSE2;
+	}
+
+	if (cpuHasAVX512F()) {
+		kernels.convert = &convertCS16ToCF32AVX512;
+		kernels.removeSync = &removeSyncWordsAVX512;
+		kernels.name = "avx512";
+	}
+	else if (cpuHasAVX2()) {
+		kernels.convert = &convertCS16ToCF32AVX2;
+		kernels.removeSync = &removeSyncWordsAVX2;
+		kernels.name = "avx2";
+	}
+	else if (cpuHasSSE2()) {
+		kernels.convert = &convertCS16ToCF32SSE2;
+		kernels.removeSync = &removeSyncWordsSSE2;
+		kernels.name = "sse2";
+	}
+#endif
+#ifdef IQ_CONVERT_NEON
+	kernels.convert = &convertCS16ToCF32NEON;
+	kernels.removeSync = &removeSyncWordsNEON;
+	kernels.name = "neon";
+#endif
+	return kernels;
+}
+
+static const IQKernels &getKernels(void)
+{
+	// initialized once, thread safe in C++11
+	static const IQKernels kernels = selectKernels();
+	return kernels;
+}
+
+void convertCS16ToCF32(const int16_t *in, float *out, size_t numElems)
+{
+	getKernels().convert(in, out, numElems);
+}
+
+// The kernels sum the moments in float, chunks keep the rounding error small
+#define IQ_MOMENT_CHUNK 4096
+
+void convertCS16ToCF32Corrected(const int16_t *in, float *out, size_t numElems, const IQCorrectionCoeffs &coeffs, IQMoments &moments)
+{
+	const ConvertCorrectedFn fn = getKernels().convertCorrected;
+	for (size_t k = 0; k < numElems; k += IQ_MOMENT_CHUNK) {
+		size_t n = (numElems - k < IQ_MOMENT_CHUNK) ? numElems - k : IQ_MOMENT_CHUNK;
+		fn(in + 2 * k, out + 2 * k, n, coeffs, moments);
+	}
+}
+
+void convertCF32ToCS16(const float *in, int16_t *out, size_t numElems)
+{
+	getKernels().convertBack(in, out, numElems);
+}
+
+float sumSquaresCF32(const float *in, size_t numElems)
+{
+	return getKernels().sumSquares(in, numElems);
+}
+
+void scaleRampCF32(float *iq, size_t numElems, float gain, float step)
+{
+	getKernels().scaleRamp(iq, numElems, gain, step);
+}
+
+void rotateCF32(float *iq, const float *rot, size_t numElems, float re, float im)
+{
+	getKernels().rotate(iq, rot, numElems, re, im);
+}
+
+void firCF32(const float *in, const float *taps, size_t numTaps, float *out, size_t numOut)
+{
+	getKernels().fir(in, taps, numTaps, out, numOut);
+}
+
+void firInterpCF32(const float *in, const float *taps0, const float *taps1, float frac, size_t numTaps, float *out)
+{
+	getKernels().firInterp(in, taps0, taps1, frac, numTaps, out);
+}
+
+size_t removeSyncWords(uint32_t *words, size_t numWords, size_t *markers, size_t maxMarkers, size_t *numMarkers)
+{
+	SyncWordList list = { markers, maxMarkers, 0 };
+	size_t n = getKernels().removeSync(words, numWords, list);
+	if (numMarkers != NULL) *numMarkers = list.count;
+	return n;
+}
+
+const char *iqKernelName(void)
+{
+	return getKernels().name;
+}
+
+template <RemoveSyncWordsFn fn>
+static size_t removeSyncWordsVariant(uint32_t *words, size_t numWords, size_t *markers, size_t maxMarkers, size_t *numMarkers)
+{
+	SyncWordList list = { markers, maxMarkers, 0 };
+	size_t n = fn(words, numWords, list);
+	if (numMarkers != NULL) *numMarkers = list.count;
+	return n;
+}
+
+size_t iqKernelVariants(IQKernelVariant *variants, size_t maxVariants)
+{
+	IQKernelVariant all[4];
+	size_t count = 0;
+	IQKernelVariant scalar = { "scalar", &convertCS16ToCF32Scalar, &removeSyncWordsVariant<&removeSyncWordsScalar> };
+	all[count++] = scalar;
+#ifdef IQ_CONVERT_X86
+	if (cpuHasSSE2()) {
+		IQKernelVariant sse2 = { "sse2", &convertCS16ToCF32SSE2, &removeSyncWordsVariant<&removeSyncWordsSSE2> };
+		all[count++] = sse2;
+	}
+	if (cpuHasAVX2()) {
+		IQKernelVariant avx2 = { "avx2", &convertCS16ToCF32AVX2, &removeSyncWordsVariant<&removeSyncWordsAVX2> };
+		all[count++] = avx2;
+	}
+	if (cpuHasAVX512F()) {
+		IQKernelVariant avx512 = { "avx512", &convertCS16ToCF32AVX512, &removeSyncWordsVariant<&removeSyncWordsAVX512> };
+		all[count++] = avx512;
+	}
+#endif
+#ifdef IQ_CONVERT_NEON
+	IQKernelVariant neon = { "neon", &convertCS16ToCF32NEON, &removeSyncWordsVariant<&removeSyncWordsNEON> };
+	all[count++] = neon;
+#endif
+	for (size_t i = 0; i < count && i < maxVariants; i++) {
+		variants[i] = all[i];
+	}
+	return (count < maxVariants) ? count : maxVariants;
+}
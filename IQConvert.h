@@ -0,0 +1,93 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+//
+// Sample format conversion and processing kernels for the stream path.
+// The best kernel for the running CPU is picked on first use.
+//
+
+// Sync word 00 80 00 80 the radio inserts into the I/Q stream, read as a little endian word
+#define IQ_SYNC_WORD 0x80008000
+
+// Convert numElems complex int16 samples to complex float, scaled by 1/32768
+void convertCS16ToCF32(const int16_t *in, float *out, size_t numElems);
+
+// DC offset and IQ balance, as full scale floats: with y = x - (dcI, dcQ) the
+// corrected sample is I = yI, Q = gain * yQ + cross * yI
+struct IQCorrectionCoeffs
+{
+	float dcI;
+	float dcQ;
+	float gain;
+	float cross;
+};
+
+// Sums over the uncorrected input, as full scale floats
+struct IQMoments
+{
+	double sumI;
+	double sumQ;
+	double sumII;
+	double sumQQ;
+	double sumIQ;
+};
+
+// convertCS16ToCF32 with the correction applied in the same pass. The moments of
+// the input are added to moments for the estimator, so the data is read only once.
+void convertCS16ToCF32Corrected(const int16_t *in, float *out, size_t numElems, const IQCorrectionCoeffs &coeffs, IQMoments &moments);
+
+// Convert numElems complex float samples back to complex int16, scaled by 32768, rounded and saturated
+void convertCF32ToCS16(const float *in, int16_t *out, size_t numElems);
+
+// Sum of I*I + Q*Q over numElems complex float samples
+float sumSquaresCF32(const float *in, size_t numElems);
+
+// Scale numElems complex float samples in place, sample k by gain + k * step
+void scaleRampCF32(float *iq, size_t numElems, float gain, float step);
+
+// Multiply numElems complex float samples in place, sample k by rot[k] * (re + j im)
+void rotateCF32(float *iq, const float *rot, size_t numElems, float re, float im);
+
+// FIR filter with real taps over complex float samples, output m is the sum of
+// taps[k] * in[m + k] for k below numTaps
+void firCF32(const float *in, const float *taps, size_t numTaps, float *out, size_t numOut);
+
+// One output of firCF32 with the taps interpolated, taps0 + frac * (taps1 - taps0)
+void firInterpCF32(const float *in, const float *taps0, const float *taps1, float frac, size_t numTaps, float *out);
+
+// Drop the sync words from numWords CS16 samples in place and return the number of samples left.
+// The output index of every dropped word is stored in markers, up to maxMarkers of them;
+// numMarkers receives the total count.
+size_t removeSyncWords(uint32_t *words, size_t numWords, size_t *markers, size_t maxMarkers, size_t *numMarkers);
+
+// Instruction set of the kernels selected for this CPU
+const char *iqKernelName(void);
+
+// A build of convertCS16ToCF32 and removeSyncWords for one instruction set
+struct IQKernelVariant
+{
+	const char *name;
+	void (*convert)(const int16_t *in, float *out, size_t numElems);
+	size_t (*removeSync)(uint32_t *words, size_t numWords, size_t *markers, size_t maxMarkers, size_t *numMarkers);
+};
+
+// Fill variants with the builds this CPU runs, scalar first, and return how many
+// were written, at most maxVariants. For the unit tests, which hold them against scalar.
+size_t iqKernelVariants(IQKernelVariant *variants, size_t maxVariants);
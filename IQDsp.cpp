@@ -0,0 +1,510 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include "IQDsp.h"
+#include "IQConvert.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+/*******************************************************************
+ * Digital AGC
+ ******************************************************************/
+
+DigitalAGC::DigitalAGC(void) :
+	_enabled(false),
+	_attack(IQ_AGC_DEFAULT_ATTACK),
+	_decay(IQ_AGC_DEFAULT_DECAY),
+	_level(IQ_AGC_DEFAULT_LEVEL)
+{
+	this->reset();
+}
+
+void DigitalAGC::reset(void)
+{
+	_power = 0;
+	_gain = 1.0f;
+	_reset = true;
+}
+
+// one pole smoothing factor for a time constant, per block
+static double blockCoeff(const double seconds, const double sampleRate)
+{
+	if (seconds <= 0 || sampleRate <= 0) return 1.0;
+	return 1.0 - std::exp(-(double)IQ_AGC_BLOCK / (seconds * sampleRate));
+}
+
+void DigitalAGC::process(float *iq, const size_t numElems, const double sampleRate)
+{
+	const double attack = blockCoeff(_attack, sampleRate);
+	const double decay = blockCoeff(_decay, sampleRate);
+	const double target = std::pow(10.0, _level / 10.0);
+	const double maxGain = std::pow(10.0, IQ_AGC_MAX_GAIN / 20.0);
+
+	for (size_t i = 0; i < numElems; i += IQ_AGC_BLOCK) {
+		size_t n = (numElems - i < IQ_AGC_BLOCK) ? numElems - i : IQ_AGC_BLOCK;
+		float *block = iq + 2 * i;
+
+		// mean power of the block, a partial block counts for its share
+		double power = sumSquaresCF32(block, n) / n;
+		if (_reset) {
+			_power = power;
+			_reset = false;
+		}
+		else {
+			double a = (power > _power) ? attack : decay;
+			if (n != IQ_AGC_BLOCK) a = 1.0 - std::pow(1.0 - a, (double)n / IQ_AGC_BLOCK);
+			_power += a * (power - _power);
+		}
+
+		double gain = (_power > 0) ? std::sqrt(target / _power) : maxGain;
+		if (gain > maxGain) gain = maxGain;
+
+		// ramp from the previous gain so the updates do not click
+		float step = ((float)gain - _gain) / n;
+		scaleRampCF32(block, n, _gain + step, step);
+		_gain = (float)gain;
+	}
+}
+
+/*******************************************************************
+ * DC offset and IQ balance
+ ******************************************************************/
+
+// index of the coefficients in _manual and _estimate
+enum { DC_I, DC_Q, IQ_GAIN, IQ_CROSS };
+
+IQCorrector::IQCorrector(void) :
+	_dcAuto(false),
+	_iqAuto(false)
+{
+	_manual[DC_I] = 0.0f;
+	_manual[DC_Q] = 0.0f;
+	_manual[IQ_GAIN] = 1.0f;
+	_manual[IQ_CROSS] = 0.0f;
+	this->reset();
+}
+
+void IQCorrector::setDCOffset(const std::complex<double> &offset)
+{
+	_manual[DC_I] = (float)offset.real();
+	_manual[DC_Q] = (float)offset.imag();
+}
+
+void IQCorrector::setIQBalance(const std::complex<double> &balance)
+{
+	_manual[IQ_GAIN] = (float)balance.real();
+	_manual[IQ_CROSS] = (float)balance.imag();
+}
+
+std::complex<double> IQCorrector::dcOffset(void) const
+{
+	const std::atomic<float> *c = _dcAuto ? _estimate : _manual;
+	return std::complex<double>(c[DC_I], c[DC_Q]);
+}
+
+std::complex<double> IQCorrector::iqBalance(void) const
+{
+	const std::atomic<float> *c = _iqAuto ? _estimate : _manual;
+	return std::complex<double>(c[IQ_GAIN], c[IQ_CROSS]);
+}
+
+bool IQCorrector::enabled(void) const
+{
+	return _dcAuto || _iqAuto || _manual[DC_I] != 0.0f || _manual[DC_Q] != 0.0f ||
+		_manual[IQ_GAIN] != 1.0f || _manual[IQ_CROSS] != 0.0f;
+}
+
+void IQCorrector::reset(void)
+{
+	_mean[0] = _mean[1] = 0;
+	_cov[0] = _cov[1] = _cov[2] = 0;
+	_estimate[DC_I] = 0.0f;
+	_estimate[DC_Q] = 0.0f;
+	_estimate[IQ_GAIN] = 1.0f;
+	_estimate[IQ_CROSS] = 0.0f;
+	_reset = true;
+}
+
+void IQCorrector::process(const int16_t *in, float *out, const size_t numElems, const double sampleRate)
+{
+	const bool dcAuto = _dcAuto;
+	const bool iqAuto = _iqAuto;
+	const std::atomic<float> *dc = dcAuto ? _estimate : _manual;
+	const std::atomic<float> *iq = iqAuto ? _estimate : _manual;
+	IQCorrectionCoeffs coeffs = { dc[DC_I], dc[DC_Q], iq[IQ_GAIN], iq[IQ_CROSS] };
+
+	IQMoments m = { 0, 0, 0, 0, 0 };
+	convertCS16ToCF32Corrected(in, out, numElems, coeffs, m);
+	if ((!dcAuto && !iqAuto) || numElems == 0 || sampleRate <= 0) return;
+
+	// moments of this call, folded into the running estimates with a weight for its length
+	const double n = (double)numElems;
+	const double mean[2] = { m.sumI / n, m.sumQ / n };
+	const double cov[3] = { m.sumII / n - mean[0] * mean[0], m.sumQQ / n - mean[1] * mean[1], m.sumIQ / n - mean[0] * mean[1] };
+	const double a = _reset ? 1.0 : 1.0 - std::exp(-n / (IQ_DC_TIME * sampleRate));
+	const double b = _reset ? 1.0 : 1.0 - std::exp(-n / (IQ_BALANCE_TIME * sampleRate));
+	_reset = false;
+	for (int k = 0; k < 2; k++) _mean[k] += a * (mean[k] - _mean[k]);
+	for (int k = 0; k < 3; k++) _cov[k] += b * (cov[k] - _cov[k]);
+
+	_estimate[DC_I] = (float)_mean[0];
+	_estimate[DC_Q] = (float)_mean[1];
+
+	// Q - rho * I is uncorrelated with I, its power is cQQ - rho * cIQ
+	const double rho = (_cov[0] > 0) ? _cov[2] / _cov[0] : 0.0;
+	const double residual = _cov[1] - rho * _cov[2];
+	if (_cov[0] > 0 && residual > 0) {
+		double gain = std::sqrt(_cov[0] / residual);
+		_estimate[IQ_GAIN] = (float)gain;
+		_estimate[IQ_CROSS] = (float)(-rho * gain);
+	}
+}
+
+/*******************************************************************
+ * NCO mixer
+ ******************************************************************/
+
+// M_PI needs _USE_MATH_DEFINES on MSVC
+#define IQ_PI 3.14159265358979323846
+
+// e^(j 2 pi k / 2^B) and e^(j 2 pi k / 2^2B) for the top 2B bits of a phase
+struct SinCosTable
+{
+	float coarse[2 << IQ_NCO_TABLE_BITS];
+	float fine[2 << IQ_NCO_TABLE_BITS];
+
+	SinCosTable(void)
+	{
+		const double step = 2 * IQ_PI / (1 << IQ_NCO_TABLE_BITS);
+		for (int k = 0; k < (1 << IQ_NCO_TABLE_BITS); k++) {
+			coarse[2 * k] = (float)std::cos(k * step);
+			coarse[2 * k + 1] = (float)std::sin(k * step);
+			fine[2 * k] = (float)std::cos(k * step / (1 << IQ_NCO_TABLE_BITS));
+			fine[2 * k + 1] = (float)std::sin(k * step / (1 << IQ_NCO_TABLE_BITS));
+		}
+	}
+};
+
+static const SinCosTable &getSinCosTable(void)
+{
+	static const SinCosTable table;
+	return table;
+}
+
+NCOMixer::NCOMixer(void) :
+	_frequency(0.0),
+	_rotFrequency(0.0),
+	_rotRate(0.0),
+	_increment(0)
+{
+	for (int k = 0; k < 2 * IQ_NCO_BLOCK; k++) _rot[k] = 0.0f;
+}
+
+void NCOMixer::process(float *iq, const size_t numElems, const unsigned long long tick, const double sampleRate)
+{
+	const double frequency = _frequency;
+	if (frequency == 0.0 || sampleRate <= 0) return;
+
+	if (frequency != _rotFrequency || sampleRate != _rotRate) {
+		// cycles per sample as a 64 bit fraction of a turn, negative shifts wrap around
+		double cycles = std::fmod(frequency / sampleRate, 1.0);
+		if (cycles < 0) cycles += 1.0;
+		if (cycles >= 1.0) cycles = 0.0;
+		_increment = (uint64_t)(cycles * 18446744073709551616.0);
+		for (int k = 0; k < IQ_NCO_BLOCK; k++) {
+			double phase = 2 * IQ_PI * std::fmod(cycles * k, 1.0);
+			_rot[2 * k] = (float)std::cos(phase);
+			_rot[2 * k + 1] = (float)std::sin(phase);
+		}
+		_rotFrequency = frequency;
+		_rotRate = sampleRate;
+	}
+
+	const SinCosTable &table = getSinCosTable();
+	const unsigned shift = 64 - IQ_NCO_TABLE_BITS;
+	const uint64_t mask = (1 << IQ_NCO_TABLE_BITS) - 1;
+	for (size_t i = 0; i < numElems; i += IQ_NCO_BLOCK) {
+		size_t n = (numElems - i < IQ_NCO_BLOCK) ? numElems - i : IQ_NCO_BLOCK;
+
+		// phase of the first sample of the block, wrapping like the accumulator would
+		uint64_t phase = _increment * (uint64_t)(tick + i);
+		const float *c = &table.coarse[2 * (phase >> shift)];
+		const float *f = &table.fine[2 * ((phase >> (shift - IQ_NCO_TABLE_BITS)) & mask)];
+		float re = c[0] * f[0] - c[1] * f[1];
+		float im = c[0] * f[1] + c[1] * f[0];
+		rotateCF32(iq + 2 * i, _rot, n, re, im);
+	}
+}
+
+/*******************************************************************
+ * Resampler
+ ******************************************************************/
+
+// Kaiser window for 80 dB of stopband attenuation
+#define IQ_KAISER_BETA 7.857
+
+// Modified Bessel function of the first kind, order 0
+static double besselI0(const double x)
+{
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 50 && term > 1e-12 * sum; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+// Kaiser window at x in [-1, 1]
+static double kaiser(const double x)
+{
+	if (x <= -1.0 || x >= 1.0) return 0.0;
+	return besselI0(IQ_KAISER_BETA * std::sqrt(1.0 - x * x)) / besselI0(IQ_KAISER_BETA);
+}
+
+static double sinc(const double x)
+{
+	if (x == 0.0) return 1.0;
+	return std::sin(IQ_PI * x) / (IQ_PI * x);
+}
+
+// The side taps of the half-band filter, the same for every stage
+struct HalfBandTaps
+{
+	float taps[IQ_HALFBAND_TAPS];
+
+	HalfBandTaps(void)
+	{
+		// full filter of 2 * IQ_HALFBAND_TAPS - 1 taps, side tap i is number 2 * i,
+		// normalized so they add up to the 0.5 of the center
+		const int center = IQ_HALFBAND_TAPS - 1;
+		double sum = 0;
+		double h[IQ_HALFBAND_TAPS];
+		for (int i = 0; i < IQ_HALFBAND_TAPS; i++) {
+			int n = 2 * i - center;
+			h[i] = 0.5 * sinc(n / 2.0) * kaiser((double)n / (center + 1));
+			sum += h[i];
+		}
+		for (int i = 0; i < IQ_HALFBAND_TAPS; i++) taps[i] = (float)(0.5 * h[i] / sum);
+	}
+};
+
+static const HalfBandTaps &getHalfBandTaps(void)
+{
+	static const HalfBandTaps taps;
+	return taps;
+}
+
+// pairs of history the filter needs before the new ones
+#define HALFBAND_HISTORY (IQ_HALFBAND_TAPS - 1)
+
+HalfBandDecimator::HalfBandDecimator(void)
+{
+	this->reset();
+}
+
+void HalfBandDecimator::reset(void)
+{
+	_even.assign(2 * HALFBAND_HISTORY, 0.0f);
+	_odd.assign(2 * HALFBAND_HISTORY, 0.0f);
+	_pending = false;
+}
+
+size_t HalfBandDecimator::process(const float *in, const size_t numElems, float *out)
+{
+	// grown once to the largest call, the history stays at the front
+	const size_t pairs = (numElems + (_pending ? 1 : 0)) / 2;
+	if (_even.size() < 2 * (HALFBAND_HISTORY + pairs)) {
+		_even.resize(2 * (HALFBAND_HISTORY + pairs));
+		_odd.resize(2 * (HALFBAND_HISTORY + pairs));
+	}
+
+	float *even = _even.data() + 2 * HALFBAND_HISTORY;
+	float *odd = _odd.data() + 2 * HALFBAND_HISTORY;
+	size_t k = 0, p = 0;
+	if (_pending && numElems > 0) {
+		even[0] = _held[0];
+		even[1] = _held[1];
+		odd[0] = in[0];
+		odd[1] = in[1];
+		k = 1;
+		p = 1;
+		_pending = false;
+	}
+	for (; k + 2 <= numElems; k += 2, p++) {
+		even[2 * p] = in[2 * k];
+		even[2 * p + 1] = in[2 * k + 1];
+		odd[2 * p] = in[2 * k + 2];
+		odd[2 * p + 1] = in[2 * k + 3];
+	}
+	if (k < numElems) {
+		_held[0] = in[2 * k];
+		_held[1] = in[2 * k + 1];
+		_pending = true;
+	}
+
+	// output m: even samples m to m + IQ_HALFBAND_TAPS - 1, odd sample m + IQ_HALFBAND_TAPS / 2 - 1
+	firCF32(_even.data(), getHalfBandTaps().taps, IQ_HALFBAND_TAPS, out, pairs);
+	const float *center = _odd.data() + 2 * (IQ_HALFBAND_TAPS / 2 - 1);
+	for (size_t m = 0; m < 2 * pairs; m++) out[m] += 0.5f * center[m];
+
+	std::memmove(_even.data(), _even.data() + 2 * pairs, 2 * HALFBAND_HISTORY * sizeof(float));
+	std::memmove(_odd.data(), _odd.data() + 2 * pairs, 2 * HALFBAND_HISTORY * sizeof(float));
+	return pairs;
+}
+
+PolyphaseResampler::PolyphaseResampler(void) :
+	_ratio(1.0),
+	_numTaps(0),
+	_fill(0),
+	_pos(0)
+{
+}
+
+void PolyphaseResampler::configure(const double ratio)
+{
+	_ratio = ratio;
+
+	// Kaiser estimate for a transition of 0.2 of the output rate, a multiple of 8 for the kernels
+	size_t n = (size_t)std::ceil(72.0 / (2.285 * 2 * IQ_PI * 0.2 / ratio));
+	_numTaps = std::max<size_t>(16, (n + 7) / 8 * 8);
+
+	// continuous filter h(t) over [0, _numTaps] input samples, cutoff at half the output rate
+	const double cutoff = 0.5 / ratio;
+	const size_t length = _numTaps * IQ_POLYPHASE_PHASES;
+	std::vector<double> h(length + 1);
+	double sum = 0;
+	for (size_t q = 0; q <= length; q++) {
+		double t = (double)q / IQ_POLYPHASE_PHASES - _numTaps / 2.0;
+		h[q] = 2 * cutoff * sinc(2 * cutoff * t) * kaiser(t / (_numTaps / 2.0));
+		sum += h[q];
+	}
+	// unity gain at DC for every phase
+	const double scale = IQ_POLYPHASE_PHASES / sum;
+
+	// phase p tap i weighs sample n - (_numTaps - 1 - i) of an output at n + p / IQ_POLYPHASE_PHASES
+	_table.assign((IQ_POLYPHASE_PHASES + 1) * _numTaps, 0.0f);
+	for (size_t p = 0; p <= IQ_POLYPHASE_PHASES; p++) {
+		for (size_t i = 0; i < _numTaps; i++) {
+			size_t q = (_numTaps - 1 - i) * IQ_POLYPHASE_PHASES + p;
+			_table[p * _numTaps + i] = (q <= length) ? (float)(h[q] * scale) : 0.0f;
+		}
+	}
+	this->reset();
+}
+
+void PolyphaseResampler::reset(void)
+{
+	// the first output is at the first new sample
+	_fill = _numTaps - 1;
+	_buff.assign(2 * _fill, 0.0f);
+	_pos = (double)_fill;
+}
+
+size_t PolyphaseResampler::process(const float *in, const size_t numElems, float *out)
+{
+	if (_buff.size() < 2 * (_fill + numElems)) _buff.resize(2 * (_fill + numElems));
+	std::memcpy(_buff.data() + 2 * _fill, in, 2 * numElems * sizeof(float));
+	_fill += numElems;
+
+	size_t count = 0;
+	while (_pos < (double)_fill) {
+		size_t n = (size_t)_pos;
+		double phase = (_pos - n) * IQ_POLYPHASE_PHASES;
+		size_t p = (size_t)phase;
+		const float *taps = &_table[p * _numTaps];
+		firInterpCF32(_buff.data() + 2 * (n + 1 - _numTaps), taps, taps + _numTaps, (float)(phase - p), _numTaps, out + 2 * count);
+		count++;
+		_pos += _ratio;
+	}
+
+	// keep the last _numTaps - 1 samples
+	const size_t drop = _fill - (_numTaps - 1);
+	std::memmove(_buff.data(), _buff.data() + 2 * drop, 2 * (_numTaps - 1) * sizeof(float));
+	_fill = _numTaps - 1;
+	_pos -= drop;
+	return count;
+}
+
+Resampler::Resampler(void) :
+	_inRate(0),
+	_outRate(0),
+	_enabled(false),
+	_fractional(false),
+	_delay(0),
+	_outCount(0)
+{
+}
+
+void Resampler::configure(const double inRate, const double outRate)
+{
+	_inRate = inRate;
+	_outRate = outRate;
+	_halfBands.clear();
+	_fractional = false;
+	_delay = 0;
+	_enabled = (outRate > 0 && outRate < inRate);
+	if (!_enabled) return;
+
+	// halve while the rate stays at or above the output rate, delays add up in input samples
+	double rate = inRate;
+	double scale = 1.0;
+	while (rate / 2 >= outRate * (1 - 1e-9)) {
+		_halfBands.push_back(HalfBandDecimator());
+		_delay += HalfBandDecimator::delay() * scale;
+		rate /= 2;
+		scale *= 2;
+	}
+	double ratio = rate / outRate;
+	if (ratio > 1 + 1e-9) {
+		_fractional = true;
+		_polyphase.configure(ratio);
+		_delay += _polyphase.delay() * scale;
+	}
+	this->reset();
+}
+
+void Resampler::reset(void)
+{
+	for (size_t i = 0; i < _halfBands.size(); i++) _halfBands[i].reset();
+	if (_fractional) _polyphase.reset();
+	_outCount = 0;
+}
+
+size_t Resampler::process(const float *in, const size_t numElems, float *out)
+{
+	const float *src = in;
+	size_t n = numElems;
+	for (size_t i = 0; i < _halfBands.size(); i++) {
+		bool last = (i + 1 == _halfBands.size()) && !_fractional;
+		float *dst = out;
+		if (!last) {
+			std::vector<float> &work = _work[i % 2];
+			if (work.size() < n + 2) work.resize(n + 2);
+			dst = work.data();
+		}
+		n = _halfBands[i].process(src, n, dst);
+		src = dst;
+	}
+	if (_fractional) n = _polyphase.process(src, n, out);
+	_outCount += n;
+	return n;
+}
+
+double Resampler::nextPosition(void) const
+{
+	return _outCount * (_inRate / _outRate) - _delay;
+}
@@ -0,0 +1,270 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <complex>
+#include <vector>
+
+//
+// Processing stages of the stream path, run on complex float samples during or
+// after the conversion from CS16. Their settings can change from any thread while the stream
+// runs, a stage picks them up at the start of the next process call.
+//
+
+// Time constants of the DC offset and IQ balance estimates, in seconds
+#define IQ_DC_TIME 0.05
+#define IQ_BALANCE_TIME 0.5
+
+// Samples per NCO block and the bits of the coarse and fine sin/cos tables
+#define IQ_NCO_BLOCK 64
+#define IQ_NCO_TABLE_BITS 10
+
+// Resampler: lowest output rate, taps of the half-band filter that are not zero
+// or the center (even, the length is 2 * that - 1) and phases of the polyphase table
+#define IQ_RESAMPLE_MIN_RATE 1000.0
+#define IQ_HALFBAND_TAPS 26
+#define IQ_POLYPHASE_PHASES 256
+
+// Samples per gain update of the digital AGC
+#define IQ_AGC_BLOCK 64
+
+#define IQ_AGC_DEFAULT_ATTACK 0.001
+#define IQ_AGC_DEFAULT_DECAY 0.1
+#define IQ_AGC_DEFAULT_LEVEL -20.0
+#define IQ_AGC_MAX_GAIN 60.0
+
+//
+// Digital AGC, the IC-R8600 has none in I/Q mode. The input power is tracked per
+// block of IQ_AGC_BLOCK samples, rising with the attack and falling with the decay
+// time constant, and the gain that brings it to the output level is ramped linearly
+// across the next block. The per sample work is the vectorized sumSquaresCF32 and
+// scaleRampCF32 kernels.
+//
+class DigitalAGC
+{
+public:
+	DigitalAGC(void);
+
+	void setEnabled(const bool enabled) { _enabled = enabled; }
+	bool enabled(void) const { return _enabled; }
+
+	// time constants in seconds
+	void setAttack(const double seconds) { _attack = seconds; }
+	double attack(void) const { return _attack; }
+	void setDecay(const double seconds) { _decay = seconds; }
+	double decay(void) const { return _decay; }
+
+	// output level in dB relative to a full scale complex sine
+	void setLevel(const double dBFS) { _level = dBFS; }
+	double level(void) const { return _level; }
+
+	// restart from unity gain, on stream start
+	void reset(void);
+
+	// numElems complex samples in place, at sampleRate
+	void process(float *iq, const size_t numElems, const double sampleRate);
+
+private:
+	std::atomic<bool> _enabled;
+	std::atomic<double> _attack;
+	std::atomic<double> _decay;
+	std::atomic<double> _level;
+
+	// state, only touched by process
+	double _power;
+	float _gain;
+	bool _reset;
+};
+
+//
+// DC offset and IQ imbalance correction, applied by convertCS16ToCF32Corrected while
+// converting. In automatic mode the offset follows the mean of the input and the
+// balance is estimated from its covariance: Q is decorrelated from I and scaled to the
+// same power. The estimates use the moments the conversion returns, so the samples
+// are read once. Manual values are full scale: the offset is subtracted and the
+// balance (gain, cross) gives Q = gain * Q + cross * I, (1, 0) is no correction.
+//
+class IQCorrector
+{
+public:
+	IQCorrector(void);
+
+	void setDCAuto(const bool automatic) { _dcAuto = automatic; }
+	bool dcAuto(void) const { return _dcAuto; }
+	void setIQAuto(const bool automatic) { _iqAuto = automatic; }
+	bool iqAuto(void) const { return _iqAuto; }
+
+	// manual values, in use while the automatic mode is off
+	void setDCOffset(const std::complex<double> &offset);
+	void setIQBalance(const std::complex<double> &balance);
+
+	// values in use, the latest estimate in automatic mode
+	std::complex<double> dcOffset(void) const;
+	std::complex<double> iqBalance(void) const;
+
+	// true when there is anything to correct
+	bool enabled(void) const;
+
+	// restart the estimates, on stream start
+	void reset(void);
+
+	// convert numElems CS16 samples to corrected CF32, at sampleRate
+	void process(const int16_t *in, float *out, const size_t numElems, const double sampleRate);
+
+private:
+	std::atomic<bool> _dcAuto;
+	std::atomic<bool> _iqAuto;
+	std::atomic<float> _manual[4];
+	std::atomic<float> _estimate[4];
+
+	// state, only touched by process
+	double _mean[2];
+	double _cov[3];
+	bool _reset;
+};
+
+//
+// Complex NCO mixer for the residual tuning offset the radio's 1 Hz steps leave.
+// The phase is a 64 bit accumulator driven by the stream tick of the first sample,
+// so it stays continuous across calls and over dropped samples. At every block of
+// IQ_NCO_BLOCK samples the phase is looked up in a coarse and a fine sin/cos table
+// (20 bits, spurs below -100 dBc) and rotateCF32 applies it times a precomputed
+// rotator of the block, in place.
+//
+class NCOMixer
+{
+public:
+	NCOMixer(void);
+
+	// shift in Hz, positive moves the spectrum up
+	void setFrequency(const double frequency) { _frequency = frequency; }
+	double frequency(void) const { return _frequency; }
+
+	bool enabled(void) const { return _frequency != 0.0; }
+
+	// numElems complex samples in place, tick is the stream position of the first one
+	void process(float *iq, const size_t numElems, const unsigned long long tick, const double sampleRate);
+
+private:
+	std::atomic<double> _frequency;
+
+	// state, only touched by process: the rotator of a block for _rotFrequency at _rotRate
+	double _rotFrequency;
+	double _rotRate;
+	uint64_t _increment;
+	float _rot[2 * IQ_NCO_BLOCK];
+};
+
+//
+// Half-band decimator by 2. Every other tap of a half-band filter is zero, so the
+// input is split into even and odd samples: an output is the dot product of the
+// even ones with the IQ_HALFBAND_TAPS side taps, plus half the odd sample at the
+// center. Passband to 0.2 and stopband from 0.3 of the input rate, 80 dB.
+//
+class HalfBandDecimator
+{
+public:
+	HalfBandDecimator(void);
+
+	void reset(void);
+
+	// numElems complex samples in, returns the number written to out, at most (numElems + 1) / 2
+	size_t process(const float *in, const size_t numElems, float *out);
+
+	// output m is centered on input sample 2 * m - delay()
+	static double delay(void) { return IQ_HALFBAND_TAPS - 1; }
+
+private:
+	// history and new samples, complex, split into even and odd ones
+	std::vector<float> _even;
+	std::vector<float> _odd;
+	bool _pending;
+	float _held[2];
+};
+
+//
+// Polyphase resampler by a fractional ratio above 1. The filter is tabulated in
+// IQ_POLYPHASE_PHASES phases per input sample. firInterpCF32 applies the taps of an
+// output interpolated between the two phases around its position. Passband to
+// 0.4 and stopband from 0.6 of the output rate, 80 dB.
+//
+class PolyphaseResampler
+{
+public:
+	PolyphaseResampler(void);
+
+	void configure(const double ratio);
+
+	void reset(void);
+
+	// numElems complex samples in, returns the number written to out, at most numElems / ratio + 1
+	size_t process(const float *in, const size_t numElems, float *out);
+
+	// output k is centered on input sample k * ratio - delay()
+	double delay(void) const { return _numTaps / 2.0; }
+
+private:
+	double _ratio;
+	size_t _numTaps;
+	// (IQ_POLYPHASE_PHASES + 1) x _numTaps, in the order firCF32 applies them
+	std::vector<float> _table;
+	// history and new samples, complex, and the position of the next output in them
+	std::vector<float> _buff;
+	size_t _fill;
+	double _pos;
+};
+
+//
+// Decimation from a hardware rate to any rate below it: half-band stages while the
+// rate can be halved, then the polyphase stage for the rest. Configured and run from
+// the stream path only.
+//
+class Resampler
+{
+public:
+	Resampler(void);
+
+	void configure(const double inRate, const double outRate);
+	double inputRate(void) const { return _inRate; }
+	double outputRate(void) const { return _outRate; }
+
+	bool enabled(void) const { return _enabled; }
+
+	void reset(void);
+
+	// numElems complex samples in, returns the number written to out,
+	// at most numElems * outputRate / inputRate + 2
+	size_t process(const float *in, const size_t numElems, float *out);
+
+	// input sample the next output is centered on, counted from the reset,
+	// negative while the filters fill
+	double nextPosition(void) const;
+
+private:
+	double _inRate;
+	double _outRate;
+	bool _enabled;
+	bool _fractional;
+	double _delay;
+	unsigned long long _outCount;
+	std::vector<HalfBandDecimator> _halfBands;
+	PolyphaseResampler _polyphase;
+	std::vector<float> _work[2];
+};
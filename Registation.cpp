@@ -19,17 +19,38 @@
 static std::vector<SoapySDR::Kwargs> findICR(const SoapySDR::Kwargs &args)
 {
 	std::vector<SoapySDR::Kwargs> results;
-	BOOL icr8600 = FindICR8600Device();
-	if (icr8600) {
+
+	// simulated radio, e.g. driver=icr8600,sim=1
+	if (args.count("sim") != 0 && args.at("sim") != "0") {
+		SoapySDR::Kwargs devInfo = args;
+		devInfo["label"] = "IC-R8600 (simulated)";
+		devInfo["product"] = "IC-R8600";
+		devInfo["serial"] = "sim";
+		devInfo["manufacturer"] = "Icom";
+		results.push_back(devInfo);
+		return results;
+	}
+
+	// every radio on the bus, or the ones matching serial= and path=
+	std::vector<ICR8600_DEVICE_INFO> devices;
+	ListICR8600Devices(&devices);
+	for (size_t i = 0; i < devices.size(); i++) {
+		const ICR8600_DEVICE_INFO &device = devices[i];
+		if (args.count("serial") != 0 && args.at("serial") != device.Serial) continue;
+		if (args.count("path") != 0 && args.at("path") != device.Path) continue;
+
 		SoapySDR::Kwargs devInfo;
-		devInfo["label"] = "IC-R8600";
+		devInfo["label"] = "IC-R8600 " + (device.Serial.empty() ? device.Path : device.Serial);
 		devInfo["available"] = "Yes"; 
 		devInfo["product"] = "IC-R8600";
-		devInfo["serial"] = "-";
+		if (!device.Serial.empty()) {
+			devInfo["serial"] = device.Serial;
+		}
+		devInfo["path"] = device.Path;
 		devInfo["manufacturer"] = "Icom";
 		results.push_back(devInfo);
 	}
-	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::findICR: %d", icr8600);
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::findICR: %d", (int)results.size());
 
 	return results;
 }
@@ -13,36 +13,136 @@
  */
 
 #include "SoapyICR8600.hpp"
-#include "WinUSBDevice.h"
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdint>
+
+static VOID _civ_notify(const UCHAR *Frame, ULONG Length, PVOID Context)
+{
+	SoapyICR8600 *self = (SoapyICR8600 *)Context;
+	self->civ_notify(Frame, Length);
+}
 
 SoapyICR8600::SoapyICR8600(const SoapySDR::Kwargs &args)
 {
 	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::SoapyICR8600");
-	if (!FindICR8600Device()) {
-		throw std::runtime_error("Icom ICR8600 not found.");
-	}
+	bool sim = (args.count("sim") != 0 && args.at("sim") != "0");
 
 	rxFormat = RX_FORMAT_INT16;
 
 	sampleRate = 1920000;
+	_outputRate = sampleRate;
 	centerFrequency = 15000000;
 	antennaIndex = 0;
+	preampOn = FALSE;
+	attenuator = 0;
+	gainRF = 0;
+	_stateFields = 0;
+	_ppm = 0.0;
+	_ncoTune = false;
+	_tuneFrequency = 0.0;
+	_tuneCommanded = 0;
 
 	bufferLength = DEFAULT_BUFFER_LENGTH;
-	bufferData = NULL;
-
-	BOOL noDevice;
-	HRESULT hr = OpenDevice(&deviceData, &noDevice);
-	if (FAILED(hr)) {
-		if (noDevice) {
-			SoapySDR_logf(SOAPY_SDR_ERROR, "Error: device not connected or driver not installed");
-		} else {
-			SoapySDR_logf(SOAPY_SDR_ERROR, "Error: failed looking for device");
+	numBuffers = DEFAULT_NUM_BUFFERS;
+	numTransfers = DEFAULT_NUM_TRANSFERS;
+	_streamLatency = DEFAULT_LATENCY;
+	_bufferLengthArg = 0;
+	_numBuffersArg = 0;
+	_numTransfersArg = 0;
+	_hugePages = false;
+	_numaNode = -1;
+	_sizedRate = 0;
+
+	_rx_running = false;
+	_buffPool = NULL;
+	_dropPool = NULL;
+	_dropStride = 0;
+	_dspBuff = NULL;
+	_resampleBuff = NULL;
+	_buffStride = 0;
+	_buf_head = 0;
+	_buf_tail = 0;
+	_buf_queued = 0;
+	_buf_acquired = 0;
+	_buf_count = 0;
+	_currentHandle = 0;
+	_currentBuff = NULL;
+	bufferedElems = 0;
+	_currentElem = 0;
+	_currentSync = 0;
+	_readSyncCount = 0;
+	_gapPending = false;
+	_rxElems = 0;
+	_lastSyncElem = 0;
+	_lastSyncValid = false;
+	_syncInterval = 0;
+	_syncCadence = 0;
+	_syncCandidate = 0;
+	_syncRepeats = 0;
+	_rx_abrupt = false;
+	_overflows = 0;
+	_droppedTransfers = 0;
+	_shortReads = 0;
+	_syncErrors = 0;
+	_rxTicks = 0;
+	_rxRate.tick = 0;
+	_rxRate.timeNs = 0;
+	_rxRate.hardwareRate = sampleRate;
+	_rxRate.outputRate = _outputRate;
+	_ratePending = false;
+	_scanDwellSec = DEFAULT_SCAN_DWELL;
+	_scanSettle = DEFAULT_SCAN_SETTLE;
+	_scanWake = ULLONG_MAX;
+	_scanFrequency = 0;
+	_scanSeq = 0;
+	_resampleStart = 0;
+	_resampleTick = 0;
+
+	// calibration of this radio, applied from the first setFrequency on
+	if (args.count("ppm") != 0) {
+		try
+		{
+			_ppm = std::stod(args.at("ppm"));
 		}
-		throw std::runtime_error("Icom ICR8600 not found or cannot be opened.");
+		catch (const std::invalid_argument &) {}
+	}
+	_ncoTune = (args.count("nco_tune") != 0 && args.at("nco_tune") != "0");
+
+	// civ_latency=1 also covers the commands sent while opening
+	if (args.count("civ_latency") != 0 && args.at("civ_latency") != "0") {
+		ICR8600SetLatencyLog(TRUE);
 	}
 
-	BOOL bResult = GetDeviceDescriptor(deviceData.WinusbHandle, &deviceDesc);
+	if (sim) {
+		SoapySDR_logf(SOAPY_SDR_INFO, "Using the simulated IC-R8600");
+		transport.reset(new SimTransport(args));
+		_serial = "sim";
+	}
+	else {
+		USBTransport *usb = new USBTransport();
+		transport.reset(usb);
+
+		// serial= and path= pick one of several radios, as listed by find
+		std::string serial = (args.count("serial") != 0) ? args.at("serial") : "";
+		std::string path = (args.count("path") != 0) ? args.at("path") : "";
+		BOOL noDevice;
+		HRESULT hr = usb->Open(&noDevice, serial.c_str(), path.c_str());
+		if (FAILED(hr)) {
+			if (noDevice) {
+				SoapySDR_logf(SOAPY_SDR_ERROR, "Error: device not connected or driver not installed");
+			} else {
+				SoapySDR_logf(SOAPY_SDR_ERROR, "Error: failed looking for device");
+			}
+			throw std::runtime_error("Icom ICR8600 not found or cannot be opened.");
+		}
+		_serial = usb->GetInfo().Serial;
+		_usbPath = usb->GetInfo().Path;
+		SoapySDR_logf(SOAPY_SDR_INFO, "Opened IC-R8600 at %s, serial %s", _usbPath.c_str(), _serial.empty() ? "unknown" : _serial.c_str());
+	}
+
+	BOOL bResult = transport->GetDescriptor(&deviceDesc);
 	if (FALSE == bResult) {
 		printf("GetDeviceDescriptor: failed\n");
 		throw std::runtime_error("WinUsb_GetDescriptor failed");
@@ -51,17 +151,30 @@ SoapyICR8600::SoapyICR8600(const SoapySDR::Kwargs &args)
 	// Print a few parts of the device descriptor
 	SoapySDR_logf(SOAPY_SDR_INFO, "Device found: VID_%04X&PID_%04X; bcdUsb %04X", deviceDesc.idVendor, deviceDesc.idProduct, deviceDesc.bcdUSB);
 
-	// Need to enable I/Q Mode or other commands will not work
-	ICR8600SetRemoteOn(deviceData.WinusbHandle);
+	// front panel changes the radio broadcasts reach the cached state as they
+	// arrive, the reader keeps the response pipe read between commands
+	transport->NotifyCallback = &_civ_notify;
+	transport->NotifyContext = this;
+	ICR8600StartReader(transport.get());
+
+	// Need to enable I/Q Mode or other commands will not work. The ack is read
+	// with the first command, opening does not wait for the radio
+	ICR8600PostRemoteOn(transport.get());
 
 }
 
 SoapyICR8600::~SoapyICR8600(void)
 {
+	// Stop the RX thread and release the ring if the stream was not closed
+	if (_buffPool != NULL) {
+		this->closeStream((SoapySDR::Stream *) this);
+	}
+
 	// Exit I/Q Mode
-	ICR8600SetRemoteOff(deviceData.WinusbHandle);
+	ICR8600SetRemoteOff(transport.get());
 
-	CloseDevice(&deviceData);
+	ICR8600StopReader(transport.get());
+	transport.reset();
 	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::~SoapyICR8600");
 }
 
@@ -85,6 +198,8 @@ SoapySDR::Kwargs SoapyICR8600::getHardwareInfo(void) const
 	// This also gets printed in --probe
 	SoapySDR::Kwargs args;
 	args["origin"] = "https://www.icom.co.jp/world/products/receiver/desktop/ic-r8600/";
+	if (!_serial.empty()) args["serial"] = _serial;
+	if (!_usbPath.empty()) args["path"] = _usbPath;
 	return args;
 }
 
@@ -123,18 +238,21 @@ void SoapyICR8600::setAntenna(const int direction, const size_t channel, const s
 	// Antenna commands only function in the HF region
 	// ANT 1 is automatically selected outside the HF region
 	if (centerFrequency < 30000000) {
+		int index = -1;
 		if (name == "ANT 1") {
-			antennaIndex = 0;
-			ICR8600SetAntenna(deviceData.WinusbHandle, 0);
+			index = 0;
 		}
 		else if (name == "ANT 2") {
-			antennaIndex = 1;
-			ICR8600SetAntenna(deviceData.WinusbHandle, 1);
+			index = 1;
 		}
 		else if (name == "ANT 3") {
-			antennaIndex = 2;
-			ICR8600SetAntenna(deviceData.WinusbHandle, 2);
-		}		
+			index = 2;
+		}
+		if (index >= 0 && ICR8600SetAntenna(transport.get(), index)) {
+			std::lock_guard<std::mutex> state(_state_mutex);
+			antennaIndex = index;
+			_stateFields |= ICR8600_STATE_ANTENNA;
+		}
 	}
 	else {
 		if (name != "ANT 1") {
@@ -146,60 +264,119 @@ void SoapyICR8600::setAntenna(const int direction, const size_t channel, const s
 
 std::string SoapyICR8600::getAntenna(const int direction, const size_t channel) const
 {
-	std::lock_guard<std::mutex> lock(_device_mutex);
-
-	ULONG antennaIndex;
-	std::string antenna = "";
+	requireState(ICR8600_STATE_FREQUENCY | ICR8600_STATE_ANTENNA);
+	std::lock_guard<std::mutex> state(_state_mutex);
 
 	// On the R8600,
 	// Antenna commands only function in the HF region
 	// ANT 1 is automatically selected outside the HF region
 	if (centerFrequency >= 30000000) {
-		antenna = "ANT 1";		
+		return "ANT 1";
 	}
-	else if (ICR8600GetAntenna(deviceData.WinusbHandle, &antennaIndex))
+	switch(antennaIndex)
 	{
-		switch(antennaIndex)
-		{
-			case 0x00:
-				antenna = "ANT 1";
-				break;
-			case 0x01:
-				antenna = "ANT 2";
-				break;
-			case 0x02:
-				antenna = "ANT 3";
-				break;
-			default:
-				antenna = "";
-		}
+		case 0x00:
+			return "ANT 1";
+		case 0x01:
+			return "ANT 2";
+		case 0x02:
+			return "ANT 3";
+		default:
+			return "";
 	}
-	return antenna;
 }
 
 /*******************************************************************
  * Frontend corrections API
  ******************************************************************/
 
+// DC offset and IQ balance are corrected in the stream path, see IQCorrector
 bool SoapyICR8600::hasDCOffsetMode(const int direction, const size_t channel) const
 {
-	return false;
+	return true;
+}
+
+void SoapyICR8600::setDCOffsetMode(const int direction, const size_t channel, const bool automatic)
+{
+	_iqCorrector.setDCAuto(automatic);
+}
+
+bool SoapyICR8600::getDCOffsetMode(const int direction, const size_t channel) const
+{
+	return _iqCorrector.dcAuto();
+}
+
+bool SoapyICR8600::hasDCOffset(const int direction, const size_t channel) const
+{
+	return true;
+}
+
+// a manual offset turns the automatic mode off
+void SoapyICR8600::setDCOffset(const int direction, const size_t channel, const std::complex<double> &offset)
+{
+	_iqCorrector.setDCAuto(false);
+	_iqCorrector.setDCOffset(offset);
+}
+
+std::complex<double> SoapyICR8600::getDCOffset(const int direction, const size_t channel) const
+{
+	return _iqCorrector.dcOffset();
+}
+
+#ifdef SOAPY_SDR_API_HAS_IQ_BALANCE_MODE
+bool SoapyICR8600::hasIQBalanceMode(const int direction, const size_t channel) const
+{
+	return true;
+}
+
+void SoapyICR8600::setIQBalanceMode(const int direction, const size_t channel, const bool automatic)
+{
+	_iqCorrector.setIQAuto(automatic);
+}
+
+bool SoapyICR8600::getIQBalanceMode(const int direction, const size_t channel) const
+{
+	return _iqCorrector.iqAuto();
+}
+#endif
+
+bool SoapyICR8600::hasIQBalance(const int direction, const size_t channel) const
+{
+	return true;
+}
+
+// (gain, cross) of Q: Q = gain * Q + cross * I, a manual value turns the automatic mode off
+void SoapyICR8600::setIQBalance(const int direction, const size_t channel, const std::complex<double> &balance)
+{
+	_iqCorrector.setIQAuto(false);
+	_iqCorrector.setIQBalance(balance);
+}
+
+std::complex<double> SoapyICR8600::getIQBalance(const int direction, const size_t channel) const
+{
+	return _iqCorrector.iqBalance();
 }
 
 bool SoapyICR8600::hasFrequencyCorrection(const int direction, const size_t channel) const
 {
-	return false;
+	return true;
 }
 
+// ppm the radio's reference is off, the current frequency is retuned with it
 void SoapyICR8600::setFrequencyCorrection(const int direction, const size_t channel, const double value)
 {
-	// ppm = int(value);
-	// rtlsdr_set_freq_correction(dev, ppm);
+	requireState(ICR8600_STATE_FREQUENCY);
+	std::lock_guard<std::mutex> lock(_device_mutex);
+
+	double frequency = targetFrequency();
+	_ppm = value;
+	SoapySDR_logf(SOAPY_SDR_INFO, "Setting frequency correction: %.3f ppm", value);
+	tuneTo(frequency);
 }
 
 double SoapyICR8600::getFrequencyCorrection(const int direction, const size_t channel) const
 {
-	return double(0);
+	return _ppm;
 }
 
 /*******************************************************************
@@ -219,75 +396,76 @@ std::vector<std::string> SoapyICR8600::listGains(const int direction, const size
 	return gains;
 }
 
+// IC-R8600 disables AGC while in I/Q mode,
+// automatic gain mode is the digital AGC of the stream path
 bool SoapyICR8600::hasGainMode(const int direction, const size_t channel) const
 {
-	// IC-R8600 disables AGC while in I/Q mode
-	return false;
+	return true;
 }
 
 void SoapyICR8600::setGainMode(const int direction, const size_t channel, const bool automatic)
 {
-	// IC-R8600 disables AGC while in I/Q mode
+	_agc.setEnabled(automatic);
 }
 
 bool SoapyICR8600::getGainMode(const int direction, const size_t channel) const
 {
-	// IC-R8600 disables AGC while in I/Q mode
-	return false;
+	return _agc.enabled();
 }
 
-void SoapyICR8600::setGain(const int direction, const size_t channel, const double value)
+// RF gain setting for a gain in dB
+// set = 4*(gain(dB) + 63.75)
+// RF Gain Range 0dB (max) to -63.75dB (min)
+// from observation, have not found this specified
+static ULONG gainToRF(const double value)
 {
-	std::lock_guard<std::mutex> lock(_device_mutex);
-
-	//set the overall gain by distributing it across available gain elements
-
-	// RF Gain -63.75dB to 0dB
-	// Pre-Amp 0dB to 14db
-	// Attenuator -30dB to 0dB
-	// 
-	// Min Gain = (-63.75) + (0) + (-30) = -93.75
-	// Max Gain = (0) + (14) + 0 = 14dB
-
-	// Strategy...
-	// 0dB is nominal
-	// 0dB to 14dB Pre-Amp
-	// -30dB to 0 dB Attenuator
-	// < -30dB RF Gain 
+	return (ULONG)(int(4.0*(value + 63.75)));
+}
 
+//
+// Distribute an overall gain across the gain elements
+//
+// RF Gain -63.75dB to 0dB
+// Pre-Amp 0dB to 14db
+// Attenuator -30dB to 0dB
+//
+// Min Gain = (-63.75) + (0) + (-30) = -93.75
+// Max Gain = (0) + (14) + 0 = 14dB
+//
+// Strategy...
+// 0dB is nominal
+// 0dB to 14dB Pre-Amp
+// -30dB to 0 dB Attenuator
+// < -30dB RF Gain
+//
+static ICR8600_STATE planGain(const double value)
+{
+	ICR8600_STATE plan;
 	double gain = value;
 
-	if (gain > 0.0)
+	plan.PreAmpOn = (gain > 0.0);
+	if (plan.PreAmpOn)
 	{
-		this->setGain(SOAPY_SDR_RX, 0, "PRE-AMP", 14.0);
 		gain -= 14.0;
 	}
-	else
-	{
-		this->setGain(SOAPY_SDR_RX, 0, "PRE-AMP", 0.0);
-		gain -= 0.0;		
-	}
 
 	if (gain <= -30.0)
 	{
-		this->setGain(SOAPY_SDR_RX, 0, "ATTENUATOR", -30.0);
-		gain += 30.0;		
+		plan.Attenuator = 30;
 	}
 	else if (gain <= -20)
 	{
-		this->setGain(SOAPY_SDR_RX, 0, "ATTENUATOR", -20.0);
-		gain += 20.0;
+		plan.Attenuator = 20;
 	}
 	else if (gain <= -10.0)
 	{
-		this->setGain(SOAPY_SDR_RX, 0, "ATTENUATOR", -10.0);
-		gain += 10.0;
+		plan.Attenuator = 10;
 	}
 	else
 	{
-		this->setGain(SOAPY_SDR_RX, 0, "ATTENUATOR", 0.0);
-		gain += 0.0;		
+		plan.Attenuator = 0;
 	}
+	gain += (double)plan.Attenuator;
 
 	if (gain < -63.75)
 	{
@@ -297,8 +475,59 @@ void SoapyICR8600::setGain(const int direction, const size_t channel, const doub
 	{
 		gain = 0.0;
 	}
+	plan.GainRF = gainToRF(gain);
+	return plan;
+}
 
-	this->setGain(SOAPY_SDR_RX, 0, "RF", gain);
+// Queue the elements of plan in fields that differ from the cache, or are not known
+SoapyICR8600::GainCommands SoapyICR8600::queueGain(CIVCommandQueue &queue, const ICR8600_STATE &plan, const ULONG fields)
+{
+	GainCommands commands = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+	std::lock_guard<std::mutex> state(_state_mutex);
+	if ((fields & ICR8600_STATE_PREAMP) && (!(_stateFields & ICR8600_STATE_PREAMP) || preampOn != plan.PreAmpOn))
+		commands.preamp = queue.PushPreAmp(plan.PreAmpOn);
+	if ((fields & ICR8600_STATE_ATTENUATOR) && (!(_stateFields & ICR8600_STATE_ATTENUATOR) || attenuator != plan.Attenuator))
+		commands.attenuator = queue.PushAttenuator(plan.Attenuator);
+	if ((fields & ICR8600_STATE_GAIN_RF) && (!(_stateFields & ICR8600_STATE_GAIN_RF) || gainRF != plan.GainRF))
+		commands.gainRF = queue.PushGainRF(plan.GainRF);
+	return commands;
+}
+
+// a failed element is read back from the radio next time it is needed
+void SoapyICR8600::commitGain(const CIVCommandQueue &queue, const ICR8600_STATE &plan, const GainCommands &commands)
+{
+	std::lock_guard<std::mutex> state(_state_mutex);
+	if (commands.preamp != SIZE_MAX) {
+		preampOn = plan.PreAmpOn;
+		_stateFields = queue.Result(commands.preamp) ? (_stateFields | ICR8600_STATE_PREAMP) : (_stateFields & ~ICR8600_STATE_PREAMP);
+	}
+	if (commands.attenuator != SIZE_MAX) {
+		attenuator = plan.Attenuator;
+		_stateFields = queue.Result(commands.attenuator) ? (_stateFields | ICR8600_STATE_ATTENUATOR) : (_stateFields & ~ICR8600_STATE_ATTENUATOR);
+	}
+	if (commands.gainRF != SIZE_MAX) {
+		gainRF = plan.GainRF;
+		_stateFields = queue.Result(commands.gainRF) ? (_stateFields | ICR8600_STATE_GAIN_RF) : (_stateFields & ~ICR8600_STATE_GAIN_RF);
+	}
+}
+
+void SoapyICR8600::setGain(const int direction, const size_t channel, const double value)
+{
+	std::lock_guard<std::mutex> lock(_device_mutex);
+
+	//set the overall gain by distributing it across available gain elements,
+	//as one batch with only the elements that change
+	ICR8600_STATE plan = planGain(value);
+	CIVCommandQueue queue;
+	GainCommands commands = queueGain(queue, plan, ICR8600_STATE_PREAMP | ICR8600_STATE_ATTENUATOR | ICR8600_STATE_GAIN_RF);
+	if (queue.Size() == 0) return;
+
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "Setting Gain: %.2f dB, Pre-Amp %s, Attenuator %d dB, RF %d (%d commands)",
+		value, plan.PreAmpOn ? "ON" : "OFF", plan.Attenuator, plan.GainRF, (int)queue.Size());
+	if (!queue.Submit(transport.get())) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "setGain: %.2f dB not fully applied", value);
+	}
+	commitGain(queue, plan, commands);
 }
 
 void SoapyICR8600::setGain(const int direction, const size_t channel, const std::string &name, const double value)
@@ -309,25 +538,32 @@ void SoapyICR8600::setGain(const int direction, const size_t channel, const std:
 
 	if (name == "RF")
 	{
-		// set = 4*(gain(dB) + 63.75)
-		// RF Gain Range 0dB (max) to -63.75dB (min)
-		// from observation, have not found this specified
-		ULONG s;
-		s = (ULONG)(int(4.0*(value + 63.75)));
+		ULONG s = gainToRF(value);
 		SoapySDR_logf(SOAPY_SDR_INFO, "Setting RF Gain: %.2f dB (%d)", value, s);
-		ICR8600SetGainRF(deviceData.WinusbHandle, s);
+		if (ICR8600SetGainRF(transport.get(), s)) {
+			std::lock_guard<std::mutex> state(_state_mutex);
+			gainRF = s;
+			_stateFields |= ICR8600_STATE_GAIN_RF;
+		}
 	}
 	else if (name == "PRE-AMP")
 	{
-		if (value > 0)
+		BOOL on = (value > 0);
+		BOOL ok;
+		if (on)
 		{
 			SoapySDR_logf(SOAPY_SDR_INFO, "Setting Pre-Amp Gain: %.2f dB (ON)", value);
-			ICR8600SetPreAmpOn(deviceData.WinusbHandle);
+			ok = ICR8600SetPreAmpOn(transport.get());
 		}
 		else
 		{
 			SoapySDR_logf(SOAPY_SDR_INFO, "Setting Pre-Amp Gain: %.2f dB (OFF)", value);
-			ICR8600SetPreAmpOff(deviceData.WinusbHandle);			
+			ok = ICR8600SetPreAmpOff(transport.get());
+		}
+		if (ok) {
+			std::lock_guard<std::mutex> state(_state_mutex);
+			preampOn = on;
+			_stateFields |= ICR8600_STATE_PREAMP;
 		}
 	}
 	else if (name == "ATTENUATOR")
@@ -335,7 +571,11 @@ void SoapyICR8600::setGain(const int direction, const size_t channel, const std:
 		// give the attenuator a positive attenuation value
 		ULONG atten = (ULONG)(int(-1.0 * value));
 		SoapySDR_logf(SOAPY_SDR_INFO, "Setting Attenuator Gain: %.2f dB (%d)", value, atten);
-		ICR8600SetAttenuator(deviceData.WinusbHandle, atten);
+		if (ICR8600SetAttenuator(transport.get(), atten)) {
+			std::lock_guard<std::mutex> state(_state_mutex);
+			attenuator = atten;
+			_stateFields |= ICR8600_STATE_ATTENUATOR;
+		}
 	}
 	else
 	{
@@ -358,64 +598,27 @@ double SoapyICR8600::getGain(const int direction, const size_t channel) const
 
 double SoapyICR8600::getGain(const int direction, const size_t channel, const std::string &name) const
 {
-	std::lock_guard<std::mutex> lock(_device_mutex);
-
-	ULONG set;
-	double gain;
-
 	if (name == "RF")
 	{
-		if (ICR8600GetGainRF(deviceData.WinusbHandle, &set))
-		{
-			// gain(dB) = 0.25*set - 63.75
-			// RF Gain Range 0dB (max) to -63.75dB (min)
-			// from observation, have not found this specified
-			gain = 0.25 * (double)set - 63.75;
-			SoapySDR_logf(SOAPY_SDR_INFO, "Getting RF Gain: %f dB (%d)", gain, set);
-			return (double)gain;
-		}
-		else
-		{
-			return 0;
-		}
+		requireState(ICR8600_STATE_GAIN_RF);
+		std::lock_guard<std::mutex> state(_state_mutex);
+		// gain(dB) = 0.25*set - 63.75
+		// RF Gain Range 0dB (max) to -63.75dB (min)
+		// from observation, have not found this specified
+		return 0.25 * (double)gainRF - 63.75;
 	}
 	else if (name == "PRE-AMP")
 	{
-		BOOL on;
-
-		if (ICR8600GetPreAmpState(deviceData.WinusbHandle, &on))
-		{
-			if (on)
-			{
-				SoapySDR_logf(SOAPY_SDR_INFO, "Getting Pre-Amp Gain: 14.0 dB (ON)");
-				return(14.0);
-			}
-			else
-			{
-				SoapySDR_logf(SOAPY_SDR_INFO, "Getting Pre-Amp Gain: 0.0 dB (OFF)");
-				return(0.0);
-			}
-		}
-		else
-		{
-			return 0;
-		}
+		requireState(ICR8600_STATE_PREAMP);
+		std::lock_guard<std::mutex> state(_state_mutex);
+		return preampOn ? 14.0 : 0.0;
 	}
 	else if (name == "ATTENUATOR")
 	{
-		if (ICR8600GetAttenuator(deviceData.WinusbHandle, &set))
-		{
-			SoapySDR_logf(SOAPY_SDR_INFO, "Getting Attenuator Gain: %.2f dB (%d)", -1.0 * (double)set, set);
-			if (set != 0)
-				// convert to negative
-				return -1.0*(double)set;
-			else
-				return 0.0;
-		}
-		else
-		{
-			return 0;
-		}
+		requireState(ICR8600_STATE_ATTENUATOR);
+		std::lock_guard<std::mutex> state(_state_mutex);
+		// convert to negative
+		return (attenuator != 0) ? -1.0 * (double)attenuator : 0.0;
 	}
 	else
 	{
@@ -462,19 +665,50 @@ SoapySDR::Range SoapyICR8600::getGainRange(const int direction, const size_t cha
  * Frequency API
  ******************************************************************/
 
+// "CORR" is the frequency correction in ppm, not listed as a component so the
+// default setFrequency does not tune it with what is left after "RF"
 void SoapyICR8600::setFrequency(const int direction, const size_t channel, const std::string &name, const double frequency, const SoapySDR::Kwargs &args)
 {
+	if (name == "CORR")
+	{
+		this->setFrequencyCorrection(direction, channel, frequency);
+		return;
+	}
+
+	// gain=<dB>, and RF, PRE-AMP or ATTENUATOR=<dB> for single elements, go out
+	// in one batch with the retune
+	ICR8600_STATE plan = ICR8600_STATE();
+	ULONG planFields = 0;
+	try
+	{
+		if (args.count("gain") != 0) {
+			plan = planGain(std::stod(args.at("gain")));
+			planFields = ICR8600_STATE_PREAMP | ICR8600_STATE_ATTENUATOR | ICR8600_STATE_GAIN_RF;
+		}
+		if (args.count("PRE-AMP") != 0) {
+			plan.PreAmpOn = (std::stod(args.at("PRE-AMP")) > 0);
+			planFields |= ICR8600_STATE_PREAMP;
+		}
+		if (args.count("ATTENUATOR") != 0) {
+			plan.Attenuator = (ULONG)(int(-1.0 * std::stod(args.at("ATTENUATOR"))));
+			planFields |= ICR8600_STATE_ATTENUATOR;
+		}
+		if (args.count("RF") != 0) {
+			plan.GainRF = gainToRF(std::stod(args.at("RF")));
+			planFields |= ICR8600_STATE_GAIN_RF;
+		}
+	}
+	catch (const std::invalid_argument &) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "setFrequency: invalid gain argument, gain left as it is");
+		planFields = 0;
+	}
+
 	std::lock_guard<std::mutex> lock(_device_mutex);
 
 	if (name == "RF")
 	{
-		centerFrequency = (ULONG)frequency;
-		SoapySDR_logf(SOAPY_SDR_INFO, "Setting center freq: %d for %s", centerFrequency, name.c_str());
-		ICR8600SetFrequency(deviceData.WinusbHandle, centerFrequency);
-	} else if (name == "CORR")
-	{
-		// ppm = (int)frequency;
-		// rtlsdr_set_freq_correction(dev, ppm);
+		SoapySDR_logf(SOAPY_SDR_INFO, "Setting center freq: %.3f for %s", frequency, name.c_str());
+		tuneTo(frequency, &plan, planFields);
 	}
 }
 
@@ -482,11 +716,12 @@ double SoapyICR8600::getFrequency(const int direction, const size_t channel, con
 {
 	if (name == "RF")
 	{
-		return (double)centerFrequency;
+		requireState(ICR8600_STATE_FREQUENCY);
+		return tunedFrequency();
 	}
 	else if (name == "CORR")
 	{
-		return (double)0;
+		return _ppm;
 	}
 
 	return 0;
@@ -518,38 +753,139 @@ SoapySDR::ArgInfoList SoapyICR8600::getFrequencyArgsInfo(const int direction, co
 {
 	SoapySDR::ArgInfoList freqArgs;
 
-	// TODO: frequency arguments
+	SoapySDR::ArgInfo gainArg;
+	gainArg.key = "gain";
+	gainArg.name = "Gain";
+	gainArg.units = "dB";
+	gainArg.description = "Overall gain set in one batch with the retune, distributed like setGain";
+	gainArg.type = SoapySDR::ArgInfo::FLOAT;
+	freqArgs.push_back(gainArg);
+
+	static const char *elements[] = { "RF", "PRE-AMP", "ATTENUATOR" };
+	for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); i++) {
+		SoapySDR::ArgInfo elementArg;
+		elementArg.key = elements[i];
+		elementArg.name = std::string(elements[i]) + " Gain";
+		elementArg.units = "dB";
+		elementArg.description = std::string("Gain of the ") + elements[i] + " element set in one batch with the retune";
+		elementArg.type = SoapySDR::ArgInfo::FLOAT;
+		freqArgs.push_back(elementArg);
+	}
 
 	return freqArgs;
 }
 
+// Command the radio for frequency, with _device_mutex held, and set the
+// gain elements of gain in gainFields in the same batch
+BOOL SoapyICR8600::tuneTo(const double frequency, const ICR8600_STATE *gain, const ULONG gainFields)
+{
+	const double scale = 1.0 + _ppm * 1e-6;
+	double commanded = std::floor(frequency / scale + 0.5);
+	if (commanded < 0 || commanded > (double)ULONG_MAX) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "tuneTo: %.3f Hz out of range", frequency);
+		return FALSE;
+	}
+	ULONG f = (ULONG)commanded;
+
+	// the gain elements of the new frequency go out in the same batch
+	CIVCommandQueue queue;
+	size_t retune = queue.PushFrequency(f);
+	GainCommands commands = { SIZE_MAX, SIZE_MAX, SIZE_MAX };
+	if (gain != NULL) {
+		commands = queueGain(queue, *gain, gainFields);
+	}
+	if (!queue.Submit(transport.get()) && queue.Result(retune)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "tuneTo: gain for %.3f Hz not fully applied", frequency);
+	}
+	if (gain != NULL) {
+		commitGain(queue, *gain, commands);
+	}
+	if (!queue.Result(retune)) return FALSE;
+
+	std::lock_guard<std::mutex> state(_state_mutex);
+	centerFrequency = f;
+	_stateFields |= ICR8600_STATE_FREQUENCY;
+	_tuneFrequency = frequency;
+	_tuneCommanded = f;
+	// the radio lands on f * scale, shift the stream up by the difference
+	_nco.setFrequency(_ncoTune ? f * scale - frequency : 0.0);
+	return TRUE;
+}
+
+// Center of the stream: where the corrected radio is, less the NCO shift
+double SoapyICR8600::tunedFrequency(void) const
+{
+	std::lock_guard<std::mutex> state(_state_mutex);
+	return centerFrequency * (1.0 + _ppm * 1e-6) - _nco.frequency();
+}
+
+// The frequency to keep when the correction changes: the one last asked for,
+// unless the radio was retuned from its front panel since
+double SoapyICR8600::targetFrequency(void) const
+{
+	{
+		std::lock_guard<std::mutex> state(_state_mutex);
+		if (_tuneCommanded != 0 && centerFrequency == _tuneCommanded) return _tuneFrequency;
+	}
+	return tunedFrequency();
+}
+
 /*******************************************************************
  * Sample Rate API
  ******************************************************************/
 
+// Rates of the I/Q output of the radio
+static const ULONG hardwareRates[] = { 240000, 480000, 960000, 1920000, 3840000, 5120000 };
+#define NUM_HARDWARE_RATES (sizeof(hardwareRates) / sizeof(hardwareRates[0]))
+
+// Any rate in getSampleRateRange: the radio runs at the nearest hardware rate
+// above and the stream path decimates the rest
 void SoapyICR8600::setSampleRate(const int direction, const size_t channel, const double rate)
 {
 	std::lock_guard<std::mutex> lock(_device_mutex);
 
-	sampleRate = (ULONG)rate;
-	SoapySDR_logf(SOAPY_SDR_INFO, "Setting sample rate: %d", sampleRate);
-	ICR8600SetSampleRate(deviceData.WinusbHandle, sampleRate);
+	double outputRate = std::min(std::max(rate, IQ_RESAMPLE_MIN_RATE), (double)hardwareRates[NUM_HARDWARE_RATES - 1]);
+	ULONG hardwareRate = hardwareRates[NUM_HARDWARE_RATES - 1];
+	for (size_t i = 0; i < NUM_HARDWARE_RATES; i++) {
+		if (hardwareRates[i] >= outputRate) {
+			hardwareRate = hardwareRates[i];
+			break;
+		}
+	}
+
+	SoapySDR_logf(SOAPY_SDR_INFO, "Setting sample rate: %.0f, hardware %d", outputRate, (int)hardwareRate);
+	if (!ICR8600SetSampleRate(transport.get(), hardwareRate)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "setSampleRate: the radio did not take %d Hz, staying at %.0f", (int)hardwareRate, (double)_outputRate);
+		return;
+	}
+
+	// a running stream switches at its next transfer and keeps the time continuous
+	std::lock_guard<std::mutex> rates(_rate_mutex);
+	sampleRate = hardwareRate;
+	_outputRate = outputRate;
+	_ratePending = true;
 }
 
 double SoapyICR8600::getSampleRate(const int direction, const size_t channel) const
 {
-	return sampleRate;
+	return _outputRate;
 }
 
+// The hardware rates and common ones the resampler makes from them
 std::vector<double> SoapyICR8600::listSampleRates(const int direction, const size_t channel) const
 {
 	std::vector<double> results;
-	results.push_back(240000);
-	results.push_back(480000);
-	results.push_back(960000);
-	results.push_back(1920000);
-	results.push_back(3840000);
-	results.push_back(5120000);
+	results.push_back(48000);
+	results.push_back(96000);
+	results.push_back(192000);
+	for (size_t i = 0; i < NUM_HARDWARE_RATES; i++) results.push_back(hardwareRates[i]);
+	return results;
+}
+
+SoapySDR::RangeList SoapyICR8600::getSampleRateRange(const int direction, const size_t channel) const
+{
+	SoapySDR::RangeList results;
+	results.push_back(SoapySDR::Range(IQ_RESAMPLE_MIN_RATE, hardwareRates[NUM_HARDWARE_RATES - 1]));
 	return results;
 }
 
@@ -570,6 +906,100 @@ std::vector<double> SoapyICR8600::listBandwidths(const int direction, const size
 	return results;
 }
 
+/*******************************************************************
+ * Time API
+ ******************************************************************/
+
+static long long hostTimeNs(void)
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+long long SoapyICR8600::ticksToTimeNs(const StreamRate &rate, const unsigned long long ticks)
+{
+	return rate.timeNs + SoapySDR::ticksToTimeNs((long long)(ticks - rate.tick), rate.hardwareRate);
+}
+
+bool SoapyICR8600::hasHardwareTime(const std::string &what) const
+{
+	return what.empty();
+}
+
+long long SoapyICR8600::getHardwareTime(const std::string &what) const
+{
+	// time of the latest sample received, the host clock while not streaming
+	if (!_rx_running) return hostTimeNs();
+	std::lock_guard<std::mutex> lock(_rate_mutex);
+	return ticksToTimeNs(_rxRate, _rxTicks);
+}
+
+/*******************************************************************
+ * Receiver state
+ ******************************************************************/
+
+// Read everything back from the radio, with _device_mutex held
+BOOL SoapyICR8600::refreshState(void)
+{
+	ICR8600_STATE st;
+	ULONG fields = ICR8600GetState(transport.get(), &st);
+
+	std::lock_guard<std::mutex> state(_state_mutex);
+	if (fields & ICR8600_STATE_FREQUENCY) centerFrequency = st.Frequency;
+	if (fields & ICR8600_STATE_ANTENNA) antennaIndex = (int)st.AntennaIndex;
+	if (fields & ICR8600_STATE_PREAMP) preampOn = st.PreAmpOn;
+	if (fields & ICR8600_STATE_ATTENUATOR) attenuator = st.Attenuator;
+	if (fields & ICR8600_STATE_GAIN_RF) gainRF = st.GainRF;
+	_stateFields |= fields;
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "refreshState: %d Hz, ANT %d, pre-amp %s, attenuator %d dB, RF gain %d",
+		centerFrequency, antennaIndex + 1, preampOn ? "on" : "off", attenuator, gainRF);
+	return fields == ICR8600_STATE_ALL;
+}
+
+// The first getter of a field nobody set yet reads the state from the radio once
+void SoapyICR8600::requireState(const ULONG fields) const
+{
+	{
+		std::lock_guard<std::mutex> state(_state_mutex);
+		if ((_stateFields & fields) == fields) return;
+	}
+	std::lock_guard<std::mutex> lock(_device_mutex);
+	const_cast<SoapyICR8600 *>(this)->refreshState();
+}
+
+// Transceive frame from the radio, called on the CI-V reader thread
+void SoapyICR8600::civ_notify(const UCHAR *frame, ULONG length)
+{
+	std::lock_guard<std::mutex> state(_state_mutex);
+	ICR8600_STATE st;
+	switch (ICR8600ParseState(frame, length, &st))
+	{
+	case ICR8600_STATE_FREQUENCY:
+		centerFrequency = st.Frequency;
+		_stateFields |= ICR8600_STATE_FREQUENCY;
+		break;
+	case ICR8600_STATE_ANTENNA:
+		antennaIndex = (int)st.AntennaIndex;
+		_stateFields |= ICR8600_STATE_ANTENNA;
+		break;
+	case ICR8600_STATE_PREAMP:
+		preampOn = st.PreAmpOn;
+		_stateFields |= ICR8600_STATE_PREAMP;
+		break;
+	case ICR8600_STATE_ATTENUATOR:
+		attenuator = st.Attenuator;
+		_stateFields |= ICR8600_STATE_ATTENUATOR;
+		break;
+	case ICR8600_STATE_GAIN_RF:
+		gainRF = st.GainRF;
+		_stateFields |= ICR8600_STATE_GAIN_RF;
+		break;
+	default:
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "civ_notify: ignored %d byte frame, command %02X", (int)length, length > 4 ? frame[4] : 0);
+		return;
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "civ_notify: radio reported command %02X", frame[4]);
+}
+
 /*******************************************************************
  * Settings API
  ******************************************************************/
@@ -578,6 +1008,22 @@ SoapySDR::ArgInfoList SoapyICR8600::getSettingInfo(void) const
 {
 	SoapySDR::ArgInfoList setArgs;
 
+	SoapySDR::ArgInfo streamTraceArg;
+	streamTraceArg.key = "stream_trace";
+	streamTraceArg.value = "false";
+	streamTraceArg.name = "Stream Trace";
+	streamTraceArg.description = "Log streaming counters once per second (needs a build with ENABLE_STREAM_TRACE)";
+	streamTraceArg.type = SoapySDR::ArgInfo::BOOL;
+	setArgs.push_back(streamTraceArg);
+
+	SoapySDR::ArgInfo civLatencyArg;
+	civLatencyArg.key = "civ_latency";
+	civLatencyArg.value = "false";
+	civLatencyArg.name = "CI-V Latency";
+	civLatencyArg.description = "Log the reply latency of every CI-V command, per opcode";
+	civLatencyArg.type = SoapySDR::ArgInfo::BOOL;
+	setArgs.push_back(civLatencyArg);
+
 	//SoapySDR::ArgInfo directSampArg;
 	//directSampArg.key = "direct_samp";
 	//directSampArg.value = "0";
@@ -608,13 +1054,48 @@ SoapySDR::ArgInfoList SoapyICR8600::getSettingInfo(void) const
 	//iqSwapArg.type = SoapySDR::ArgInfo::BOOL;
 	//setArgs.push_back(iqSwapArg);
 
-	//SoapySDR::ArgInfo digitalAGCArg;
-	//digitalAGCArg.key = "digital_agc";
-	//digitalAGCArg.value = "false";
-	//digitalAGCArg.name = "Digital AGC";
-	//digitalAGCArg.description = "RTL-SDR digital AGC Mode";
-	//digitalAGCArg.type = SoapySDR::ArgInfo::BOOL;
-	//setArgs.push_back(digitalAGCArg);
+	SoapySDR::ArgInfo digitalAGCArg;
+	digitalAGCArg.key = "digital_agc";
+	digitalAGCArg.value = "false";
+	digitalAGCArg.name = "Digital AGC";
+	digitalAGCArg.description = "AGC on the returned samples, the IC-R8600 has none in I/Q mode";
+	digitalAGCArg.type = SoapySDR::ArgInfo::BOOL;
+	setArgs.push_back(digitalAGCArg);
+
+	SoapySDR::ArgInfo agcAttackArg;
+	agcAttackArg.key = "agc_attack";
+	agcAttackArg.value = std::to_string(IQ_AGC_DEFAULT_ATTACK);
+	agcAttackArg.name = "AGC Attack";
+	agcAttackArg.description = "Digital AGC time constant for rising levels";
+	agcAttackArg.units = "s";
+	agcAttackArg.type = SoapySDR::ArgInfo::FLOAT;
+	setArgs.push_back(agcAttackArg);
+
+	SoapySDR::ArgInfo agcDecayArg;
+	agcDecayArg.key = "agc_decay";
+	agcDecayArg.value = std::to_string(IQ_AGC_DEFAULT_DECAY);
+	agcDecayArg.name = "AGC Decay";
+	agcDecayArg.description = "Digital AGC time constant for falling levels";
+	agcDecayArg.units = "s";
+	agcDecayArg.type = SoapySDR::ArgInfo::FLOAT;
+	setArgs.push_back(agcDecayArg);
+
+	SoapySDR::ArgInfo agcLevelArg;
+	agcLevelArg.key = "agc_level";
+	agcLevelArg.value = std::to_string(IQ_AGC_DEFAULT_LEVEL);
+	agcLevelArg.name = "AGC Level";
+	agcLevelArg.description = "Digital AGC output level, relative to a full scale complex sine";
+	agcLevelArg.units = "dBFS";
+	agcLevelArg.type = SoapySDR::ArgInfo::FLOAT;
+	setArgs.push_back(agcLevelArg);
+
+	SoapySDR::ArgInfo ncoTuneArg;
+	ncoTuneArg.key = "nco_tune";
+	ncoTuneArg.value = "false";
+	ncoTuneArg.name = "NCO Fine Tuning";
+	ncoTuneArg.description = "Shift the stream by the sub-Hz offset the 1 Hz steps and the frequency correction leave";
+	ncoTuneArg.type = SoapySDR::ArgInfo::BOOL;
+	setArgs.push_back(ncoTuneArg);
 
 	SoapySDR_logf(SOAPY_SDR_INFO, "SETARGS?");
 
@@ -623,6 +1104,57 @@ SoapySDR::ArgInfoList SoapyICR8600::getSettingInfo(void) const
 
 void SoapyICR8600::writeSetting(const std::string &key, const std::string &value)
 {
+	if (key == "stream_trace")
+	{
+		bool enable = (value == "true");
+		if (enable && !StreamTrace::compiledIn()) {
+			SoapySDR_logf(SOAPY_SDR_WARNING, "stream_trace: not compiled in, rebuild with ENABLE_STREAM_TRACE");
+		}
+		_trace.setEnabled(enable);
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "stream_trace: %s", _trace.enabled() ? "true" : "false");
+		return;
+	}
+
+	if (key == "civ_latency")
+	{
+		ICR8600SetLatencyLog(value == "true");
+		return;
+	}
+
+	if (key == "nco_tune")
+	{
+		requireState(ICR8600_STATE_FREQUENCY);
+		std::lock_guard<std::mutex> lock(_device_mutex);
+		double frequency = targetFrequency();
+		_ncoTune = (value == "true");
+		tuneTo(frequency);
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "nco_tune: %s, shift %.3f Hz", _ncoTune ? "true" : "false", _nco.frequency());
+		return;
+	}
+
+	if (key == "digital_agc")
+	{
+		_agc.setEnabled(value == "true");
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "digital_agc: %s", _agc.enabled() ? "true" : "false");
+		return;
+	}
+	if (key == "agc_attack" || key == "agc_decay" || key == "agc_level")
+	{
+		double v;
+		try
+		{
+			v = std::stod(value);
+		}
+		catch (const std::exception &) {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "%s: invalid value '%s'", key.c_str(), value.c_str());
+			return;
+		}
+		if (key == "agc_attack") _agc.setAttack(v);
+		if (key == "agc_decay") _agc.setDecay(v);
+		if (key == "agc_level") _agc.setLevel(v);
+		return;
+	}
+
 	//if (key == "direct_samp")
 	//{
 	//    try
@@ -647,16 +1179,66 @@ void SoapyICR8600::writeSetting(const std::string &key, const std::string &value
 	//    SoapySDR_logf(SOAPY_SDR_DEBUG, "RTL-SDR offset_tune mode: %s", offsetMode ? "true" : "false");
 	//    rtlsdr_set_offset_tuning(dev, offsetMode ? 1 : 0);
 	//}
-	//else if (key == "digital_agc")
-	//{
-	//    digitalAGC = (value == "true") ? true : false;
-	//    SoapySDR_logf(SOAPY_SDR_DEBUG, "RTL-SDR digital agc mode: %s", digitalAGC ? "true" : "false");
-	//    rtlsdr_set_agc_mode(dev, digitalAGC ? 1 : 0);
-	//}
 }
 
 std::string SoapyICR8600::readSetting(const std::string &key) const
 {
+	if (key == "stream_trace") {
+		return _trace.enabled() ? "true" : "false";
+	}
+	if (key == "civ_latency") {
+		return ICR8600GetLatencyLog() ? "true" : "false";
+	}
+	if (key == "nco_tune") {
+		return _ncoTune ? "true" : "false";
+	}
+	if (key == "digital_agc") {
+		return _agc.enabled() ? "true" : "false";
+	}
+	if (key == "agc_attack") {
+		return std::to_string(_agc.attack());
+	}
+	if (key == "agc_decay") {
+		return std::to_string(_agc.decay());
+	}
+	if (key == "agc_level") {
+		return std::to_string(_agc.level());
+	}
+
+	// running drop counts of the RX stream, read only
+	if (key == "overflows") {
+		return std::to_string(_overflows);
+	}
+	if (key == "dropped_transfers") {
+		return std::to_string(_droppedTransfers);
+	}
+	if (key == "short_reads") {
+		return std::to_string(_shortReads);
+	}
+	if (key == "sync_errors") {
+		return std::to_string(_syncErrors);
+	}
+	// for the thread that calls readStream: comma separated, in the samples it returned last
+	if (key == "sync_offsets") {
+		std::string offsets;
+		for (size_t i = 0; i < _readSyncCount; i++) {
+			if (i > 0) offsets += ",";
+			offsets += std::to_string(_readSync[i]);
+		}
+		return offsets;
+	}
+
+	// read the receiver state back from the radio, "true" when all of it was read
+	if (key == "refresh_state") {
+		std::lock_guard<std::mutex> lock(_device_mutex);
+		return const_cast<SoapyICR8600 *>(this)->refreshState() ? "true" : "false";
+	}
+
+	// scan mode: centre frequency of the samples readStream returned last
+	if (key == "scan_frequency") {
+		return std::to_string(_scanFrequency);
+	}
+
 	return "false";
 	//if (key == "direct_samp") {
 	//    return std::to_string(directSamplingMode);
@@ -664,8 +1246,6 @@ std::string SoapyICR8600::readSetting(const std::string &key) const
 	//	return "false";
 	//} else if (key == "offset_tune") {
 	//	return "false";
-	//} // else if (key == "digital_agc") {
-	//    return digitalAGC?"true":"false";
 	//}
 
 	SoapySDR_logf(SOAPY_SDR_WARNING, "Unknown setting '%s'", key.c_str());
@@ -0,0 +1,357 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "ICR8600Transport.h"
+#include "IQConvert.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+#define bcdToDec(val) (ULONG)((val>>4)*10 + (val & 0x0f))
+#define decToBcd(val) (UCHAR)((((val) / 10 * 16) + ((val) % 10)))
+
+// test tone: a quarter of full scale, one turn every SIM_TONE_PERIOD samples
+#define SIM_TONE_PERIOD 64
+#define SIM_TONE_LEVEL 8192.0
+
+static const ULONG simSampleRates[] = { 5120000, 3840000, 1920000, 960000, 480000, 240000 };
+
+SimTransport::SimTransport(const SoapySDR::Kwargs &args)
+{
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SimTransport::SimTransport");
+	sampleRate = 1920000;
+	frequency = 15000000;
+	antenna = 0;
+	preamp = 0;
+	attenuator = 0;
+	gainRF = 255;
+	remoteOn = FALSE;
+
+	paced = !(args.count("sim_paced") != 0 && args.at("sim_paced") == "0");
+	latency = std::chrono::steady_clock::duration::zero();
+	if (args.count("sim_latency") != 0) {
+		latency = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double, std::milli>(std::max(atof(args.at("sim_latency").c_str()), 0.0)));
+	}
+	dialPeriod = std::chrono::steady_clock::duration::zero();
+	if (args.count("sim_dial") != 0) {
+		dialPeriod = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double, std::milli>(std::max(atof(args.at("sim_dial").c_str()), 0.0)));
+	}
+	dialNext = std::chrono::steady_clock::now() + dialPeriod;
+	sourcePos = 0;
+	syncPos = 0;
+	wordsSent = 0;
+	cancelAsync = false;
+	asyncRunning = false;
+
+	replay = (args.count("replay") != 0);
+	if (replay) {
+		// raw capture of the I/Q pipe, sync words included
+		std::ifstream file(args.at("replay").c_str(), std::ios::binary | std::ios::ate);
+		std::streamsize size = file.tellg();
+		if (!file || size < (std::streamsize)sizeof(uint32_t)) {
+			throw std::runtime_error("SimTransport: cannot read replay file " + args.at("replay"));
+		}
+		source.resize((size_t)size / sizeof(uint32_t));
+		file.seekg(0);
+		file.read((char *)source.data(), source.size() * sizeof(uint32_t));
+		SoapySDR_logf(SOAPY_SDR_INFO, "SimTransport: replaying %d words from %s", (int)source.size(), args.at("replay").c_str());
+	}
+	else {
+		source.resize(SIM_TONE_PERIOD);
+		for (size_t i = 0; i < source.size(); i++) {
+			double phase = 2.0 * 3.14159265358979323846 * (double)i / SIM_TONE_PERIOD;
+			int16_t iq[2] = { (int16_t)std::lround(SIM_TONE_LEVEL * cos(phase)), (int16_t)std::lround(SIM_TONE_LEVEL * sin(phase)) };
+			std::memcpy(&source[i], iq, sizeof(iq));
+		}
+	}
+}
+
+BOOL SimTransport::GetDescriptor(USB_DEVICE_DESCRIPTOR *Desc)
+{
+	Desc->idVendor = ICR8600_VID;
+	Desc->idProduct = ICR8600_PID;
+	Desc->bcdUSB = 0x0200;
+	return TRUE;
+}
+
+/*******************************************************************
+ * CI-V
+ ******************************************************************/
+
+// FE FE E0 96 <payload> FD, padded to an even length like the radio does;
+// transceive broadcasts go to 00. Called with replyMutex held.
+void SimTransport::reply(const std::vector<UCHAR> &payload, UCHAR to)
+{
+	std::vector<UCHAR> frame;
+	frame.push_back(0xFE);
+	frame.push_back(0xFE);
+	frame.push_back(to);
+	frame.push_back(0x96);
+	frame.insert(frame.end(), payload.begin(), payload.end());
+	frame.push_back(0xFD);
+	if (frame.size() % 2) frame.push_back(0xFF);
+
+	// every reply is a round trip late, in the order of the commands, so
+	// commands written back to back are answered together
+	std::chrono::steady_clock::time_point ready = std::chrono::steady_clock::now();
+	if (to == 0xE0) ready += latency;
+	if (!replyTimes.empty()) ready = std::max(ready, replyTimes.back());
+	replies.push_back(frame);
+	replyTimes.push_back(ready);
+	replyCond.notify_all();
+}
+
+void SimTransport::ack(BOOL ok)
+{
+	reply(std::vector<UCHAR>(1, ok ? 0xFB : 0xFA));
+}
+
+void SimTransport::handleCommand(const UCHAR *cmd, size_t len)
+{
+	// cmd points past FE FE 96 E0, len excludes FD
+	if (len == 0) {
+		ack(FALSE);
+		return;
+	}
+
+	std::vector<UCHAR> r(cmd, cmd + len);
+	switch (cmd[0]) {
+	case 0x1A:
+		// 1A 13 00 xx: remote on/off, 1A 13 01 01 00 xx: I/Q sample rate
+		if (len == 4 && cmd[1] == 0x13 && cmd[2] == 0x00) {
+			remoteOn = (cmd[3] != 0);
+			ack(TRUE);
+		}
+		else if (len == 6 && cmd[1] == 0x13 && cmd[2] == 0x01 && cmd[5] >= 1 && cmd[5] <= 6) {
+			sampleRate = simSampleRates[cmd[5] - 1];
+			ack(TRUE);
+		}
+		else ack(FALSE);
+		break;
+	case 0x03:
+		// frequency, 5 BCD bytes, least significant first
+		r.resize(1);
+		for (ULONG f = frequency, i = 0; i < 5; i++, f /= 100) r.push_back(decToBcd(f % 100));
+		reply(r);
+		break;
+	case 0x05:
+		if (len == 6) {
+			ULONG f = 0;
+			for (int i = 5; i >= 1; i--) f = f * 100 + bcdToDec(cmd[i]);
+			frequency = f;
+			ack(TRUE);
+		}
+		else ack(FALSE);
+		break;
+	case 0x11:
+		if (len == 1) {
+			r.push_back(decToBcd(attenuator));
+			reply(r);
+		}
+		else {
+			attenuator = (UCHAR)bcdToDec(cmd[1]);
+			ack(TRUE);
+		}
+		break;
+	case 0x12:
+		// antenna selection only works in the HF region
+		if (frequency >= 30000000) ack(FALSE);
+		else if (len == 1) {
+			r.push_back(antenna);
+			reply(r);
+		}
+		else {
+			antenna = cmd[1];
+			ack(antenna <= 2);
+		}
+		break;
+	case 0x14:
+		if (len == 2 && cmd[1] == 0x02) {
+			r.push_back(decToBcd(gainRF / 100));
+			r.push_back(decToBcd(gainRF % 100));
+			reply(r);
+		}
+		else if (len == 4 && cmd[1] == 0x02) {
+			gainRF = bcdToDec(cmd[2]) * 100 + bcdToDec(cmd[3]);
+			ack(TRUE);
+		}
+		else ack(FALSE);
+		break;
+	case 0x16:
+		if (len == 2 && cmd[1] == 0x02) {
+			r.push_back(preamp);
+			reply(r);
+		}
+		else if (len == 3 && cmd[1] == 0x02) {
+			preamp = cmd[2];
+			ack(TRUE);
+		}
+		else ack(FALSE);
+		break;
+	default:
+		ack(FALSE);
+	}
+}
+
+// Someone at the front panel: the frequency steps up 1 kHz every dialPeriod and
+// the radio broadcasts it (transceive, command 00). Called with replyMutex held.
+void SimTransport::turnDial(void)
+{
+	if (dialPeriod == std::chrono::steady_clock::duration::zero()) return;
+	for (; dialNext <= std::chrono::steady_clock::now(); dialNext += dialPeriod) {
+		frequency += 1000;
+		std::vector<UCHAR> r(1, 0x00);
+		for (ULONG f = frequency, i = 0; i < 5; i++, f /= 100) r.push_back(decToBcd(f % 100));
+		reply(r, 0x00);
+	}
+}
+
+BOOL SimTransport::WriteControl(PUCHAR Buffer, ULONG Length, PULONG Written)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "SimTransport::WriteControl");
+	*Written = Length;
+	std::lock_guard<std::mutex> lock(replyMutex);
+	if (Length < 5 || Buffer[0] != 0xFE || Buffer[1] != 0xFE || Buffer[2] != 0x96 || Buffer[3] != 0xE0) {
+		ack(FALSE);
+		return TRUE;
+	}
+	const UCHAR *end = std::find(Buffer + 4, Buffer + Length, 0xFD);
+	handleCommand(Buffer + 4, end - (Buffer + 4));
+	return TRUE;
+}
+
+ULONG SimTransport::ReadResponse(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs)
+{
+	// replies are queued by WriteControl and the dial, each ready at its time
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(TimeoutMs);
+	std::unique_lock<std::mutex> lock(replyMutex);
+	for (;;) {
+		turnDial();
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		if (!replies.empty() && replyTimes.front() <= now) {
+			break;
+		}
+		if (now >= deadline) {
+			return 0;
+		}
+		std::chrono::steady_clock::time_point wake = deadline;
+		if (!replies.empty()) wake = std::min(wake, replyTimes.front());
+		if (dialPeriod != std::chrono::steady_clock::duration::zero()) wake = std::min(wake, dialNext);
+		replyCond.wait_until(lock, wake);
+	}
+	ULONG n = std::min<ULONG>(Length, (ULONG)replies.front().size());
+	std::memcpy(Buffer, replies.front().data(), n);
+	replies.pop_front();
+	replyTimes.pop_front();
+	return n;
+}
+
+/*******************************************************************
+ * I/Q
+ ******************************************************************/
+
+void SimTransport::fillIQ(PUCHAR Buffer, ULONG Length)
+{
+	uint32_t *out = (uint32_t *)Buffer;
+	size_t n = Length / sizeof(uint32_t);
+	wordsSent += n;
+
+	while (n > 0) {
+		// a replayed capture carries its own sync words
+		if (!replay && syncPos == SIM_SYNC_INTERVAL) {
+			*out++ = IQ_SYNC_WORD;
+			syncPos = 0;
+			n--;
+			continue;
+		}
+		size_t chunk = std::min(n, source.size() - sourcePos);
+		if (!replay) chunk = std::min(chunk, SIM_SYNC_INTERVAL - syncPos);
+		std::memcpy(out, &source[sourcePos], chunk * sizeof(uint32_t));
+		out += chunk;
+		n -= chunk;
+		sourcePos = (sourcePos + chunk) % source.size();
+		syncPos += chunk;
+	}
+}
+
+ULONG SimTransport::ReadIQ(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs)
+{
+	if (paced) {
+		// the transfer completes once its samples would have arrived from the radio
+		double seconds = (double)(Length / sizeof(uint32_t)) / sampleRate;
+		if (TimeoutMs != 0 && seconds * 1000.0 > TimeoutMs) {
+			std::this_thread::sleep_for(std::chrono::milliseconds(TimeoutMs));
+			return 0;
+		}
+		std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+	}
+	fillIQ(Buffer, Length);
+	return Length;
+}
+
+BOOL SimTransport::ReadIQAsync(ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "SimTransport::ReadIQAsync");
+	// a cancel left over from a read that already ended must not stop this one
+	cancelAsync = false;
+	asyncRunning = true;
+
+	std::vector<PUCHAR> buffers;
+	for (ULONG i = 0; i < NumTransfers; i++) {
+		PUCHAR buffer = Callback(NULL, 0, Context);
+		if (buffer == NULL) break;
+		buffers.push_back(buffer);
+	}
+
+	// transfers complete in the order they were queued, at the pace of the sample rate
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	wordsSent = 0;
+	BOOL result = TRUE;
+	size_t i = 0;
+	while (!cancelAsync && !buffers.empty()) {
+		fillIQ(buffers[i], TransferLength);
+		if (paced) {
+			std::this_thread::sleep_until(start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+				std::chrono::duration<double>((double)wordsSent / sampleRate)));
+		}
+		if (cancelAsync) break;
+		buffers[i] = Callback(buffers[i], TransferLength, Context);
+		if (buffers[i] == NULL) break;
+		// on the bus two transfers would write it at once, fail like a broken stream
+		if (std::count(buffers.begin(), buffers.end(), buffers[i]) > 1) {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "SimTransport::ReadIQAsync: buffer queued on two transfers at once");
+			result = FALSE;
+			break;
+		}
+		i = (i + 1) % buffers.size();
+	}
+
+	asyncRunning = false;
+	cancelAsync = false;
+	return result;
+}
+
+VOID SimTransport::CancelIQAsync(void)
+{
+	// like the USB transport, only a running read is cancelled
+	if (asyncRunning) cancelAsync = true;
+}
@@ -22,8 +22,15 @@
 #include <mutex>
 #include <condition_variable>
 #include <atomic>
+#include <deque>
+#include <memory>
+#include <SoapySDR/Time.hpp>
 
-#include "WinUSBDevice.h"
+#include "ICR8600Transport.h"
+#include "CIVCommands.h"
+#include "StreamTrace.h"
+#include "IQDsp.h"
+#include "BufferArena.h"
 
 typedef enum SDRRXFormat
 {
@@ -31,7 +38,48 @@ typedef enum SDRRXFormat
 } sdrRXFormat;
 
 #define DEFAULT_BUFFER_LENGTH (4 * 1024)
+#define DEFAULT_NUM_BUFFERS 16
+#define DEFAULT_NUM_TRANSFERS 4
 #define BYTES_PER_SAMPLE 2
+#define BYTES_PER_FRAME (2 * BYTES_PER_SAMPLE)
+
+// Automatic sizing of the stream buffers when the stream args leave them at 0:
+// a transfer holds DEFAULT_LATENCY seconds at the hardware rate, in whole USB packets
+// up to MAX_BUFFER_LENGTH, enough are queued for AUTO_QUEUE_TIME and the ring holds AUTO_RING_TIME
+#define DEFAULT_LATENCY 0.004
+#define USB_PACKET_SIZE 512
+#define MAX_BUFFER_LENGTH (1024 * 1024)
+#define MAX_NUM_TRANSFERS 32
+#define AUTO_QUEUE_TIME 0.016
+#define AUTO_RING_TIME 0.1
+#define SYNC_WORDS_PER_BUFFER 64
+
+// readStream flag: a sync word was dropped from the I/Q stream right before the first returned sample
+#ifdef SOAPY_SDR_USER_FLAG0
+#define ICR8600_FLAG_SYNC_WORD SOAPY_SDR_USER_FLAG0
+#else
+#define ICR8600_FLAG_SYNC_WORD (1 << 16)
+#endif
+
+// readStream flag, scan mode: the first returned sample is the first one of a new hop
+#ifdef SOAPY_SDR_USER_FLAG1
+#define ICR8600_FLAG_SCAN_HOP SOAPY_SDR_USER_FLAG1
+#else
+#define ICR8600_FLAG_SCAN_HOP (1 << 17)
+#endif
+
+#define DEFAULT_SCAN_DWELL 0.01
+#define DEFAULT_SCAN_SETTLE 1024
+
+// A sample rate as the stream sees it: from tick on, whose time is timeNs, the
+// radio ran at hardwareRate and readStream returned outputRate
+struct StreamRate
+{
+	unsigned long long tick;
+	long long timeNs;
+	ULONG hardwareRate;
+	double outputRate;
+};
 
 class SoapyICR8600 : public SoapySDR::Device
 {
@@ -117,6 +165,30 @@ public:
 
 	bool hasDCOffsetMode(const int direction, const size_t channel) const;
 
+	void setDCOffsetMode(const int direction, const size_t channel, const bool automatic);
+
+	bool getDCOffsetMode(const int direction, const size_t channel) const;
+
+	bool hasDCOffset(const int direction, const size_t channel) const;
+
+	void setDCOffset(const int direction, const size_t channel, const std::complex<double> &offset);
+
+	std::complex<double> getDCOffset(const int direction, const size_t channel) const;
+
+#ifdef SOAPY_SDR_API_HAS_IQ_BALANCE_MODE
+	bool hasIQBalanceMode(const int direction, const size_t channel) const;
+
+	void setIQBalanceMode(const int direction, const size_t channel, const bool automatic);
+
+	bool getIQBalanceMode(const int direction, const size_t channel) const;
+#endif
+
+	bool hasIQBalance(const int direction, const size_t channel) const;
+
+	void setIQBalance(const int direction, const size_t channel, const std::complex<double> &balance);
+
+	std::complex<double> getIQBalance(const int direction, const size_t channel) const;
+
 	bool hasFrequencyCorrection(const int direction, const size_t channel) const;
 
 	void setFrequencyCorrection(const int direction, const size_t channel, const double value);
@@ -171,12 +243,21 @@ public:
 
 	std::vector<double> listSampleRates(const int direction, const size_t channel) const;
 
+	SoapySDR::RangeList getSampleRateRange(const int direction, const size_t channel) const;
+
 	void setBandwidth(const int direction, const size_t channel, const double bw);
 
 	double getBandwidth(const int direction, const size_t channel) const;
 
 	std::vector<double> listBandwidths(const int direction, const size_t channel) const;
 
+	/*******************************************************************
+	 * Time API
+	 ******************************************************************/
+
+	bool hasHardwareTime(const std::string &what = "") const;
+
+	long long getHardwareTime(const std::string &what = "") const;
 
 	/*******************************************************************
 	 * Settings API
@@ -188,22 +269,199 @@ public:
 
 	std::string readSetting(const std::string &key) const;
 
+	/*******************************************************************
+	 * Async RX engine
+	 ******************************************************************/
+
+	void rx_async_thread(void);
+
+	PUCHAR rx_callback(PUCHAR buf, ULONG len);
+
+	void scan_thread(void);
+
+	// transceive frames the radio sends on its own
+	void civ_notify(const UCHAR *frame, ULONG length);
+
 private:
-	// WinUSB access
-	DEVICE_DATA deviceData;
+	// USB or simulated radio, see ICR8600Transport.h
+	std::unique_ptr<ICR8600Transport> transport;
 	USB_DEVICE_DESCRIPTOR deviceDesc;
+	// which radio was opened, see ICR8600_DEVICE_INFO
+	std::string _serial;
+	std::string _usbPath;
 
 	//cached settings
 	sdrRXFormat rxFormat;
-	ULONG sampleRate;
+	std::atomic<ULONG> sampleRate;
+	// rate of the returned samples, _resampler decimates to it when sampleRate,
+	// the nearest hardware rate above, is not the same
+	std::atomic<double> _outputRate;
+
+	// receiver state, updated on every successful set, on transceive frames and by
+	// refreshState; the getters read it under _state_mutex without going to the radio.
+	// _stateFields has the ICR8600_STATE_* bits of what is known.
 	ULONG centerFrequency;
 	int antennaIndex;
+	BOOL preampOn;
+	ULONG attenuator;
+	ULONG gainRF;
+	ULONG _stateFields;
+	BOOL refreshState(void);
+	void requireState(const ULONG fields) const;
+
+	// frequency correction: the radio is commanded frequency / (1 + ppm) in 1 Hz steps
+	// and, with _ncoTune, _nco shifts the stream by what the step leaves. _tuneFrequency
+	// is the last frequency asked for, _tuneCommanded what the radio was sent for it.
+	std::atomic<double> _ppm;
+	std::atomic<bool> _ncoTune;
+	double _tuneFrequency;
+	ULONG _tuneCommanded;
+	BOOL tuneTo(const double frequency, const ICR8600_STATE *gain = NULL, const ULONG gainFields = 0);
+
+	// gain elements of a plan in a CIVCommandQueue: queueGain pushes those of
+	// fields that differ from the cached state, commitGain records the outcome
+	struct GainCommands
+	{
+		size_t preamp;
+		size_t attenuator;
+		size_t gainRF;
+	};
+	GainCommands queueGain(CIVCommandQueue &queue, const ICR8600_STATE &plan, const ULONG fields);
+	void commitGain(const CIVCommandQueue &queue, const ICR8600_STATE &plan, const GainCommands &commands);
+	double tunedFrequency(void) const;
+	double targetFrequency(void) const;
 	size_t bufferLength;
-	unsigned char *bufferData;
+	size_t numBuffers;
+	size_t numTransfers;
+
+	// sizes given as stream args, 0 for those sized from the hardware rate.
+	// _sizedRate is the rate the buffers were sized for; activateStream sizes
+	// and carves them again if the rate changed since.
+	double _streamLatency;
+	size_t _bufferLengthArg;
+	size_t _numBuffersArg;
+	size_t _numTransfersArg;
+	bool _hugePages;
+	int _numaNode;
+	ULONG _sizedRate;
+	void sizeStream(const ULONG rate, size_t &length, size_t &buffers, size_t &transfers) const;
+	void carveStream(void);
+
+	// RX ring of pinned, page aligned buffers the USB transfers land in,
+	// consumed in place by readStream and the direct buffer access API.
+	// The ring, the drop buffers and the DSP scratch buffers are carved from _arena.
+	std::thread _rx_async_thread;
+	std::atomic<bool> _rx_running;
+	BufferArena _arena;
+	unsigned char *_buffPool;
+	size_t _buffStride;
+	std::vector<size_t> _buffElems;
+	std::vector<unsigned char> _buffGap;
+	// one drop buffer per transfer, a transfer queued while the ring is full
+	// lands in one of its own; _dropFree holds those no transfer is using
+	unsigned char *_dropPool;
+	size_t _dropStride;
+	std::vector<unsigned char *> _dropFree;
+	bool isDropBuffer(const unsigned char *buf) const
+	{
+		return buf != NULL && buf >= _dropPool && buf < _dropPool + numTransfers * _dropStride;
+	}
+	std::vector<size_t> _syncPos;
+	std::vector<size_t> _syncCount;
+	size_t _buf_head;
+	size_t _buf_tail;
+	size_t _buf_queued;
+	size_t _buf_acquired;
+	std::atomic<size_t> _buf_count;
+
+	// drop detection, run on the RX thread as transfers complete:
+	// a transfer lost to a full ring or a break in the sync word cadence
+	// marks the next buffer, which readStream then reports as SOAPY_SDR_OVERFLOW
+	bool checkSyncCadence(const size_t slot);
+	bool _gapPending;
+	unsigned long long _rxElems;
+	unsigned long long _lastSyncElem;
+	bool _lastSyncValid;
+	size_t _syncInterval;
+	// samples between sync words once the cadence locked, 0 before; kept for getStreamMTU
+	std::atomic<size_t> _syncCadence;
+	size_t _syncCandidate;
+	size_t _syncRepeats;
+	std::atomic<bool> _rx_abrupt;
+	std::atomic<unsigned long long> _overflows;
+	std::atomic<unsigned long long> _droppedTransfers;
+	std::atomic<unsigned long long> _shortReads;
+	std::atomic<unsigned long long> _syncErrors;
+
+	// stream time: samples since activateStream, sync words excluded and dropped
+	// transfers included, converted at the rate they came at from the host clock
+	// time that rate took effect. setSampleRate only marks a new rate pending, the
+	// RX thread starts it at the next transfer, so every slot keeps the StreamRate
+	// of its samples and those already in the ring are timed and resampled as before.
+	static long long ticksToTimeNs(const StreamRate &rate, const unsigned long long ticks);
+	void applyPendingRate(void);
+	std::vector<unsigned long long> _buffTicks;
+	std::vector<StreamRate> _buffRate;
+	std::atomic<unsigned long long> _rxTicks;
+	StreamRate _rxRate;
+	std::atomic<bool> _ratePending;
+	// sampleRate and _outputRate are set and _rxRate is replaced with it held
+	mutable std::mutex _rate_mutex;
+
+	// scan mode, set up with the scan_* stream args: _scan_thread retunes through
+	// _scanFreqs as the samples of each dwell arrive, readStream only returns the
+	// samples of a hop's valid window [start, end), in stream ticks
+	struct ScanHop
+	{
+		unsigned long long seq;
+		ULONG frequency;
+		unsigned long long start;
+		unsigned long long end;
+	};
+	size_t scanClip(const unsigned long long tick, const size_t elems, size_t &valid, bool &hopStart);
+	std::vector<ULONG> _scanFreqs;
+	double _scanDwellSec;
+	size_t _scanSettle;
+	std::thread _scan_thread;
+	std::mutex _scan_mutex;
+	std::condition_variable _scan_cond;
+	std::atomic<unsigned long long> _scanWake;
+	std::deque<ScanHop> _scanHops;
+	std::atomic<ULONG> _scanFrequency;
+	unsigned long long _scanSeq;
+
+	// readStream position in the acquired buffer
+	size_t _currentHandle;
+	unsigned char *_currentBuff;
+	size_t bufferedElems;
+	size_t _currentElem;
+	size_t _currentSync;
+	// where sync words were removed in the samples of the last readStream,
+	// as offsets of the sample after each; read back with the sync_offsets setting
+	size_t _readSync[SYNC_WORDS_PER_BUFFER];
+	size_t _readSyncCount;
+
+	// processing of the returned samples, see IQDsp.h; CS16 streams
+	// go through _dspBuff as CF32 while a stage is on, and _resampleBuff
+	// after the resampler. _resampleStart is the tick the resampler was
+	// reset at, _resampleTick the one of the next sample it expects.
+	IQCorrector _iqCorrector;
+	NCOMixer _nco;
+	Resampler _resampler;
+	DigitalAGC _agc;
+	float *_dspBuff;
+	float *_resampleBuff;
+	unsigned long long _resampleStart;
+	unsigned long long _resampleTick;
+
+	// counters of the streaming path, see StreamTrace.h
+	StreamTrace _trace;
 
 	// mutex protection because we need to be thread safe
 	mutable std::mutex	_device_mutex;
+	mutable std::mutex	_state_mutex;
 	std::mutex	_buf_mutex;
+	std::condition_variable _buf_cond;
 
 };
 
@@ -0,0 +1,103 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#pragma once
+
+#include <SoapySDR/Logger.h>
+#include <atomic>
+#include <chrono>
+
+//
+// Tracing of the streaming hot path.
+// Compiled in with ICR8600_STREAM_TRACE (cmake -DENABLE_STREAM_TRACE=ON) and switched on
+// at runtime with the "stream_trace" setting. Events are only counted, a summary of the
+// counters is logged at most once per second. When tracing is off, counting is a single
+// relaxed load: no locks, no formatting, no syscalls.
+//
+
+class StreamTrace
+{
+public:
+	enum Counter
+	{
+		TRANSFERS,
+		BYTES,
+		DROPPED_TRANSFERS,
+		READS,
+		SAMPLES,
+		SYNC_WORDS,
+		NUM_COUNTERS
+	};
+
+	StreamTrace(void) : _enabled(false), _nextLogNs(0)
+	{
+		for (int i = 0; i < NUM_COUNTERS; i++) _counters[i] = 0;
+	}
+
+	static bool compiledIn(void)
+	{
+#ifdef ICR8600_STREAM_TRACE
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	void setEnabled(const bool enabled)
+	{
+		for (int i = 0; i < NUM_COUNTERS; i++) _counters[i] = 0;
+		_nextLogNs = 0;
+		_enabled = enabled && compiledIn();
+	}
+
+	bool enabled(void) const
+	{
+		return _enabled.load(std::memory_order_relaxed);
+	}
+
+	inline void count(const Counter counter, const unsigned long long n = 1)
+	{
+#ifdef ICR8600_STREAM_TRACE
+		if (_enabled.load(std::memory_order_relaxed)) {
+			_counters[counter].fetch_add(n, std::memory_order_relaxed);
+		}
+#endif
+	}
+
+	// Log and reset the counters once per second, called on the consumer side
+	inline void poll(void)
+	{
+#ifdef ICR8600_STREAM_TRACE
+		if (!_enabled.load(std::memory_order_relaxed)) return;
+
+		long long nowNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+		long long nextNs = _nextLogNs.load(std::memory_order_relaxed);
+		if (nowNs < nextNs) return;
+		_nextLogNs = nowNs + 1000000000LL;
+		if (nextNs == 0) return;
+
+		unsigned long long c[NUM_COUNTERS];
+		for (int i = 0; i < NUM_COUNTERS; i++) c[i] = _counters[i].exchange(0, std::memory_order_relaxed);
+		SoapySDR_logf(SOAPY_SDR_INFO, "ICR8600 stream: %llu transfers (%llu bytes), %llu dropped, %llu reads, %llu samples, %llu sync words",
+			c[TRANSFERS], c[BYTES], c[DROPPED_TRANSFERS], c[READS], c[SAMPLES], c[SYNC_WORDS]);
+#endif
+	}
+
+private:
+	std::atomic<bool> _enabled;
+	std::atomic<long long> _nextLogNs;
+	std::atomic<unsigned long long> _counters[NUM_COUNTERS];
+};
@@ -13,10 +13,15 @@
  */
 
 #include "SoapyICR8600.hpp"
+#include "IQConvert.h"
 #include <SoapySDR/Logger.hpp>
 #include <SoapySDR/Formats.hpp>
 #include <climits> 
 #include <cstring> 
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <sstream>
 
 std::vector<std::string> SoapyICR8600::getStreamFormats(const int direction, const size_t channel) const {
 	std::vector<std::string> formats;
@@ -41,6 +46,85 @@ SoapySDR::ArgInfoList SoapyICR8600::getStreamArgsInfo(const int direction, const
 
 	SoapySDR::ArgInfoList streamArgs;
 
+	SoapySDR::ArgInfo bufflenArg;
+	bufflenArg.key = "bufflen";
+	bufflenArg.value = "0";
+	bufflenArg.name = "Buffer Size";
+	bufflenArg.description = "Number of bytes per buffer, multiples of 512 only, 0 to size them from the sample rate and latency.";
+	bufflenArg.units = "bytes";
+	bufflenArg.type = SoapySDR::ArgInfo::INT;
+	streamArgs.push_back(bufflenArg);
+
+	SoapySDR::ArgInfo buffersArg;
+	buffersArg.key = "buffers";
+	buffersArg.value = "0";
+	buffersArg.name = "Ring buffers";
+	buffersArg.description = "Number of buffers in the RX ring, 0 for enough to hold 100 ms.";
+	buffersArg.units = "buffers";
+	buffersArg.type = SoapySDR::ArgInfo::INT;
+	streamArgs.push_back(buffersArg);
+
+	SoapySDR::ArgInfo transfersArg;
+	transfersArg.key = "transfers";
+	transfersArg.value = "0";
+	transfersArg.name = "USB transfers";
+	transfersArg.description = "Number of bulk reads kept queued on the I/Q endpoint, 0 for enough to cover 16 ms.";
+	transfersArg.units = "transfers";
+	transfersArg.type = SoapySDR::ArgInfo::INT;
+	streamArgs.push_back(transfersArg);
+
+	SoapySDR::ArgInfo latencyArg;
+	latencyArg.key = "latency";
+	latencyArg.value = std::to_string(DEFAULT_LATENCY);
+	latencyArg.name = "Latency";
+	latencyArg.description = "Time it takes the radio to fill a buffer, when its size is chosen automatically.";
+	latencyArg.units = "s";
+	latencyArg.type = SoapySDR::ArgInfo::FLOAT;
+	streamArgs.push_back(latencyArg);
+
+	SoapySDR::ArgInfo hugePagesArg;
+	hugePagesArg.key = "hugepages";
+	hugePagesArg.value = "false";
+	hugePagesArg.name = "Huge pages";
+	hugePagesArg.description = "Back the RX buffers with huge pages when the system has them reserved.";
+	hugePagesArg.type = SoapySDR::ArgInfo::BOOL;
+	streamArgs.push_back(hugePagesArg);
+
+	SoapySDR::ArgInfo numaNodeArg;
+	numaNodeArg.key = "numa_node";
+	numaNodeArg.value = "-1";
+	numaNodeArg.name = "NUMA node";
+	numaNodeArg.description = "Node the RX buffers are allocated on, -1 for the default policy.";
+	numaNodeArg.type = SoapySDR::ArgInfo::INT;
+	streamArgs.push_back(numaNodeArg);
+
+	SoapySDR::ArgInfo scanFreqsArg;
+	scanFreqsArg.key = "scan_freqs";
+	scanFreqsArg.value = "";
+	scanFreqsArg.name = "Scan frequencies";
+	scanFreqsArg.description = "Comma separated centre frequencies to hop through, empty to not scan.";
+	scanFreqsArg.units = "Hz";
+	scanFreqsArg.type = SoapySDR::ArgInfo::STRING;
+	streamArgs.push_back(scanFreqsArg);
+
+	SoapySDR::ArgInfo scanDwellArg;
+	scanDwellArg.key = "scan_dwell";
+	scanDwellArg.value = std::to_string(DEFAULT_SCAN_DWELL);
+	scanDwellArg.name = "Scan dwell";
+	scanDwellArg.description = "Samples returned per hop, as a time at the sample rate.";
+	scanDwellArg.units = "s";
+	scanDwellArg.type = SoapySDR::ArgInfo::FLOAT;
+	streamArgs.push_back(scanDwellArg);
+
+	SoapySDR::ArgInfo scanSettleArg;
+	scanSettleArg.key = "scan_settle";
+	scanSettleArg.value = std::to_string(DEFAULT_SCAN_SETTLE);
+	scanSettleArg.name = "Scan settle";
+	scanSettleArg.description = "Samples discarded after each retune while the receiver settles.";
+	scanSettleArg.units = "samples";
+	scanSettleArg.type = SoapySDR::ArgInfo::INT;
+	streamArgs.push_back(scanSettleArg);
+
 	return streamArgs;
 }
 
@@ -48,7 +132,238 @@ SoapySDR::ArgInfoList SoapyICR8600::getStreamArgsInfo(const int direction, const
  * Async thread work
  ******************************************************************/
 
-// Not implemented
+static PUCHAR _rx_callback(PUCHAR buf, ULONG len, PVOID ctx)
+{
+	SoapyICR8600 *self = (SoapyICR8600 *)ctx;
+	return self->rx_callback(buf, len);
+}
+
+void SoapyICR8600::rx_async_thread(void)
+{
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::rx_async_thread: start");
+	BOOL ok = transport->ReadIQAsync(&_rx_callback, this, (ULONG)numTransfers, (ULONG)bufferLength);
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::rx_async_thread: stop");
+
+	// wake up readStream, nothing more will arrive
+	std::lock_guard<std::mutex> lock(_buf_mutex);
+	if (!ok && _rx_running) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "SoapyICR8600::rx_async_thread: I/Q reads failed, stream ended");
+		_rx_abrupt = true;
+	}
+	_rx_running = false;
+	_buf_cond.notify_one();
+}
+
+// Sync words should come at a fixed interval; once the same distance was seen
+// a few times in a row, any other distance means samples went missing
+#define SYNC_CADENCE_LOCK 4
+
+bool SoapyICR8600::checkSyncCadence(const size_t slot)
+{
+	bool ok = true;
+	size_t count = _syncCount[slot];
+	if (count > SYNC_WORDS_PER_BUFFER) {
+		// positions were not all kept, start over on the next buffer
+		_lastSyncValid = false;
+		_rxElems += _buffElems[slot];
+		return true;
+	}
+
+	const size_t *syncPos = &_syncPos[slot * SYNC_WORDS_PER_BUFFER];
+	for (size_t i = 0; i < count; i++) {
+		unsigned long long elem = _rxElems + syncPos[i];
+		if (_lastSyncValid) {
+			size_t d = (size_t)(elem - _lastSyncElem);
+			if (_syncRepeats >= SYNC_CADENCE_LOCK && d != _syncInterval) {
+				ok = false;
+				_syncRepeats = 0;
+			}
+			else if (d == _syncInterval) {
+				if (++_syncRepeats == SYNC_CADENCE_LOCK) _syncCadence = d;
+			}
+			else {
+				_syncInterval = d;
+				_syncRepeats = 1;
+			}
+		}
+		_lastSyncElem = elem;
+		_lastSyncValid = true;
+	}
+	_rxElems += _buffElems[slot];
+	return ok;
+}
+
+// Start the rate setSampleRate left pending at the samples of this transfer
+void SoapyICR8600::applyPendingRate(void)
+{
+	StreamRate rate;
+	{
+		std::lock_guard<std::mutex> lock(_rate_mutex);
+		rate.tick = _rxTicks;
+		rate.timeNs = ticksToTimeNs(_rxRate, _rxTicks);
+		rate.hardwareRate = sampleRate;
+		rate.outputRate = _outputRate;
+		_rxRate = rate;
+		_ratePending = false;
+	}
+
+	// the transfers keep their size, activateStream sizes them for this rate
+	size_t length, buffers, transfers;
+	this->sizeStream(rate.hardwareRate, length, buffers, transfers);
+	if (length != bufferLength || buffers != numBuffers || transfers != numTransfers) {
+		SoapySDR_logf(SOAPY_SDR_WARNING, "SoapyICR8600: buffers sized for %u Hz are kept at %u Hz until the stream is activated again", (unsigned)_sizedRate, (unsigned)rate.hardwareRate);
+	}
+}
+
+PUCHAR SoapyICR8600::rx_callback(PUCHAR buf, ULONG len)
+{
+	if (buf != NULL && _ratePending) {
+		this->applyPendingRate();
+	}
+
+	const bool dropped = isDropBuffer(buf);
+	if (dropped) {
+		// the samples of this transfer are lost, the next buffer starts after a gap;
+		// they still count for the stream time
+		size_t numSync;
+		_rxTicks += removeSyncWords((uint32_t *)buf, len / 4, NULL, 0, &numSync);
+		_gapPending = true;
+		_droppedTransfers++;
+	}
+	else if (buf != NULL) {
+		// transfers complete in the order they were queued,
+		// so this is the oldest queued slot, right after the last ready one
+		size_t slot = (size_t)(buf - _buffPool) / _buffStride;
+		_buf_queued--;
+		if (len < bufferLength) _shortReads++;
+
+		// drop the sync words in place while the buffer is still in cache,
+		// their positions are kept for readStream
+		_buffElems[slot] = removeSyncWords((uint32_t *)buf, len / 4,
+			&_syncPos[slot * SYNC_WORDS_PER_BUFFER], SYNC_WORDS_PER_BUFFER, &_syncCount[slot]);
+		_trace.count(StreamTrace::SYNC_WORDS, _syncCount[slot]);
+		_buffTicks[slot] = _rxTicks;
+		_buffRate[slot] = _rxRate;
+		_rxTicks += _buffElems[slot];
+
+		// the scan thread waits for the end of the dwell to arrive
+		if (_rxTicks >= _scanWake) {
+			std::lock_guard<std::mutex> lock(_scan_mutex);
+			_scanWake = ULLONG_MAX;
+			_scan_cond.notify_one();
+		}
+
+		if (_gapPending) {
+			_lastSyncValid = false;
+		}
+		else if (!checkSyncCadence(slot)) {
+			_syncErrors++;
+			_gapPending = true;
+		}
+		_buffGap[slot] = _gapPending;
+		if (_gapPending) _overflows++;
+		_gapPending = false;
+
+		std::lock_guard<std::mutex> lock(_buf_mutex);
+		_buf_count++;
+		_buf_cond.notify_one();
+	}
+	if (buf != NULL) {
+		_trace.count(StreamTrace::TRANSFERS);
+		_trace.count(StreamTrace::BYTES, len);
+	}
+
+	if (!_rx_running) return NULL;
+
+	// queue the transfer again on the next free slot
+	if (_buf_queued + _buf_count < numBuffers) {
+		if (dropped) _dropFree.push_back(buf);
+		PUCHAR next = _buffPool + _buf_tail * _buffStride;
+		_buf_tail = (_buf_tail + 1) % numBuffers;
+		_buf_queued++;
+		return next;
+	}
+
+	// ring is full, readStream is not keeping up: this transfer is dropped, into
+	// a buffer no other transfer writes, so its sync words can be counted
+	_trace.count(StreamTrace::DROPPED_TRANSFERS);
+	if (dropped) return buf;
+	PUCHAR drop = _dropFree.back();
+	_dropFree.pop_back();
+	return drop;
+}
+
+/*******************************************************************
+ * Scan engine
+ ******************************************************************/
+
+// The radio does not say when a retune takes effect in the I/Q stream, so a hop
+// is only trusted from the reply to its frequency command on: samples received
+// up to then are from the previous frequency or in between. Samples of the
+// transfer being filled when the reply came were possibly sent before the retune,
+// so one transfer more is skipped before the settle samples.
+// The retune is sent as soon as the last sample of the dwell has arrived, while
+// readStream is still returning the dwell from the ring.
+
+void SoapyICR8600::scan_thread(void)
+{
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::scan_thread: start");
+	const unsigned long long dwell = std::max<unsigned long long>(1, (unsigned long long)(_scanDwellSec * sampleRate));
+	const unsigned long long skip = bufferLength / BYTES_PER_FRAME + _scanSettle;
+
+	unsigned long long seq = 0;
+	for (size_t i = 0; _rx_running; i = (i + 1) % _scanFreqs.size()) {
+		ULONG frequency = _scanFreqs[i];
+		BOOL ok;
+		{
+			std::lock_guard<std::mutex> lock(_device_mutex);
+			ok = tuneTo(frequency);
+		}
+		if (!ok) {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "SoapyICR8600::scan_thread: retune to %d failed, hop skipped", (int)frequency);
+			continue;
+		}
+
+		ScanHop hop;
+		hop.seq = ++seq;
+		hop.frequency = frequency;
+		hop.start = _rxTicks + skip;
+		hop.end = hop.start + dwell;
+
+		std::unique_lock<std::mutex> lock(_scan_mutex);
+		_scanHops.push_back(hop);
+		_scanWake = hop.end;
+		_scan_cond.wait(lock, [this, &hop] { return _rxTicks >= hop.end || !_rx_running; });
+	}
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::scan_thread: stop");
+}
+
+// Samples [tick, tick + elems) of the stream: returns how many to drop before the
+// next valid one, valid gets how many valid samples follow in the same hop
+size_t SoapyICR8600::scanClip(const unsigned long long tick, const size_t elems, size_t &valid, bool &hopStart)
+{
+	std::lock_guard<std::mutex> lock(_scan_mutex);
+	valid = 0;
+	hopStart = false;
+	while (!_scanHops.empty() && _scanHops.front().end <= tick) {
+		_scanHops.pop_front();
+	}
+	if (_scanHops.empty()) {
+		// next hop is not known yet, it can only start after these
+		return elems;
+	}
+
+	const ScanHop &hop = _scanHops.front();
+	size_t drop = (size_t)std::min<unsigned long long>(elems, hop.start > tick ? hop.start - tick : 0);
+	if (drop == elems) return drop;
+
+	// the first samples returned from a hop, also when its start was lost to an overflow
+	valid = (size_t)std::min<unsigned long long>(elems - drop, hop.end - (tick + drop));
+	hopStart = (hop.seq != _scanSeq);
+	_scanSeq = hop.seq;
+	_scanFrequency = hop.frequency;
+	return drop;
+}
 
 /*******************************************************************
  * Stream API
@@ -74,49 +389,294 @@ SoapySDR::Stream *SoapyICR8600::setupStream(const int direction, const std::stri
 	} else if (format == SOAPY_SDR_CF32)
 	{
 		 SoapySDR_log(SOAPY_SDR_INFO, "Using format CF32.");
+		 SoapySDR_logf(SOAPY_SDR_DEBUG, "CS16 to CF32 conversion: %s", iqKernelName());
 		 rxFormat = RX_FORMAT_FLOAT32;
 	} else {
 		throw std::runtime_error("setupStream invalid format '" + format + "' -- Only CS16 is supported by SoapyICR8600 module.");
 	}
 
-	bufferLength = DEFAULT_BUFFER_LENGTH;
+	_streamLatency = DEFAULT_LATENCY;
+	if (args.count("latency") != 0) {
+		try
+		{
+			double latency_in = std::stod(args.at("latency"));
+			if (latency_in > 0) {
+				_streamLatency = latency_in;
+			}
+		}
+		catch (const std::invalid_argument &) {}
+	}
+
+	// 0 or left out: sized from the hardware rate, see sizeStream
+	_bufferLengthArg = 0;
 	if (args.count("bufflen") != 0) {
 		try
 		{
 			int bufferLength_in = std::stoi(args.at("bufflen"));
 			if (bufferLength_in > 0) {
-				bufferLength = bufferLength_in;
+				_bufferLengthArg = bufferLength_in;
 			}
 		}
 		catch (const std::invalid_argument &) {}
 	}
-	SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::setupStream Using buffer length %d", bufferLength);
 
-	bufferData = (unsigned char*)malloc(2 * bufferLength * sizeof(unsigned char));
+	_numTransfersArg = 0;
+	if (args.count("transfers") != 0) {
+		try
+		{
+			int numTransfers_in = std::stoi(args.at("transfers"));
+			if (numTransfers_in > 0) {
+				_numTransfersArg = numTransfers_in;
+			}
+		}
+		catch (const std::invalid_argument &) {}
+	}
+
+	_numBuffersArg = 0;
+	if (args.count("buffers") != 0) {
+		try
+		{
+			int numBuffers_in = std::stoi(args.at("buffers"));
+			if (numBuffers_in > 0) {
+				_numBuffersArg = numBuffers_in;
+			}
+		}
+		catch (const std::invalid_argument &) {}
+	}
+
+	_hugePages = args.count("hugepages") != 0 && (args.at("hugepages") == "true" || args.at("hugepages") == "1");
+	_numaNode = -1;
+	if (args.count("numa_node") != 0) {
+		try
+		{
+			_numaNode = std::stoi(args.at("numa_node"));
+		}
+		catch (const std::invalid_argument &) {}
+	}
+
+	_scanFreqs.clear();
+	if (args.count("scan_freqs") != 0) {
+		std::stringstream list(args.at("scan_freqs"));
+		std::string item;
+		while (std::getline(list, item, ',')) {
+			if (item.empty()) continue;
+			try
+			{
+				_scanFreqs.push_back((ULONG)std::stod(item));
+			}
+			catch (const std::exception &) {
+				throw std::runtime_error("setupStream invalid scan frequency '" + item + "'");
+			}
+		}
+	}
+	_scanDwellSec = DEFAULT_SCAN_DWELL;
+	if (args.count("scan_dwell") != 0) {
+		try
+		{
+			double dwell_in = std::stod(args.at("scan_dwell"));
+			if (dwell_in > 0) {
+				_scanDwellSec = dwell_in;
+			}
+		}
+		catch (const std::invalid_argument &) {}
+	}
+	_scanSettle = DEFAULT_SCAN_SETTLE;
+	if (args.count("scan_settle") != 0) {
+		try
+		{
+			int settle_in = std::stoi(args.at("scan_settle"));
+			if (settle_in >= 0) {
+				_scanSettle = settle_in;
+			}
+		}
+		catch (const std::invalid_argument &) {}
+	}
+	if (!_scanFreqs.empty()) {
+		SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::setupStream Scanning %d frequencies, %g s dwell, %d settle samples", (int)_scanFreqs.size(), _scanDwellSec, (int)_scanSettle);
+	}
+
+	if (_buffPool != NULL) {
+		this->closeStream((SoapySDR::Stream *) this);
+	}
+	_sizedRate = sampleRate;
+	this->sizeStream(_sizedRate, bufferLength, numBuffers, numTransfers);
+	SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::setupStream Using buffer length %d", (int)bufferLength);
+	SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::setupStream Using %d buffers, %d USB transfers", (int)numBuffers, (int)numTransfers);
+	this->carveStream();
 
 	//Set parameters
 	//SoapySDR_logf(SOAPY_SDR_INFO, "ICR8600SetFrequency: %d", centerFrequency);
-	//ICR8600SetFrequency(deviceData.WinusbHandle, centerFrequency);
+	//ICR8600SetFrequency(transport.get(), centerFrequency);
 	//SoapySDR_logf(SOAPY_SDR_INFO, "ICR8600SetSampleRate: %d", sampleRate);
-	//ICR8600SetSampleRate(deviceData.WinusbHandle, sampleRate);
+	//ICR8600SetSampleRate(transport.get(), sampleRate);
 
 	return (SoapySDR::Stream *) this;
 }
 
+// Buffer sizes at this hardware rate, where no stream arg gives them: a transfer
+// holds _streamLatency seconds in whole USB packets, enough transfers are queued
+// for AUTO_QUEUE_TIME and the ring holds AUTO_RING_TIME
+void SoapyICR8600::sizeStream(const ULONG rate, size_t &length, size_t &buffers, size_t &transfers) const
+{
+	length = _bufferLengthArg;
+	if (length == 0) {
+		double bytes = std::ceil(_streamLatency * rate) * BYTES_PER_FRAME;
+		bytes = std::ceil(bytes / USB_PACKET_SIZE) * USB_PACKET_SIZE;
+		length = (size_t)std::min<double>(std::max<double>(bytes, DEFAULT_BUFFER_LENGTH), MAX_BUFFER_LENGTH);
+	}
+	const double bufferTime = (double)(length / BYTES_PER_FRAME) / rate;
+
+	transfers = _numTransfersArg;
+	if (transfers == 0) {
+		transfers = (size_t)std::ceil(AUTO_QUEUE_TIME / bufferTime);
+		transfers = std::min<size_t>(std::max<size_t>(transfers, DEFAULT_NUM_TRANSFERS), MAX_NUM_TRANSFERS);
+	}
+
+	buffers = _numBuffersArg;
+	if (buffers == 0) {
+		buffers = (size_t)std::ceil(AUTO_RING_TIME / bufferTime);
+		buffers = std::max<size_t>(std::max<size_t>(buffers, DEFAULT_NUM_BUFFERS), 2 * transfers);
+	}
+
+	// keep free slots in the ring while all transfers are queued
+	if (transfers >= buffers) {
+		transfers = std::max<size_t>(1, buffers / 2);
+	}
+}
+
+// Carve the RX ring, one page aligned slot per buffer, the drop buffers and the
+// scratch buffers from the arena, which the last stream may have left mapped
+void SoapyICR8600::carveStream(void)
+{
+	const size_t pageSize = BufferArena::pageSize();
+	const size_t dspBytes = bufferLength / sizeof(int16_t) * sizeof(float);
+	_buffStride = (bufferLength + pageSize - 1) / pageSize * pageSize;
+	_dropStride = (bufferLength + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+	if (!_arena.reserve(_buffStride * numBuffers + _dropStride * numTransfers + 2 * dspBytes + 3 * ARENA_ALIGN, _hugePages, _numaNode)) {
+		throw std::runtime_error("failed to allocate the RX buffers");
+	}
+	_buffPool = _arena.alloc(_buffStride * numBuffers, pageSize);
+	_dropPool = _arena.alloc(_dropStride * numTransfers, ARENA_ALIGN);
+	_dropFree.reserve(numTransfers);
+	_dspBuff = (float *)_arena.alloc(dspBytes, ARENA_ALIGN);
+	_resampleBuff = (float *)_arena.alloc(dspBytes, ARENA_ALIGN);
+	_buffElems.assign(numBuffers, 0);
+	_buffGap.assign(numBuffers, 0);
+	_buffTicks.assign(numBuffers, 0);
+	_buffRate.assign(numBuffers, _rxRate);
+	_syncPos.assign(numBuffers * SYNC_WORDS_PER_BUFFER, 0);
+	_syncCount.assign(numBuffers, 0);
+}
+
 void SoapyICR8600::closeStream(SoapySDR::Stream *stream) {
 	SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::closeStream");
 	this->deactivateStream(stream, 0, 0);
-	free(bufferData);
-	bufferData = NULL;
+	_arena.rewind();
+	_buffPool = NULL;
+	_dropPool = NULL;
+	_dropFree.clear();
+	_dspBuff = NULL;
+	_resampleBuff = NULL;
+	_buffElems.clear();
+	_buffGap.clear();
+	_buffTicks.clear();
+	_buffRate.clear();
+	_syncPos.clear();
+	_syncCount.clear();
 }
 
+// Samples a buffer yields once its sync words are removed, at the output rate
+// when resampling; readStream returns up to that many in one call. Until the
+// sync cadence was seen the sync words are not known.
 size_t SoapyICR8600::getStreamMTU(SoapySDR::Stream *stream) const {
-	return bufferLength / BYTES_PER_SAMPLE;
+	size_t frames = bufferLength / BYTES_PER_FRAME;
+	const size_t cadence = _syncCadence;
+	if (cadence > 0) {
+		frames -= frames / (cadence + 1);
+	}
+	const double outputRate = _outputRate;
+	if (outputRate < sampleRate) {
+		// readStream keeps two outputs of headroom for the resampler
+		return (size_t)std::ceil(frames * outputRate / sampleRate) + 2;
+	}
+	return frames;
 }
 
 int SoapyICR8600::activateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs, const size_t numElems) {
 	if (flags != 0) return SOAPY_SDR_NOT_SUPPORTED;
 
+	if (_rx_async_thread.joinable()) return 0;
+
+	// the rate changed since the buffers were sized, size and carve them again
+	const ULONG rate = sampleRate;
+	if (_buffPool != NULL && rate != _sizedRate) {
+		size_t length, buffers, transfers;
+		this->sizeStream(rate, length, buffers, transfers);
+		_sizedRate = rate;
+		if (length != bufferLength || buffers != numBuffers || transfers != numTransfers) {
+			SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::activateStream Using buffer length %d, %d buffers, %d USB transfers at %u Hz", (int)length, (int)buffers, (int)transfers, (unsigned)rate);
+			_arena.rewind();
+			bufferLength = length;
+			numBuffers = buffers;
+			numTransfers = transfers;
+			try
+			{
+				this->carveStream();
+			}
+			catch (const std::runtime_error &e) {
+				SoapySDR_logf(SOAPY_SDR_ERROR, "SoapyICR8600::activateStream: %s", e.what());
+				_buffPool = NULL;
+				_dropPool = NULL;
+			}
+		}
+	}
+	if (_buffPool == NULL) return SOAPY_SDR_ERROR;
+
+	// I/Q mode has to be on before the first transfer, if nothing was sent since opening
+	{
+		std::lock_guard<std::mutex> lock(_device_mutex);
+		if (!ICR8600CollectAcks(transport.get())) {
+			SoapySDR_logf(SOAPY_SDR_WARNING, "SoapyICR8600::activateStream: remote on was not acknowledged");
+		}
+	}
+
+	SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::activateStream: start RX thread");
+	_gapPending = false;
+	_rxElems = 0;
+	_lastSyncValid = false;
+	_syncRepeats = 0;
+	_rx_abrupt = false;
+
+	// stream time starts now, on the host clock, at the rate set last
+	long long now = this->getHardwareTime();
+	{
+		std::lock_guard<std::mutex> lock(_rate_mutex);
+		_rxRate.tick = 0;
+		_rxRate.timeNs = now;
+		_rxRate.hardwareRate = sampleRate;
+		_rxRate.outputRate = _outputRate;
+		_ratePending = false;
+	}
+	_rxTicks = 0;
+	_dropFree.clear();
+	for (size_t i = 0; i < numTransfers; i++) {
+		_dropFree.push_back(_dropPool + i * _dropStride);
+	}
+	_iqCorrector.reset();
+	_resampler.reset();
+	_resampleStart = 0;
+	_resampleTick = 0;
+	_agc.reset();
+
+	_rx_running = true;
+	_rx_async_thread = std::thread(&SoapyICR8600::rx_async_thread, this);
+
+	if (!_scanFreqs.empty()) {
+		_scanHops.clear();
+		_scanSeq = 0;
+		_scanWake = ULLONG_MAX;
+		_scan_thread = std::thread(&SoapyICR8600::scan_thread, this);
+	}
 
 	return 0;
 }
@@ -124,66 +684,221 @@ int SoapyICR8600::activateStream(SoapySDR::Stream *stream, const int flags, cons
 int SoapyICR8600::deactivateStream(SoapySDR::Stream *stream, const int flags, const long long timeNs) {
 	if (flags != 0) return SOAPY_SDR_NOT_SUPPORTED;
 
+	if (_rx_async_thread.joinable()) {
+		SoapySDR_logf(SOAPY_SDR_DEBUG, "SoapyICR8600::deactivateStream: stop RX thread");
+		_rx_running = false;
+		transport->CancelIQAsync();
+		_rx_async_thread.join();
+	}
+	if (_scan_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(_scan_mutex);
+			_scan_cond.notify_one();
+		}
+		_scan_thread.join();
+	}
+
+	// drop whatever is left in the ring
+	std::lock_guard<std::mutex> lock(_buf_mutex);
+	_buf_head = 0;
+	_buf_tail = 0;
+	_buf_queued = 0;
+	_buf_acquired = 0;
+	_buf_count = 0;
+	bufferedElems = 0;
+	std::fill(_buffGap.begin(), _buffGap.end(), 0);
+
 	return 0;
 }
 
 int SoapyICR8600::readStream(SoapySDR::Stream *stream, void * const *buffs, const size_t numElems, int &flags, long long &timeNs, const long timeoutUs) {
-	std::unique_lock<std::mutex> lock(_buf_mutex);
-	
-	SoapySDR_logf(SOAPY_SDR_TRACE, "SoapyICR8600::readStream: %d, flags: %d", numElems, flags);
+	_trace.count(StreamTrace::READS);
+	_readSyncCount = 0;
+
+	const bool scanning = !_scanFreqs.empty();
+	size_t scanValid = 0;
+	bool hopStart = false;
+	std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::microseconds(timeoutUs);
+
+	for (;;) {
+		// are elements left in the buffer? if not, do a new read.
+		if (bufferedElems == 0) {
+			long remainingUs = (long)std::chrono::duration_cast<std::chrono::microseconds>(deadline - std::chrono::steady_clock::now()).count();
+			int ret = this->acquireReadBuffer(stream, _currentHandle, (const void **)&_currentBuff, flags, timeNs, std::max<long>(0, remainingUs));
+			if (ret < 0) return ret;
+			bufferedElems = ret;
+			_currentElem = 0;
+			_currentSync = 0;
+			if (bufferedElems == 0) {
+				this->releaseReadBuffer(stream, _currentHandle);
+				return 0;
+			}
+		}
+		if (!scanning) break;
+
+		// scan mode: skip what falls outside the valid window of a hop
+		size_t drop = scanClip(_buffTicks[_currentHandle] + _currentElem, bufferedElems, scanValid, hopStart);
+		bufferedElems -= drop;
+		_currentElem += drop;
+		_currentBuff += drop * 2 * sizeof(int16_t);
+		if (bufferedElems > 0) break;
+		this->releaseReadBuffer(stream, _currentHandle);
+	}
+
+	// the resampler is set up here, in the only thread that runs it, for the
+	// rate this buffer came at
+	const StreamRate &rate = _buffRate[_currentHandle];
+	if (_resampler.inputRate() != rate.hardwareRate || _resampler.outputRate() != rate.outputRate) {
+		_resampler.configure(rate.hardwareRate, rate.outputRate);
+		_resampleTick = ULLONG_MAX;
+	}
+	const bool resample = _resampler.enabled();
+
+	// when resampling, returnedElems counts input samples, few enough for numElems outputs
+	size_t returnedElems = std::min(bufferedElems, numElems);
+	if (resample) {
+		double ratio = _resampler.inputRate() / _resampler.outputRate();
+		returnedElems = std::min(bufferedElems, numElems > 2 ? (size_t)((numElems - 2) * ratio) : 1);
+	}
+	if (scanning) returnedElems = std::min(returnedElems, scanValid);
+
+	// samples run on across removed sync words, so one call can return a whole
+	// buffer; where they were is flagged and kept for the sync_offsets setting
+	flags = SOAPY_SDR_HAS_TIME;
+	if (hopStart) flags |= ICR8600_FLAG_SCAN_HOP;
+	timeNs = ticksToTimeNs(rate, _buffTicks[_currentHandle] + _currentElem);
+	const size_t *syncPos = &_syncPos[_currentHandle * SYNC_WORDS_PER_BUFFER];
+	size_t syncCount = std::min<size_t>(_syncCount[_currentHandle], SYNC_WORDS_PER_BUFFER);
+	while (_currentSync < syncCount && syncPos[_currentSync] < _currentElem) {
+		// dropped along with the samples around it
+		_currentSync++;
+	}
+	while (_currentSync < syncCount && syncPos[_currentSync] < _currentElem + returnedElems) {
+		_readSync[_readSyncCount++] = syncPos[_currentSync] - _currentElem;
+		_currentSync++;
+	}
+	if (_readSyncCount > 0) flags |= ICR8600_FLAG_SYNC_WORD;
 
-	ULONG cbRead = ICR8600ReadPipe(deviceData.WinusbHandle, bufferData, bufferLength);
-	int16_t *source = (int16_t *)bufferData;
-	UCHAR *s0 = (UCHAR*)bufferData;
+	const int16_t *source = (const int16_t *)_currentBuff;
 
 	// The user's buffer for channel 0
 	void *buff0 = buffs[0];
-	int returnedElems = 0;
-	if (rxFormat == RX_FORMAT_INT16) {
-		int16_t *itarget = (int16_t *)buff0;
-		for (ULONG p = 0; p < cbRead/4; p++) {
-			UCHAR c1 = s0[4 * p], c2 = s0[4*p + 1], c3 = s0[4 * p + 2], c4 = s0[4 * p + 3];
-			if (c1 != 0x00 || c2 != 0x80 || c3 != 0x00 || c4 != 0x80) {
-				itarget[returnedElems++] = source[2*p];
-				itarget[returnedElems++] = source[2*p + 1];
-			}
-			else {
-				printf("%Xh", source[p]);
-			}
+	const bool correct = _iqCorrector.enabled();
+	size_t outElems = returnedElems;
+	if (!correct && !_nco.enabled() && !resample && !_agc.enabled()) {
+		if (rxFormat == RX_FORMAT_INT16) {
+			std::memcpy(buff0, source, returnedElems * 2 * sizeof(int16_t));
+		}
+		if (rxFormat == RX_FORMAT_FLOAT32) {
+			convertCS16ToCF32(source, (float *)buff0, returnedElems);
 		}
 	}
-	if (rxFormat == RX_FORMAT_FLOAT32) {
-		float *ftarget = (float *)buff0;
-		for (ULONG p = 0; p < cbRead / 4; p++) {
-			UCHAR c1 = s0[4 * p], c2 = s0[4 * p + 1], c3 = s0[4 * p + 2], c4 = s0[4 * p + 3];
-			if (c1 != 0x00 || c2 != 0x80 || c3 != 0x00 || c4 != 0x80) {
-				ftarget[returnedElems++] = (float)(source[2*p]) / 32768;
-				ftarget[returnedElems++] = (float)(source[2*p + 1]) / 32768;
+	else {
+		float *iq = (rxFormat == RX_FORMAT_FLOAT32 && !resample) ? (float *)buff0 : _dspBuff;
+		if (correct) _iqCorrector.process(source, iq, returnedElems, rate.hardwareRate);
+		else convertCS16ToCF32(source, iq, returnedElems);
+		if (_nco.enabled()) _nco.process(iq, returnedElems, _buffTicks[_currentHandle] + _currentElem, rate.hardwareRate);
+		if (resample) {
+			// start over after a gap or a hop, the time is the one of the input the output is centered on
+			unsigned long long tick = _buffTicks[_currentHandle] + _currentElem;
+			if (tick != _resampleTick || hopStart) {
+				_resampler.reset();
+				_resampleStart = tick;
+			}
+			_resampleTick = tick + returnedElems;
+			timeNs = ticksToTimeNs(rate, _resampleStart) + (long long)std::llround(_resampler.nextPosition() * 1e9 / rate.hardwareRate);
+			float *out = (rxFormat == RX_FORMAT_FLOAT32) ? (float *)buff0 : _resampleBuff;
+			outElems = _resampler.process(iq, returnedElems, out);
+			iq = out;
+			// nearest output sample to each sync word
+			for (size_t i = 0; i < _readSyncCount; i++) {
+				size_t offset = (size_t)std::llround(_readSync[i] * rate.outputRate / rate.hardwareRate);
+				_readSync[i] = std::min(offset, outElems > 0 ? outElems - 1 : 0);
 			}
 		}
+		if (_agc.enabled()) _agc.process(iq, outElems, rate.outputRate);
+		if (rxFormat == RX_FORMAT_INT16) {
+			convertCF32ToCS16(iq, (int16_t *)buff0, outElems);
+		}
 	}
 
-	return returnedElems/2;
+	_trace.count(StreamTrace::SAMPLES, outElems);
+
+	// bump variables for next call into readStream
+	bufferedElems -= returnedElems;
+	_currentElem += returnedElems;
+	_currentBuff += returnedElems * 2 * sizeof(int16_t);
+
+	// return the buffer to the RX ring once it is consumed
+	if (bufferedElems == 0) this->releaseReadBuffer(stream, _currentHandle);
+
+	return (int)outElems;
 }
 
 /*******************************************************************
  * Direct buffer access API
  ******************************************************************/
 
+// Direct access buffers hold native CS16 samples regardless of the stream format,
+// ICR8600_FLAG_SYNC_WORD is set when sync words were dropped from the buffer
+
 size_t SoapyICR8600::getNumDirectAccessBuffers(SoapySDR::Stream *stream) {
-	return 0; // _buffs.size();
+	return numBuffers;
 }
 
 int SoapyICR8600::getDirectAccessBufferAddrs(SoapySDR::Stream *stream, const size_t handle, void **buffs) {
-	//buffs[0] = (void *)bufferData;// _buffs[handle].data();
+	if (_buffPool == NULL || handle >= numBuffers) return SOAPY_SDR_NOT_SUPPORTED;
+	buffs[0] = (void *)(_buffPool + handle * _buffStride);
 	return 0;
 }
 
 int SoapyICR8600::acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle, const void **buffs, int &flags, long long &timeNs, const long timeoutUs) {
-	SoapySDR_logf(SOAPY_SDR_INFO, "SoapyICR8600::acquireReadBuffer, flags: %d", flags);
+	{
+		std::unique_lock<std::mutex> lock(_buf_mutex);
+		if (!_buf_cond.wait_for(lock, std::chrono::microseconds(timeoutUs), [this] { return _buf_count > _buf_acquired || !_rx_running; })) {
+			return SOAPY_SDR_TIMEOUT;
+		}
+		if (_buf_count == _buf_acquired) {
+			// RX thread is gone and the ring is drained
+			flags = _rx_abrupt ? SOAPY_SDR_END_ABRUPT : 0;
+			return SOAPY_SDR_STREAM_ERROR;
+		}
+
+		handle = _buf_head;
+
+		// samples were lost before this buffer: report it once, the buffer comes next
+		if (_buffGap[handle]) {
+			_buffGap[handle] = 0;
+			flags = 0;
+			SoapySDR_log(SOAPY_SDR_SSI, "O");
+			return SOAPY_SDR_OVERFLOW;
+		}
+
+		_buf_head = (_buf_head + 1) % numBuffers;
+		_buf_acquired++;
+	}
+
+	// the caller sees plain CS16, the RX thread already dropped the sync words
+	buffs[0] = (void *)(_buffPool + handle * _buffStride);
+	flags = (_syncCount[handle] > 0) ? ICR8600_FLAG_SYNC_WORD : 0;
+	flags |= SOAPY_SDR_HAS_TIME;
+	timeNs = ticksToTimeNs(_buffRate[handle], _buffTicks[handle]);
+
+	_trace.poll();
 
-	return 0; 
+	return (int)_buffElems[handle];
 }
 
+// Buffers must be released in the order they were acquired
 void SoapyICR8600::releaseReadBuffer(SoapySDR::Stream *stream, const size_t handle) {
+	std::lock_guard<std::mutex> lock(_buf_mutex);
+
+	// anything else would hand a slot the caller still holds back to the RX thread
+	const size_t oldest = (_buf_head + numBuffers - _buf_acquired) % numBuffers;
+	if (_buf_acquired == 0 || handle != oldest) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "SoapyICR8600::releaseReadBuffer: handle %d is not the oldest acquired buffer, ignored", (int)handle);
+		return;
+	}
+	_buf_acquired--;
+	_buf_count--;
 }
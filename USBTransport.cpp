@@ -0,0 +1,61 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "ICR8600Transport.h"
+
+USBTransport::USBTransport(void)
+{
+	deviceData.HandlesOpen = FALSE;
+}
+
+USBTransport::~USBTransport(void)
+{
+	CloseDevice(&deviceData);
+}
+
+HRESULT USBTransport::Open(PBOOL FailureDeviceNotFound, const char *Serial, const char *Path)
+{
+	return OpenDevice(&deviceData, FailureDeviceNotFound, Serial, Path);
+}
+
+BOOL USBTransport::GetDescriptor(USB_DEVICE_DESCRIPTOR *Desc)
+{
+	return GetDeviceDescriptor(deviceData.WinusbHandle, Desc);
+}
+
+BOOL USBTransport::WriteControl(PUCHAR Buffer, ULONG Length, PULONG Written)
+{
+	return WriteToBulkEndpoint(deviceData.WinusbHandle, PIPE_CONTROL_ID, Written, Buffer, Length);
+}
+
+ULONG USBTransport::ReadResponse(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs)
+{
+	return ReadBufferFromBulkEndpoint(deviceData.WinusbHandle, PIPE_RESPONSE_ID, Buffer, Length, TimeoutMs);
+}
+
+ULONG USBTransport::ReadIQ(PUCHAR Buffer, ULONG Length, ULONG TimeoutMs)
+{
+	return ICR8600ReadPipe(deviceData.WinusbHandle, Buffer, Length, TimeoutMs);
+}
+
+BOOL USBTransport::ReadIQAsync(ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength)
+{
+	return ICR8600ReadPipeAsync(deviceData.WinusbHandle, Callback, Context, NumTransfers, TransferLength);
+}
+
+VOID USBTransport::CancelIQAsync(void)
+{
+	ICR8600CancelReadPipeAsync(deviceData.WinusbHandle);
+}
@@ -13,6 +13,10 @@
  */
 
 #include "WinUSBDevice.h"
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 
@@ -21,6 +25,11 @@
 
 #else
 
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
 void Sleep(int milliseconds)
 {
     struct timespec ts;
@@ -31,168 +40,229 @@ void Sleep(int milliseconds)
 
 #endif
 
-#define decToBcd(val) (UCHAR)((((val) / 10 * 16) + ((val) % 10)))
-#define bcdToDec(val) (ULONG)((val>>4)*10 + (val & 0x0f))
-
-HRESULT RetrieveDevicePath(_Out_bytecap_(BufLen) LPTSTR DevicePath, _In_ ULONG  BufLen, _Out_opt_ PBOOL  FailureDeviceNotFound);
+//
+// Radios found on the bus last, reused for ICR8600_ENUM_CACHE_MS or, where libusb
+// has hotplug support, until a radio arrives or leaves. Never freed: radios may
+// still be closed from static destructors.
+//
+#ifndef _WIN32
+//
+// The enumeration runs on a process-wide libusb context. The libusb_device of
+// every radio found is kept referenced in Refs, so a radio is opened from it
+// without walking the bus again. Where libusb can, an open radio gets a context
+// of its own, so its transfers are not handled under another radio's event lock.
+//
+struct ENUM_CACHE
+{
+	std::mutex Mutex;
+	libusb_context *Context;
+	BOOL Hotplug;
+	libusb_hotplug_callback_handle HotplugHandle;
+	std::atomic<bool> Stale;
+	std::chrono::steady_clock::time_point Time;
+	std::vector<ICR8600_DEVICE_INFO> Devices;
+	std::vector<libusb_device *> Refs;
+};
+
+static ENUM_CACHE *GetEnumCache(void)
+{
+	static ENUM_CACHE *cache = new ENUM_CACHE();
+	return cache;
+}
 
-BOOL FindICR8600Device()
+static int LIBUSB_CALL HotplugCallback(libusb_context *context, libusb_device *device, libusb_hotplug_event event, void *user_data)
 {
-	SoapySDR_logf(SOAPY_SDR_TRACE, "FindICR8600Device");
+	GetEnumCache()->Stale = true;
+	return 0;
+}
 
-#ifdef _WIN32
-	DEVICE_DATA deviceData;
-	BOOL notFound = false;
-	HRESULT hr = RetrieveDevicePath(deviceData.DevicePath, sizeof(deviceData.DevicePath), &notFound);
-	if (FAILED(hr) || notFound) {
-		return FALSE;
+//
+// Called with the cache locked
+//
+static libusb_context *GetEnumContext(ENUM_CACHE *cache)
+{
+	if (cache->Context != NULL) {
+		return cache->Context;
 	}
-	return TRUE;
-#else
-	int r = libusb_init(NULL);
-	if (r < 0)
-	    return FALSE;
-
-	BOOL res = FALSE;
-
-    libusb_device **devs;
-	ssize_t cnt = libusb_get_device_list(NULL, &devs);
-    for (int i = 0; i < cnt; i++) {
-        libusb_device *device = devs[i];
-
-        struct libusb_device_descriptor desc;
-		int r = libusb_get_device_descriptor(device, &desc);
-        if (r < 0) continue;
-
-        printf("Device %04x:%04x, Manufacturer: %d\n", desc.idVendor, desc.idProduct, desc.iManufacturer);
-
-//        libusb_device_handle *handle;
-//        int err = libusb_open(device, &handle);
-//        if (err) {
-//            printf("  Error: cannot open device\n");
-//            continue;
-//        }
-//        // Get description
-//        const int STRING_LENGTH = 255;
-//        unsigned char stringDescription[STRING_LENGTH];
-//        if (desc.iManufacturer > 0) {
-//            r = libusb_get_string_descriptor_ascii(handle, desc.iManufacturer, stringDescription, STRING_LENGTH);
-//            if (r >= 0)
-//                printf("Manufacturer = %s\n",  stringDescription);
-//        }
-//        if (desc.iProduct > 0) {
-//            r = libusb_get_string_descriptor_ascii(handle, desc.iProduct, stringDescription, STRING_LENGTH);
-//            if ( r >= 0 )
-//                printf("Product = %s\n", stringDescription);
-//        }
-//        if (desc.iSerialNumber > 0) {
-//            r = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, stringDescription, STRING_LENGTH);
-//            if (r >= 0)
-//                printf("SerialNumber = %s\n", stringDescription);
-//        }
-//        printf("\n");
-//        libusb_close(handle);
-    }
 
-	libusb_free_device_list(devs, 1);
-	libusb_exit(NULL);
-    return res;
-#endif
+	int r = libusb_init(&cache->Context);
+	if (r < 0) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "libusb_init failed: %s", libusb_error_name(r));
+		cache->Context = NULL;
+		return NULL;
+	}
+	cache->Stale = true;
+	cache->Hotplug = FALSE;
+	if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+		r = libusb_hotplug_register_callback(cache->Context,
+			(libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED | LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+			(libusb_hotplug_flag)0, ICR8600_VID, ICR8600_PID, LIBUSB_HOTPLUG_MATCH_ANY,
+			&HotplugCallback, NULL, &cache->HotplugHandle);
+		cache->Hotplug = (r == LIBUSB_SUCCESS);
+	}
+	return cache->Context;
 }
 
-HRESULT OpenDevice(_Out_ PDEVICE_DATA DeviceData, _Out_opt_ PBOOL FailureDeviceNotFound)
+//
+// Bus and port chain, as in sysfs: 1-2.3
+//
+static std::string LibusbPath(libusb_device *device)
 {
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "OpenDevice");
-    HRESULT hr = S_OK;
-    BOOL    bResult;
-
-    DeviceData->HandlesOpen = FALSE;
+	uint8_t ports[8];
+	int count = libusb_get_port_numbers(device, ports, sizeof(ports));
+	std::string path = std::to_string(libusb_get_bus_number(device));
+	for (int i = 0; i < count; i++) {
+		path += (i == 0 ? "-" : ".") + std::to_string(ports[i]);
+	}
+	return path;
+}
 
-    hr = RetrieveDevicePath(DeviceData->DevicePath, sizeof(DeviceData->DevicePath), FailureDeviceNotFound);
-    if (FAILED(hr)) {
-        return hr;
-    }
+//
+// Serial number string descriptor, empty if the radio has none
+//
+static std::string LibusbSerial(libusb_device_handle *handle)
+{
+	struct libusb_device_descriptor desc;
+	unsigned char serial[256];
+	if (libusb_get_device_descriptor(libusb_get_device(handle), &desc) < 0 || desc.iSerialNumber == 0) {
+		return "";
+	}
+	int len = libusb_get_string_descriptor_ascii(handle, desc.iSerialNumber, serial, sizeof(serial));
+	return (len > 0) ? std::string((const char *)serial, len) : "";
+}
 
-    DeviceData->DeviceHandle = CreateFile(DeviceData->DevicePath,
-                                          GENERIC_WRITE | GENERIC_READ,
-                                          FILE_SHARE_WRITE | FILE_SHARE_READ,
-                                          NULL,
-                                          OPEN_EXISTING,
-                                          FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
-                                          NULL);
+static HRESULT EnumerateDevices(std::vector<ICR8600_DEVICE_INFO> &Devices, BOOL Refresh)
+{
+	ENUM_CACHE *cache = GetEnumCache();
+	std::lock_guard<std::mutex> lock(cache->Mutex);
+	libusb_context *context = GetEnumContext(cache);
+	if (context == NULL) {
+		return E_FAIL;
+	}
 
-    if (INVALID_HANDLE_VALUE == DeviceData->DeviceHandle) {
-        hr = HRESULT_FROM_WIN32(GetLastError());
-        return hr;
-    }
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (cache->Hotplug) {
+		// deliver pending hotplug events without waiting
+		struct timeval tv = { 0, 0 };
+		libusb_handle_events_timeout_completed(context, &tv, NULL);
+	}
+	else if (now - cache->Time > std::chrono::milliseconds(ICR8600_ENUM_CACHE_MS)) {
+		cache->Stale = true;
+	}
 
-    bResult = WinUsb_Initialize(DeviceData->DeviceHandle, &DeviceData->WinusbHandle);
-    if (FALSE == bResult) {
+	if (Refresh || cache->Stale) {
+		// cleared first, so an event arriving during the walk is not lost
+		cache->Stale = false;
+		cache->Time = now;
+		cache->Devices.clear();
+		for (size_t i = 0; i < cache->Refs.size(); i++) {
+			libusb_unref_device(cache->Refs[i]);
+		}
+		cache->Refs.clear();
+
+		libusb_device **devs;
+		ssize_t cnt = libusb_get_device_list(context, &devs);
+		for (ssize_t i = 0; i < cnt; i++) {
+			struct libusb_device_descriptor desc;
+			if (libusb_get_device_descriptor(devs[i], &desc) < 0) continue;
+			if (desc.idVendor != ICR8600_VID || desc.idProduct != ICR8600_PID) continue;
+
+			// the serial is read over the control endpoint, the interface may be claimed
+			ICR8600_DEVICE_INFO info;
+			info.Path = LibusbPath(devs[i]);
+			libusb_device_handle *handle = NULL;
+			if (libusb_open(devs[i], &handle) == 0) {
+				info.Serial = LibusbSerial(handle);
+				libusb_close(handle);
+			}
+			cache->Devices.push_back(info);
+			cache->Refs.push_back(libusb_ref_device(devs[i]));
+		}
+		if (cnt >= 0) {
+			libusb_free_device_list(devs, 1);
+		}
+	}
 
-        hr = HRESULT_FROM_WIN32(GetLastError());
-        CloseHandle(DeviceData->DeviceHandle);
-        return hr;
-    }
+	Devices = cache->Devices;
+	return S_OK;
+}
 
-    DeviceData->HandlesOpen = TRUE;
-    return hr;
-#else
-    SoapySDR_logf(SOAPY_SDR_FATAL, "OpenDevice: Only WIN32 Supported");
-    return 0;
-#endif
+//
+// The radio at Path as the last walk of the bus found it, referenced, and the
+// enumeration context; NULL when it was not seen
+//
+static libusb_device *CachedDevice(const std::string &Path, libusb_context **Context)
+{
+	ENUM_CACHE *cache = GetEnumCache();
+	std::lock_guard<std::mutex> lock(cache->Mutex);
+	*Context = cache->Context;
+	for (size_t i = 0; i < cache->Devices.size(); i++) {
+		if (cache->Devices[i].Path == Path) {
+			return libusb_ref_device(cache->Refs[i]);
+		}
+	}
+	return NULL;
 }
 
-BOOL GetDeviceDescriptor(WINUSB_INTERFACE_HANDLE hDeviceHandle, _Out_ USB_DEVICE_DESCRIPTOR *pDeviceDesc)
+//
+// Closes what OpenDevicePath got of the radio so far, the interface is released by the caller
+//
+static VOID FreeUSBDevice(ICR8600_USB_DEVICE *Device)
 {
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "GetDeviceDescriptor");
-    ULONG lengthReceived;
-	BOOL bResult = WinUsb_GetDescriptor(hDeviceHandle, USB_DEVICE_DESCRIPTOR_TYPE, 0, 0, (PBYTE)pDeviceDesc, sizeof(USB_DEVICE_DESCRIPTOR), &lengthReceived);
-	if (FALSE == bResult || lengthReceived != sizeof(USB_DEVICE_DESCRIPTOR)) {
-		SoapySDR_logf(SOAPY_SDR_ERROR, "GetDeviceDescriptor: Error among LastError %d or lengthReceived %d", FALSE == bResult ? GetLastError() : 0, lengthReceived);
-		return FALSE;
+	if (Device->Handle != NULL) {
+		libusb_close(Device->Handle);
 	}
-	return TRUE;
-#else
-	SoapySDR_logf(SOAPY_SDR_FATAL, "GetDeviceDescriptor: Only WIN32 Supported");
-    return FALSE;
-#endif
+	if (Device->Fd >= 0) {
+		close(Device->Fd);
+	}
+	if (Device->OwnContext) {
+		libusb_exit(Device->Context);
+	}
+	delete Device;
 }
+#else
+struct ENUM_CACHE
+{
+	std::mutex Mutex;
+	BOOL Valid;
+	std::chrono::steady_clock::time_point Time;
+	std::vector<ICR8600_DEVICE_INFO> Devices;
+};
 
-VOID CloseDevice(_Inout_ PDEVICE_DATA DeviceData)
+static ENUM_CACHE *GetEnumCache(void)
 {
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "CloseDevice");
-    if (FALSE == DeviceData->HandlesOpen) {
-        //
-        // Called on an uninitialized DeviceData
-        //
-        return;
-    }
+	static ENUM_CACHE *cache = new ENUM_CACHE();
+	return cache;
+}
 
-    WinUsb_Free(DeviceData->WinusbHandle);
-    CloseHandle(DeviceData->DeviceHandle);
-    DeviceData->HandlesOpen = FALSE;
-	DeviceData->DeviceHandle = INVALID_HANDLE_VALUE;
-#else
-	SoapySDR_logf(SOAPY_SDR_FATAL, "CloseDevice: Only WIN32 Supported");
-    return;
-#endif
+//
+// The device instance part of an interface path, \\?\usb#vid_0c26&pid_0022#<serial>#{guid},
+// is the serial number unless Windows made one up, which contains '&'
+//
+static std::string SerialFromPath(const std::string &Path)
+{
+	size_t begin = Path.find('#');
+	begin = (begin == std::string::npos) ? begin : Path.find('#', begin + 1);
+	if (begin == std::string::npos) {
+		return "";
+	}
+	size_t end = Path.find('#', begin + 1);
+	std::string serial = Path.substr(begin + 1, (end == std::string::npos) ? std::string::npos : end - begin - 1);
+	return (serial.find('&') == std::string::npos) ? serial : "";
 }
 
-HRESULT RetrieveDevicePath(_Out_bytecap_(BufLen) LPTSTR DevicePath, _In_ ULONG  BufLen, _Out_opt_ PBOOL  FailureDeviceNotFound)
+//
+// Interface paths of all IC-R8600s present, walked with CM_Get_Device_Interface_List
+//
+static HRESULT ListDevices(std::vector<ICR8600_DEVICE_INFO> &Devices)
 {
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "RetrieveDevicePath");
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ListDevices");
     CONFIGRET cr = CR_SUCCESS;
     HRESULT   hr = S_OK;
-    PTSTR     DeviceInterfaceList = NULL;
+    PSTR      DeviceInterfaceList = NULL;
     ULONG     DeviceInterfaceListLength = 0;
 
-    if (NULL != FailureDeviceNotFound) {
-        *FailureDeviceNotFound = FALSE;
-    }
+    Devices.clear();
 
     //
     // Enumerate all devices exposing the interface. Do this in a loop
@@ -200,30 +270,30 @@ HRESULT RetrieveDevicePath(_Out_bytecap_(BufLen) LPTSTR DevicePath, _In_ ULONG
     // causing CM_Get_Device_Interface_List to return CR_BUFFER_SMALL.
     //
     do {
-        cr = CM_Get_Device_Interface_List_Size(&DeviceInterfaceListLength,
-                                               (LPGUID)&GUID_DEVINTERFACE_WinUSB1,
-                                               NULL,
-                                               CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+        cr = CM_Get_Device_Interface_List_SizeA(&DeviceInterfaceListLength,
+                                                (LPGUID)&GUID_DEVINTERFACE_WinUSB1,
+                                                NULL,
+                                                CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
 
         if (cr != CR_SUCCESS) {
             hr = HRESULT_FROM_WIN32(CM_MapCrToWin32Err(cr, ERROR_INVALID_DATA));
             break;
         }
 
-        DeviceInterfaceList = (PTSTR)HeapAlloc(GetProcessHeap(),
-                                               HEAP_ZERO_MEMORY,
-                                               DeviceInterfaceListLength * sizeof(TCHAR));
+        DeviceInterfaceList = (PSTR)HeapAlloc(GetProcessHeap(),
+                                              HEAP_ZERO_MEMORY,
+                                              DeviceInterfaceListLength * sizeof(CHAR));
 
         if (DeviceInterfaceList == NULL) {
             hr = E_OUTOFMEMORY;
             break;
         }
 
-        cr = CM_Get_Device_Interface_List((LPGUID)&GUID_DEVINTERFACE_WinUSB1,
-                                          NULL,
-                                          DeviceInterfaceList,
-                                          DeviceInterfaceListLength,
-                                          CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
+        cr = CM_Get_Device_Interface_ListA((LPGUID)&GUID_DEVINTERFACE_WinUSB1,
+                                           NULL,
+                                           DeviceInterfaceList,
+                                           DeviceInterfaceListLength,
+                                           CM_GET_DEVICE_INTERFACE_LIST_PRESENT);
 
         if (cr != CR_SUCCESS) {
             HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
@@ -239,35 +309,316 @@ HRESULT RetrieveDevicePath(_Out_bytecap_(BufLen) LPTSTR DevicePath, _In_ ULONG
     }
 
     //
-    // If the interface list is empty, no devices were found.
+    // The list holds NULL-terminated paths and ends with an empty one.
     //
-    if (*DeviceInterfaceList == TEXT('\0')) {
-        if (NULL != FailureDeviceNotFound) {
-            *FailureDeviceNotFound = TRUE;
-        }
+    for (PSTR path = DeviceInterfaceList; *path != '\0'; path += strlen(path) + 1) {
+        ICR8600_DEVICE_INFO info;
+        info.Path = path;
+        info.Serial = SerialFromPath(info.Path);
+        Devices.push_back(info);
+    }
+
+    HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
+    return hr;
+}
+
+static HRESULT EnumerateDevices(std::vector<ICR8600_DEVICE_INFO> &Devices, BOOL Refresh)
+{
+	ENUM_CACHE *cache = GetEnumCache();
+	std::lock_guard<std::mutex> lock(cache->Mutex);
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (Refresh || !cache->Valid || now - cache->Time > std::chrono::milliseconds(ICR8600_ENUM_CACHE_MS)) {
+		HRESULT hr = ListDevices(cache->Devices);
+		cache->Valid = SUCCEEDED(hr);
+		cache->Time = now;
+		if (FAILED(hr)) {
+			return hr;
+		}
+	}
+	Devices = cache->Devices;
+	return S_OK;
+}
+#endif
 
-        hr = HRESULT_FROM_WIN32(ERROR_NOT_FOUND);
-        HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
+#ifdef _WIN32
+static BOOL SubmitReadPipe(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR PipeID, PUCHAR Buffer, ULONG BufferLength, LPOVERLAPPED pOverlapped)
+{
+	ResetEvent(pOverlapped->hEvent);
+	if (WinUsb_ReadPipe(hDeviceHandle, PipeID, Buffer, BufferLength, NULL, pOverlapped)) {
+		return TRUE;
+	}
+	return GetLastError() == ERROR_IO_PENDING;
+}
+
+//
+// Overlapped read that is aborted at the deadline, whatever arrived is returned
+//
+static BOOL ReadPipeTimed(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR PipeID, PUCHAR Buffer, ULONG BufferLength, ULONG TimeoutMs, PULONG pcbRead)
+{
+	*pcbRead = 0;
+	OVERLAPPED overlapped = { 0 };
+	overlapped.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!SubmitReadPipe(hDeviceHandle, PipeID, Buffer, BufferLength, &overlapped)) {
+		CloseHandle(overlapped.hEvent);
+		return FALSE;
+	}
+
+	if (WaitForSingleObject(overlapped.hEvent, TimeoutMs ? TimeoutMs : INFINITE) == WAIT_TIMEOUT) {
+		WinUsb_AbortPipe(hDeviceHandle, PipeID);
+	}
+	BOOL bResult = WinUsb_GetOverlappedResult(hDeviceHandle, &overlapped, pcbRead, TRUE);
+	CloseHandle(overlapped.hEvent);
+	return bResult || GetLastError() == ERROR_OPERATION_ABORTED;
+}
+#endif
+
+BOOL ListICR8600Devices(_Out_ std::vector<ICR8600_DEVICE_INFO> *Devices)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ListICR8600Devices");
+	return SUCCEEDED(EnumerateDevices(*Devices, FALSE));
+}
+
+static BOOL MatchDevice(const ICR8600_DEVICE_INFO &Info, const char *Serial, const char *Path)
+{
+	if (Serial != NULL && *Serial != '\0' && Info.Serial != Serial) return FALSE;
+	if (Path != NULL && *Path != '\0' && Info.Path != Path) return FALSE;
+	return TRUE;
+}
+
+//
+// Opens the radio at Info.Path. Gone is set when it is not there anymore,
+// as opposed to in use or failing
+//
+static HRESULT OpenDevicePath(_Out_ PDEVICE_DATA DeviceData, const ICR8600_DEVICE_INFO &Info, _Out_ PBOOL Gone)
+{
+#ifdef _WIN32
+    HRESULT hr = S_OK;
+    BOOL    bResult;
+
+    *Gone = FALSE;
+    DeviceData->DeviceHandle = CreateFileA(Info.Path.c_str(),
+                                           GENERIC_WRITE | GENERIC_READ,
+                                           FILE_SHARE_WRITE | FILE_SHARE_READ,
+                                           NULL,
+                                           OPEN_EXISTING,
+                                           FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
+                                           NULL);
+
+    if (INVALID_HANDLE_VALUE == DeviceData->DeviceHandle) {
+        DWORD error = GetLastError();
+        *Gone = (error == ERROR_FILE_NOT_FOUND);
+        hr = HRESULT_FROM_WIN32(error);
         return hr;
     }
 
-    //
-    // Give path of the first found device interface instance to the caller. CM_Get_Device_Interface_List ensured
-    // the instance is NULL-terminated.
-    //
-    hr = StringCbCopy(DevicePath,
-                      BufLen,
-                      DeviceInterfaceList);
+    bResult = WinUsb_Initialize(DeviceData->DeviceHandle, &DeviceData->WinusbHandle);
+    if (FALSE == bResult) {
 
-    HeapFree(GetProcessHeap(), 0, DeviceInterfaceList);
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(DeviceData->DeviceHandle);
+        return hr;
+    }
+
+    // CI-V pipes: a radio that stops answering fails the call instead of blocking it
+    ULONG timeout = ICR8600_USB_TIMEOUT_MS;
+    WinUsb_SetPipePolicy(DeviceData->WinusbHandle, PIPE_CONTROL_ID, PIPE_TRANSFER_TIMEOUT, sizeof(timeout), &timeout);
+    WinUsb_SetPipePolicy(DeviceData->WinusbHandle, PIPE_RESPONSE_ID, PIPE_TRANSFER_TIMEOUT, sizeof(timeout), &timeout);
 
+    DeviceData->Info = Info;
+    DeviceData->HandlesOpen = TRUE;
     return hr;
 #else
-	SoapySDR_logf(SOAPY_SDR_FATAL, "RetrieveDevicePath: Only WIN32 Supported");
-    return 0;
+	*Gone = FALSE;
+	libusb_context *enumContext = NULL;
+	libusb_device *device = CachedDevice(Info.Path, &enumContext);
+	if (device == NULL) {
+		*Gone = TRUE;
+		return E_FAIL;
+	}
+
+	ICR8600_USB_DEVICE *usb = new ICR8600_USB_DEVICE;
+	usb->Context = enumContext;
+	usb->OwnContext = FALSE;
+	usb->Fd = -1;
+	usb->Handle = NULL;
+	usb->CancelAsync = false;
+	usb->AsyncRunning = false;
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x0100010A)
+	// a context of its own that does not walk the bus, around the radio's usbfs node
+	char node[MAX_PATH];
+	snprintf(node, sizeof(node), "%s/%03d/%03d", ICR8600_USBFS_PATH,
+		(int)libusb_get_bus_number(device), (int)libusb_get_device_address(device));
+	libusb_unref_device(device);
+	usb->Fd = open(node, O_RDWR | O_CLOEXEC);
+	if (usb->Fd < 0) {
+		*Gone = (errno == ENOENT);
+		SoapySDR_logf(*Gone ? SOAPY_SDR_DEBUG : SOAPY_SDR_WARNING, "OpenDevice: %s: %s", node, strerror(errno));
+		FreeUSBDevice(usb);
+		return E_FAIL;
+	}
+	struct libusb_init_option option;
+	option.option = LIBUSB_OPTION_NO_DEVICE_DISCOVERY;
+	option.value.ival = 0;
+	int r = libusb_init_context(&usb->Context, &option, 1);
+	if (r < 0) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "OpenDevice: libusb_init_context failed: %s", libusb_error_name(r));
+		usb->Context = NULL;
+		FreeUSBDevice(usb);
+		return E_FAIL;
+	}
+	usb->OwnContext = TRUE;
+	r = libusb_wrap_sys_device(usb->Context, (intptr_t)usb->Fd, &usb->Handle);
+	if (r < 0) {
+		*Gone = (r == LIBUSB_ERROR_NO_DEVICE);
+		SoapySDR_logf(SOAPY_SDR_WARNING, "OpenDevice: %s: libusb_wrap_sys_device failed: %s", Info.Path.c_str(), libusb_error_name(r));
+		usb->Handle = NULL;
+		FreeUSBDevice(usb);
+		return E_FAIL;
+	}
+#else
+	// the enumeration context, its events are handled by whichever radio's RX thread gets there first
+	int r = libusb_open(device, &usb->Handle);
+	libusb_unref_device(device);
+	if (r < 0) {
+		*Gone = (r == LIBUSB_ERROR_NO_DEVICE);
+		SoapySDR_logf(SOAPY_SDR_WARNING, "OpenDevice: %s: libusb_open failed: %s", Info.Path.c_str(), libusb_error_name(r));
+		usb->Handle = NULL;
+		FreeUSBDevice(usb);
+		return E_FAIL;
+	}
+#endif
+
+	// another radio was plugged into the port since the bus was walked
+	if (!Info.Serial.empty() && LibusbSerial(usb->Handle) != Info.Serial) {
+		*Gone = TRUE;
+		FreeUSBDevice(usb);
+		return E_FAIL;
+	}
+
+	// Detach any kernel driver bound to the interface, then take it over
+	libusb_set_auto_detach_kernel_driver(usb->Handle, 1);
+	r = libusb_claim_interface(usb->Handle, ICR8600_INTERFACE);
+	if (r < 0) {
+		SoapySDR_logf(r == LIBUSB_ERROR_BUSY ? SOAPY_SDR_DEBUG : SOAPY_SDR_WARNING,
+			"OpenDevice: %s: libusb_claim_interface failed: %s", Info.Path.c_str(), libusb_error_name(r));
+		FreeUSBDevice(usb);
+		return E_FAIL;
+	}
+
+	DeviceData->Info = Info;
+	DeviceData->WinusbHandle = usb;
+	DeviceData->HandlesOpen = TRUE;
+	return S_OK;
+#endif
+}
+
+HRESULT OpenDevice(_Out_ PDEVICE_DATA DeviceData, _Out_opt_ PBOOL FailureDeviceNotFound, _In_opt_ const char *Serial, _In_opt_ const char *Path)
+{
+	SoapySDR_logf(SOAPY_SDR_TRACE, "OpenDevice");
+	DeviceData->HandlesOpen = FALSE;
+#ifndef _WIN32
+	DeviceData->WinusbHandle = NULL;
 #endif
+	if (NULL != FailureDeviceNotFound) {
+		*FailureDeviceNotFound = FALSE;
+	}
+
+	//
+	// The first matching radio that opens wins, so radios in use are skipped.
+	// When none matches or a cached one has gone, the bus is walked again once.
+	//
+	for (int attempt = 0; attempt < 2; attempt++) {
+		std::vector<ICR8600_DEVICE_INFO> devices;
+		HRESULT hr = EnumerateDevices(devices, attempt > 0);
+		if (FAILED(hr)) {
+			return hr;
+		}
+
+		BOOL found = FALSE;
+		BOOL gone = FALSE;
+		for (size_t i = 0; i < devices.size(); i++) {
+			if (!MatchDevice(devices[i], Serial, Path)) continue;
+			found = TRUE;
+			BOOL deviceGone = FALSE;
+			if (SUCCEEDED(OpenDevicePath(DeviceData, devices[i], &deviceGone))) {
+				return S_OK;
+			}
+			gone = gone || deviceGone;
+		}
+		if (found && !gone) {
+			return E_FAIL;
+		}
+	}
+
+	if (NULL != FailureDeviceNotFound) {
+		*FailureDeviceNotFound = TRUE;
+	}
+	return E_FAIL;
 }
 
+BOOL GetDeviceDescriptor(WINUSB_INTERFACE_HANDLE hDeviceHandle, _Out_ USB_DEVICE_DESCRIPTOR *pDeviceDesc)
+{
+#ifdef _WIN32
+	SoapySDR_logf(SOAPY_SDR_TRACE, "GetDeviceDescriptor");
+    ULONG lengthReceived;
+	BOOL bResult = WinUsb_GetDescriptor(hDeviceHandle, USB_DEVICE_DESCRIPTOR_TYPE, 0, 0, (PBYTE)pDeviceDesc, sizeof(USB_DEVICE_DESCRIPTOR), &lengthReceived);
+	if (FALSE == bResult || lengthReceived != sizeof(USB_DEVICE_DESCRIPTOR)) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "GetDeviceDescriptor: Error among LastError %d or lengthReceived %d", FALSE == bResult ? GetLastError() : 0, lengthReceived);
+		return FALSE;
+	}
+	return TRUE;
+#else
+	SoapySDR_logf(SOAPY_SDR_TRACE, "GetDeviceDescriptor");
+	if (hDeviceHandle == NULL) {
+		SoapySDR_logf(SOAPY_SDR_FATAL, "GetDeviceDescriptor: Invalid Handle");
+		return FALSE;
+	}
+	struct libusb_device_descriptor desc;
+	int r = libusb_get_device_descriptor(libusb_get_device(hDeviceHandle->Handle), &desc);
+	if (r < 0) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "GetDeviceDescriptor: %s", libusb_error_name(r));
+		return FALSE;
+	}
+	pDeviceDesc->idVendor = desc.idVendor;
+	pDeviceDesc->idProduct = desc.idProduct;
+	pDeviceDesc->bcdUSB = desc.bcdUSB;
+	return TRUE;
+#endif
+}
+
+VOID CloseDevice(_Inout_ PDEVICE_DATA DeviceData)
+{
+#ifdef _WIN32
+	SoapySDR_logf(SOAPY_SDR_TRACE, "CloseDevice");
+    if (FALSE == DeviceData->HandlesOpen) {
+        //
+        // Called on an uninitialized DeviceData
+        //
+        return;
+    }
+
+    WinUsb_Free(DeviceData->WinusbHandle);
+    CloseHandle(DeviceData->DeviceHandle);
+    DeviceData->HandlesOpen = FALSE;
+	DeviceData->DeviceHandle = INVALID_HANDLE_VALUE;
+#else
+	SoapySDR_logf(SOAPY_SDR_TRACE, "CloseDevice");
+	if (FALSE == DeviceData->HandlesOpen) {
+		//
+		// Called on an uninitialized DeviceData
+		//
+		return;
+	}
+
+	libusb_release_interface(DeviceData->WinusbHandle->Handle, ICR8600_INTERFACE);
+	FreeUSBDevice(DeviceData->WinusbHandle);
+	DeviceData->WinusbHandle = NULL;
+	DeviceData->HandlesOpen = FALSE;
+#endif
+}
+
+
 BOOL WriteToBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, ULONG* pcbWritten, PUCHAR send, ULONG cbSize)
 {
 #ifdef _WIN32
@@ -291,55 +642,57 @@ BOOL WriteToBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, ULONG*
 
 	return bResult;
 #else
-	SoapySDR_logf(SOAPY_SDR_FATAL, "WriteToBulkEndpoint: Only WIN32 Supported");
-    return FALSE;
+	SoapySDR_logf(SOAPY_SDR_TRACE, "WriteToBulkEndpoint");
+	if (hDeviceHandle == NULL || !pcbWritten) {
+		SoapySDR_logf(SOAPY_SDR_FATAL, "WriteToBulkEndpoint: Invalid Handle");
+		return FALSE;
+	}
+
+	int cbSent = 0;
+	int r = libusb_bulk_transfer(hDeviceHandle->Handle, ID, send, (int)cbSize, &cbSent, ICR8600_USB_TIMEOUT_MS);
+	if (r == 0) {
+		SoapySDR_logf(SOAPY_SDR_TRACE, "WriteToBulkEndpoint: 0x%x: %d bytes, actual data transferred: %d", ID, cbSize, cbSent);
+		*pcbWritten = (ULONG)cbSent;
+		return TRUE;
+	}
+	SoapySDR_logf(SOAPY_SDR_ERROR, "WriteToBulkEndpoint: libusb_bulk_transfer Failed: %s", libusb_error_name(r));
+	return FALSE;
 #endif
 }
 
 BOOL ReadFromBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, ULONG cbSize)
 {
-#ifdef _WIN32
 	SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint");
-	if (hDeviceHandle == INVALID_HANDLE_VALUE) {
-		SoapySDR_logf(SOAPY_SDR_FATAL, "ReadFromBulkEndpoint: Invalid Handle");
+	UCHAR szBuffer[64] = { 0 };
+	if (cbSize > sizeof(szBuffer)) {
+		cbSize = sizeof(szBuffer);
+	}
+
+	ULONG cbRead = ReadBufferFromBulkEndpoint(hDeviceHandle, ID, szBuffer, cbSize, ICR8600_USB_TIMEOUT_MS);
+	if (cbRead == 0) {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "ReadFromBulkEndpoint: Read Failed");
 		return FALSE;
 	}
 
-	BOOL bResult = TRUE;
-	UCHAR* szBuffer = (UCHAR*)LocalAlloc(LPTR, sizeof(UCHAR)*cbSize);
-	ULONG cbRead = 0;
-	bResult = WinUsb_ReadPipe(hDeviceHandle, ID, szBuffer, cbSize, &cbRead, 0);
-	if (bResult) {
-		if (cbRead == 6) {
-			// FE FE E0 96 FB FD - OK
-			if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFB)
-				SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint: OK");
-			// FE FE E0 96 FA FD - Fail
-			else if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFA)
-				SoapySDR_logf(SOAPY_SDR_ERROR, "ReadFromBulkEndpoint: Fail");
-			else
-				SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint: output %Xh %Xh %Xh %Xh %Xh %Xh", szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5]);
-		}
-		else {
-			// printf("ReadFromBulkEndpoint: pipe 0x%x: size %d, actual data read: %d.\n", ID, cbSize, cbRead);
-			SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint output (%d): %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh", cbRead, szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5], szBuffer[6], szBuffer[7],
-				szBuffer[8], szBuffer[9], szBuffer[10], szBuffer[11], szBuffer[12], szBuffer[13], szBuffer[14], szBuffer[15]);
-		}
+	if (cbRead == 6) {
+		// FE FE E0 96 FB FD - OK
+		if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFB)
+			SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint: OK");
+		// FE FE E0 96 FA FD - Fail
+		else if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFA)
+			SoapySDR_logf(SOAPY_SDR_ERROR, "ReadFromBulkEndpoint: Fail");
+		else
+			SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint: output %Xh %Xh %Xh %Xh %Xh %Xh", szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5]);
 	}
 	else {
-		SoapySDR_logf(SOAPY_SDR_ERROR, "ReadFromBulkEndpoint: WinUsb_ReadPipe Failed");
+		SoapySDR_logf(SOAPY_SDR_TRACE, "ReadFromBulkEndpoint output (%d): %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh", cbRead, szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5], szBuffer[6], szBuffer[7],
+			szBuffer[8], szBuffer[9], szBuffer[10], szBuffer[11], szBuffer[12], szBuffer[13], szBuffer[14], szBuffer[15]);
 	}
-
-	LocalFree(szBuffer);
-	return bResult;
-#else
-	SoapySDR_logf(SOAPY_SDR_FATAL, "ReadFromBulkEndpoint: Only WIN32 Supported");
-    return FALSE;
-#endif
+	return TRUE;
 }
 
 
-ULONG ReadBufferFromBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, PUCHAR szBuffer, ULONG cbSize)
+ULONG ReadBufferFromBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, PUCHAR szBuffer, ULONG cbSize, ULONG TimeoutMs)
 {
 #ifdef _WIN32
 	SoapySDR_logf(SOAPY_SDR_TRACE, "ReadBufferFromBulkEndpoint");
@@ -348,10 +701,8 @@ ULONG ReadBufferFromBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID
 		return FALSE;
 	}
 
-	BOOL bResult = TRUE;
 	ULONG cbRead = 0;
-	bResult = WinUsb_ReadPipe(hDeviceHandle, ID, szBuffer, cbSize, &cbRead, 0);
-	if (bResult) {
+	if (ReadPipeTimed(hDeviceHandle, ID, szBuffer, cbSize, TimeoutMs, &cbRead)) {
 		SoapySDR_logf(SOAPY_SDR_TRACE, "ReadBufferFromBulkEndpoint: Read %d", cbRead);
 		return cbRead;
 	}
@@ -360,359 +711,252 @@ ULONG ReadBufferFromBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID
 		return 0;
 	}
 #else
-	SoapySDR_logf(SOAPY_SDR_FATAL, "ReadBufferFromBulkEndpoint: Only WIN32 Supported");
-    return 0;
-#endif
-}
-
-
-BOOL GetAck(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "GetAck");
-	if (hDeviceHandle == INVALID_HANDLE_VALUE) {
-		SoapySDR_logf(SOAPY_SDR_FATAL, "GetAck: Invalid Handle");
-		return FALSE;
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ReadBufferFromBulkEndpoint");
+	if (hDeviceHandle == NULL) {
+		SoapySDR_logf(SOAPY_SDR_FATAL, "ReadBufferFromBulkEndpoint: Invalid Handle");
+		return 0;
 	}
 
-	ULONG cbSize = 64;
-	BOOL bResult = TRUE;
-	UCHAR* szBuffer = (UCHAR*)LocalAlloc(LPTR, sizeof(UCHAR)*cbSize);
-	ULONG cbRead = 0;
-	bResult = WinUsb_ReadPipe(hDeviceHandle, ID, szBuffer, cbSize, &cbRead, 0);
-	if (bResult) {
-		if (cbRead == 6) {
-			// FE FE E0 96 FB FD - OK
-			if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFB)
-				SoapySDR_logf(SOAPY_SDR_TRACE, "GetAck: Valid Command");
-			// FE FE E0 96 FA FD - Fail
-			else if (szBuffer[3] == 0x96 && szBuffer[4] == 0xFA)
-			{
-				SoapySDR_logf(SOAPY_SDR_ERROR, "GetAck: Invalid Command");
-				bResult = false;
-			}
-			else
-			{
-				SoapySDR_logf(SOAPY_SDR_ERROR, "GetAck: Unexpected Response %Xh %Xh %Xh %Xh %Xh %Xh", szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5]);
-				bResult = false;
-			}
-		}
-		else {
-			SoapySDR_logf(SOAPY_SDR_ERROR, "GetAck: Unexpected Response (%d) %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh  %Xh %Xh %Xh %Xh", cbRead, szBuffer[0], szBuffer[1], szBuffer[2], szBuffer[3], szBuffer[4], szBuffer[5], szBuffer[6], szBuffer[7],
-				szBuffer[8], szBuffer[9], szBuffer[10], szBuffer[11], szBuffer[12], szBuffer[13], szBuffer[14], szBuffer[15]);
-				bResult = false;
-		}
-	}
-	else {
-		SoapySDR_logf(SOAPY_SDR_FATAL, "GetAck: WinUsb_ReadPipe Failed");
+	int cbRead = 0;
+	int r = libusb_bulk_transfer(hDeviceHandle->Handle, ID, szBuffer, (int)cbSize, &cbRead, TimeoutMs);
+	if (r == 0 || r == LIBUSB_ERROR_TIMEOUT) {
+		SoapySDR_logf(SOAPY_SDR_TRACE, "ReadBufferFromBulkEndpoint: Read %d", cbRead);
+		return (ULONG)cbRead;
 	}
-
-	LocalFree(szBuffer);
-	return bResult;
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "GetAck: Only WIN32 Supported");
-    return FALSE;
+	SoapySDR_logf(SOAPY_SDR_ERROR, "ReadBufferFromBulkEndpoint: libusb_bulk_transfer Failed: %s", libusb_error_name(r));
+	return 0;
 #endif
 }
 
 
-BOOL ICR8600SetRemoteOn(WINUSB_INTERFACE_HANDLE hDeviceHandle)
+#ifndef _WIN32
+struct AsyncReadContext
 {
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetRemoteOn");
-	UCHAR remote_on_cmd[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x00, 0x01,  0xFD, 0xFF };
-	ULONG sent = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, remote_on_cmd, sizeof(remote_on_cmd));
-	Sleep(100);
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetRemoteOn: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
-
-BOOL ICR8600SetRemoteOff(WINUSB_INTERFACE_HANDLE hDeviceHandle)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetRemoteOff");
-	ULONG sent = 0;
-	UCHAR remote_off_cmd[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x00, 0x00,  0xFD, 0xFF };
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, remote_off_cmd, sizeof(remote_off_cmd));
-	Sleep(100);
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetRemoteOff: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
-
-BOOL ICR8600SetSampleRate(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG sampleRate)
+	ICR8600_IQ_CALLBACK Callback;
+	PVOID Context;
+	ULONG Pending;
+	BOOL Running;
+	BOOL Result;
+};
+
+static void LIBUSB_CALL AsyncReadCallback(struct libusb_transfer *transfer)
 {
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetSampleRate");
-	UCHAR iq_5120_16bit[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x01,  0xFD, 0xFF };
-	UCHAR iq_3840_16bit[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x02,  0xFD, 0xFF };
-	UCHAR iq_1920_16bit[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x03,  0xFD, 0xFF };
-	UCHAR iq_960_16bit[]  = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x04,  0xFD, 0xFF };
-	UCHAR iq_480_16bit[]  = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x05,  0xFD, 0xFF };
-	UCHAR iq_240_16bit[]  = { 0xFE, 0xFE, 0x96, 0xE0,  0x1A, 0x13, 0x01, 0x01, 0x00, 0x06,  0xFD, 0xFF };
-	ULONG sent = 0;
-	if (sampleRate == 240000) {
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 240000");
-		WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, iq_240_16bit, sizeof(iq_240_16bit));
-		Sleep(100);
-		return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-	}
-	if (sampleRate == 480000) {
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 480000\n");
-		WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, iq_480_16bit, sizeof(iq_480_16bit));
-		Sleep(100);
-		return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-	}
-	if (sampleRate == 960000) {
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 960000\n");
-		WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, iq_960_16bit, sizeof(iq_960_16bit));
-		Sleep(100);
-		return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-	}
-	if (sampleRate == 1920000) {
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 1920000\n");
-		WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, iq_1920_16bit, sizeof(iq_1920_16bit));
-		Sleep(100);
-		return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-	}
-	if (sampleRate == 3840000) {
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 3840000\n");
-		WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, iq_3840_16bit, sizeof(iq_3840_16bit));
-		Sleep(100);
-		return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-	}
-	if (sampleRate == 5120000) {
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetSampleRate: 5120000\n");
-		WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, iq_5120_16bit, sizeof(iq_5120_16bit));
-		Sleep(100);
-		return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-	}
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetSampleRate: Undefined Sample Rate"); 
-	return FALSE;
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetSampleRate: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	AsyncReadContext *ctx = (AsyncReadContext *)transfer->user_data;
+	ctx->Pending--;
 
-BOOL ICR8600SetFrequency(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG frequency)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetFrequency");
-	ULONG f1 = frequency % 100, f2 = (frequency / 100) % 100, f3 = (frequency / 10000) % 100, f4 = (frequency / 1000000) % 100, f5 = (frequency / 100000000) % 100;
-	UCHAR set_freq[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x05,  decToBcd(f1),decToBcd(f2),decToBcd(f3),decToBcd(f4),decToBcd(f5),  0xFD, 0xFF };
-	ULONG sent = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_freq, sizeof(set_freq));
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetFrequency: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
+		if (ctx->Running && transfer->status != LIBUSB_TRANSFER_CANCELLED) {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipeAsync: Transfer Failed (%d)", transfer->status);
+			ctx->Result = FALSE;
+		}
+		ctx->Running = FALSE;
+		return;
+	}
+	if (!ctx->Running) {
+		return;
+	}
 
-//
-// Antenna commands, both Set and Get, will only work if the R8600
-// is tuned to the HF band, otherwise the R8600 will respond 'Invalid Command'
-//
-BOOL ICR8600SetAntenna(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG antennaIndex)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetAntenna");
-	UCHAR set_ant[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x12, (UCHAR)(antennaIndex & 0xff),  0xFD, 0xFF };
-	ULONG sent = 0;
-	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600SetAntenna: Index = %d", antennaIndex);
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_ant, sizeof(set_ant));
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetAntenna: Only WIN32 Supported");
-    return FALSE;
-#endif
+	transfer->buffer = ctx->Callback(transfer->buffer, (ULONG)transfer->actual_length, ctx->Context);
+	if (transfer->buffer == NULL) {
+		ctx->Running = FALSE;
+		return;
+	}
+	int r = libusb_submit_transfer(transfer);
+	if (r == 0) {
+		ctx->Pending++;
+	}
+	else {
+		SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipeAsync: libusb_submit_transfer Failed: %s", libusb_error_name(r));
+		ctx->Running = FALSE;
+		ctx->Result = FALSE;
+	}
 }
-
-BOOL ICR8600GetAntenna(WINUSB_INTERFACE_HANDLE hDeviceHandle, PULONG antennaIndex)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetAntenna");
-	UCHAR set_ant[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x12, 0xFD };
-	ULONG sent = 0;
-	UCHAR response[64];
-	ULONG recv = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_ant, sizeof(set_ant));
-	recv = ReadBufferFromBulkEndpoint(hDeviceHandle, PIPE_RESPONSE_ID, response, sizeof(response));
-	if (recv == 8) {
-		*antennaIndex = (ULONG)response[5];
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAntenna: Index = %d", *antennaIndex);
-		return true;
-	}
-	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAntenna: Invalid Command");
-	return false;
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600GetAntenna: Only WIN32 Supported");
-    return FALSE;
 #endif
-}
 
-ULONG ICR8600ReadPipe(WINUSB_INTERFACE_HANDLE hDeviceHandle, PUCHAR Buffer, ULONG BufferLength) 
+ULONG ICR8600ReadPipe(WINUSB_INTERFACE_HANDLE hDeviceHandle, PUCHAR Buffer, ULONG BufferLength, ULONG TimeoutMs)
 {
 #ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600ReadPipe");
+	// Streaming hot path: no per call logging, see StreamTrace.h
 	ULONG cbRead = 0;
-	BOOL bResult = WinUsb_ReadPipe(hDeviceHandle, PIPE_IQ_ID, Buffer, BufferLength, &cbRead, 0);
-	if (bResult) {
-		SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600ReadPipe: Read %d", cbRead);
+	if (ReadPipeTimed(hDeviceHandle, PIPE_IQ_ID, Buffer, BufferLength, TimeoutMs, &cbRead)) {
 		return cbRead;
 	}
-	else {
-		SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipe: WinUsb_ReadPipe Failed");
-		return 0;
-	}
+	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipe: WinUsb_ReadPipe Failed");
+	return 0;
 #else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipe: Only WIN32 Supported");
+	// Streaming hot path: no per call logging, see StreamTrace.h
+	int cbRead = 0;
+	int r = libusb_bulk_transfer(hDeviceHandle->Handle, PIPE_IQ_ID, Buffer, (int)BufferLength, &cbRead, TimeoutMs);
+	if (r == 0 || r == LIBUSB_ERROR_TIMEOUT) {
+		return (ULONG)cbRead;
+	}
+	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipe: libusb_bulk_transfer Failed: %s", libusb_error_name(r));
 	return 0;
 #endif
 }
 
-BOOL ICR8600SetPreAmpOn(WINUSB_INTERFACE_HANDLE hDeviceHandle)
+BOOL ICR8600ReadPipeAsync(WINUSB_INTERFACE_HANDLE hDeviceHandle, ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength)
 {
 #ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetPreAmpOn");
-	UCHAR set_preamp[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x16, 0x02, 0x01, 0xFD };
-	ULONG sent = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_preamp, sizeof(set_preamp));
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetPreAmpOn: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600ReadPipeAsync");
+	if (hDeviceHandle == INVALID_HANDLE_VALUE || NumTransfers == 0) {
+		SoapySDR_logf(SOAPY_SDR_FATAL, "ICR8600ReadPipeAsync: Invalid Handle");
+		return FALSE;
+	}
 
-BOOL ICR8600SetPreAmpOff(WINUSB_INTERFACE_HANDLE hDeviceHandle)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetPreAmpOff");
-	UCHAR set_preamp[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x16, 0x02, 0x00, 0xFD };
-	ULONG sent = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_preamp, sizeof(set_preamp));
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetPreAmpOff: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	OVERLAPPED* overlapped = (OVERLAPPED*)LocalAlloc(LPTR, sizeof(OVERLAPPED)*NumTransfers);
+	PUCHAR* buffers = (PUCHAR*)LocalAlloc(LPTR, sizeof(PUCHAR)*NumTransfers);
+	BOOL* queued = (BOOL*)LocalAlloc(LPTR, sizeof(BOOL)*NumTransfers);
+	for (ULONG i = 0; i < NumTransfers; i++) {
+		overlapped[i].hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	}
 
-BOOL ICR8600SetGainRF(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG gain)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetGainRF");
-	ULONG g1 = gain % 100, g2 = (gain / 100) % 100;
-	UCHAR set_gain[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x14, 0x02, decToBcd(g2), decToBcd(g1),  0xFD, 0xFF };
-	ULONG sent = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_gain, sizeof(set_gain));
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetGainRF: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	BOOL bResult = TRUE;
+	BOOL running = TRUE;
+	BOOL aborted = FALSE;
+	ULONG pending = 0;
+
+	// Queue all transfers up front, so the endpoint always has a read to complete
+	for (ULONG i = 0; i < NumTransfers && running; i++) {
+		buffers[i] = Callback(NULL, 0, Context);
+		if (buffers[i] == NULL) {
+			running = FALSE;
+			break;
+		}
+		queued[i] = SubmitReadPipe(hDeviceHandle, PIPE_IQ_ID, buffers[i], TransferLength, &overlapped[i]);
+		if (queued[i]) {
+			pending++;
+		}
+		else {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipeAsync: WinUsb_ReadPipe Failed");
+			running = FALSE;
+			bResult = FALSE;
+		}
+	}
 
-BOOL ICR8600SetAttenuator(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG atten)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetAttenuator");
-	UCHAR set_atten[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x11, decToBcd(atten), 0xFD, 0xFF };
-	ULONG sent = 0;
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600SetAttenuator: Attenuator = %d", atten);
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_atten, sizeof(set_atten));
-	return GetAck(hDeviceHandle, PIPE_RESPONSE_ID);
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600SetAttenuator: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	// Reads on a bulk pipe complete in the order they were queued
+	ULONG i = 0;
+	while (pending > 0) {
+		if (queued[i]) {
+			ULONG cbRead = 0;
+			BOOL completed = WinUsb_GetOverlappedResult(hDeviceHandle, &overlapped[i], &cbRead, TRUE);
+			queued[i] = FALSE;
+			pending--;
+
+			if (running && !completed) {
+				if (GetLastError() != ERROR_OPERATION_ABORTED) {
+					SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipeAsync: Transfer Failed");
+					bResult = FALSE;
+				}
+				running = FALSE;
+			}
+			if (running) {
+				buffers[i] = Callback(buffers[i], cbRead, Context);
+				running = (buffers[i] != NULL);
+			}
+			if (running) {
+				queued[i] = SubmitReadPipe(hDeviceHandle, PIPE_IQ_ID, buffers[i], TransferLength, &overlapped[i]);
+				if (queued[i]) {
+					pending++;
+				}
+				else {
+					SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipeAsync: WinUsb_ReadPipe Failed");
+					running = FALSE;
+					bResult = FALSE;
+				}
+			}
+			if (!running && !aborted && pending > 0) {
+				// Complete the remaining reads so they can be released
+				WinUsb_AbortPipe(hDeviceHandle, PIPE_IQ_ID);
+				aborted = TRUE;
+			}
+		}
+		i = (i + 1) % NumTransfers;
+	}
 
-BOOL ICR8600GetGainRF(WINUSB_INTERFACE_HANDLE hDeviceHandle, PULONG gain)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetGainRF");
-	UCHAR set_gain[] = { 0xFE, 0xFE, 0x96, 0xE0,  0x14, 0x02, 0xFD, 0xFF };
-	UCHAR response[64];
-	ULONG sent = 0;
-	ULONG recv = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_gain, sizeof(set_gain));
-	recv = ReadBufferFromBulkEndpoint(hDeviceHandle, PIPE_RESPONSE_ID, response, sizeof(response));
-	if (recv == 10) {
-		ULONG g1 = bcdToDec(response[6]);
-		ULONG g2 = bcdToDec(response[7]);
-		*gain = (g1 * 100) +  g2;
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetGainRF: RF Gain = %d", *gain);
-		return true;
-	}
-	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetGainRF: Invalid Command");
-	return false;
+	for (ULONG i = 0; i < NumTransfers; i++) {
+		CloseHandle(overlapped[i].hEvent);
+	}
+	LocalFree(queued);
+	LocalFree(buffers);
+	LocalFree(overlapped);
+	return bResult;
 #else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600GetGainRF: Only WIN32 Supported");
-    return FALSE;
-#endif
-}
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600ReadPipeAsync");
+	if (hDeviceHandle == NULL || NumTransfers == 0) {
+		SoapySDR_logf(SOAPY_SDR_FATAL, "ICR8600ReadPipeAsync: Invalid Handle");
+		return FALSE;
+	}
 
-BOOL ICR8600GetPreAmpState(WINUSB_INTERFACE_HANDLE hDeviceHandle, PBOOL on)
-{
-#ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetPreAmpState");
-	UCHAR set_preamp[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x16, 0x02, 0xFD, 0xFF };
-	UCHAR response[64];
-	ULONG sent = 0;
-	ULONG recv = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_preamp, sizeof(set_preamp));
-	recv = ReadBufferFromBulkEndpoint(hDeviceHandle, PIPE_RESPONSE_ID, response, sizeof(response));
-	if (recv == 8) {
-		if (response[6] == 0x00) {
-			*on = false;
-			SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: OFF");
-			return true;
+	// a cancel left over from a read that already ended must not stop this one
+	hDeviceHandle->CancelAsync = false;
+	hDeviceHandle->AsyncRunning = true;
+
+	AsyncReadContext ctx;
+	ctx.Callback = Callback;
+	ctx.Context = Context;
+	ctx.Pending = 0;
+	ctx.Running = TRUE;
+	ctx.Result = TRUE;
+
+	struct libusb_transfer **transfers = (struct libusb_transfer **)calloc(NumTransfers, sizeof(struct libusb_transfer *));
+
+	// Queue all transfers up front, so the endpoint always has a read to complete
+	for (ULONG i = 0; i < NumTransfers && ctx.Running; i++) {
+		PUCHAR buffer = Callback(NULL, 0, Context);
+		if (buffer == NULL) {
+			ctx.Running = FALSE;
+			break;
 		}
-		else if (response[6] == 0x01) {
-			*on = true;
-			SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: ON");
-			return true;
+		transfers[i] = libusb_alloc_transfer(0);
+		libusb_fill_bulk_transfer(transfers[i], hDeviceHandle->Handle, PIPE_IQ_ID, buffer, (int)TransferLength, &AsyncReadCallback, &ctx, 0);
+		int r = libusb_submit_transfer(transfers[i]);
+		if (r == 0) {
+			ctx.Pending++;
+		}
+		else {
+			SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600ReadPipeAsync: libusb_submit_transfer Failed: %s", libusb_error_name(r));
+			ctx.Running = FALSE;
+			ctx.Result = FALSE;
 		}
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: Unexpected Response %Xh", response[6]);
-		return false;
 	}
-	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetPreAmpState: Invalid Command %d", recv);
-	return false;
-#else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600GetPreAmpState: Only WIN32 Supported");
-    return FALSE;
+
+	// Completions are delivered from here, in the order the reads were queued
+	BOOL cancelled = FALSE;
+	while (ctx.Pending > 0) {
+		if (hDeviceHandle->CancelAsync) {
+			ctx.Running = FALSE;
+		}
+		if (!ctx.Running && !cancelled) {
+			for (ULONG i = 0; i < NumTransfers; i++) {
+				if (transfers[i] != NULL) libusb_cancel_transfer(transfers[i]);
+			}
+			cancelled = TRUE;
+		}
+		struct timeval tv = { 0, 100000 };
+		libusb_handle_events_timeout_completed(hDeviceHandle->Context, &tv, NULL);
+	}
+
+	for (ULONG i = 0; i < NumTransfers; i++) {
+		if (transfers[i] != NULL) libusb_free_transfer(transfers[i]);
+	}
+	free(transfers);
+	hDeviceHandle->AsyncRunning = false;
+	hDeviceHandle->CancelAsync = false;
+	return ctx.Result;
 #endif
 }
 
-BOOL ICR8600GetAttenuator(WINUSB_INTERFACE_HANDLE hDeviceHandle, PULONG gain)
+VOID ICR8600CancelReadPipeAsync(WINUSB_INTERFACE_HANDLE hDeviceHandle)
 {
 #ifdef _WIN32
-	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600GetAttenuator");
-	UCHAR set_gain[] = { 0xFE, 0xFE, 0x96, 0xE0, 0x11, 0xFD };
-	UCHAR response[64];
-	ULONG sent = 0;
-	ULONG recv = 0;
-	WriteToBulkEndpoint(hDeviceHandle, PIPE_CONTROL_ID, &sent, set_gain, sizeof(set_gain));
-	recv = ReadBufferFromBulkEndpoint(hDeviceHandle, PIPE_RESPONSE_ID, response, sizeof(response));
-	if (recv == 8) {
-		*gain = bcdToDec(response[5]);
-		SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAttenuator: Gain = %d", *gain);
-		return true;
-	}
-	SoapySDR_logf(SOAPY_SDR_DEBUG, "ICR8600GetAttenuator: Invalid Command");
-	return false;
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600CancelReadPipeAsync");
+	WinUsb_AbortPipe(hDeviceHandle, PIPE_IQ_ID);
 #else
-	SoapySDR_logf(SOAPY_SDR_ERROR, "ICR8600GetAttenuator: Only WIN32 Supported");
-    return FALSE;
+	SoapySDR_logf(SOAPY_SDR_TRACE, "ICR8600CancelReadPipeAsync");
+	// only a running read is cancelled, one that starts later checks its callback
+	if (hDeviceHandle != NULL && hDeviceHandle->AsyncRunning) {
+		hDeviceHandle->CancelAsync = true;
+	}
 #endif
 }
-
@@ -20,6 +20,8 @@
 #define WINUSB_DEFINES
 
 #include <SoapySDR/Logger.h>
+#include <string>
+#include <vector>
 
 #ifdef _WIN32
 
@@ -36,7 +38,9 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#include <atomic>
 #include <libusb-1.0/libusb.h>
 
 typedef bool    BOOL;
@@ -47,11 +51,14 @@ typedef char*   LPTSTR;
 typedef unsigned char UCHAR;
 typedef unsigned char* PUCHAR;
 typedef void*   PBYTE;
+typedef void*   PVOID;
 typedef uint32_t ULONG;
 typedef uint32_t* PULONG;
 typedef int32_t HANDLE;
 typedef int32_t HRESULT;
 
+void Sleep(int milliseconds);
+
 #define FALSE   false
 #define TRUE    true
 #define MAX_PATH 255
@@ -59,14 +66,38 @@ typedef int32_t HRESULT;
 #define _In_
 #define _Out_
 #define _Out_opt_
+#define _In_opt_
 #define _Inout_
 #define _Out_bytecap_(x)
-#define FAILED(hr) ((hr) == 0)
+#define S_OK    0
+#define E_FAIL  (-1)
+#define FAILED(hr) ((hr) < 0)
+#define SUCCEEDED(hr) ((hr) >= 0)
 
-struct WINUSB_INTERFACE_HANDLE
+//
+// libusb backend: the interface handle wraps the device handle and the libusb
+// context it was opened on. With libusb 1.0.27 and later that is a context of
+// its own, without device discovery, around the radio's usbfs node Fd; before,
+// the process-wide enumeration context, and Fd is -1.
+//
+struct ICR8600_USB_DEVICE
 {
+    libusb_context       *Context;
+    BOOL                 OwnContext;
+    int                  Fd;
+    libusb_device_handle *Handle;
+    std::atomic<bool>    CancelAsync;
+    std::atomic<bool>    AsyncRunning;
 };
 
+//
+// usbfs, where the libusb backend opens a radio's device node: BBB/DDD by bus and address
+//
+#ifndef ICR8600_USBFS_PATH
+#define ICR8600_USBFS_PATH "/dev/bus/usb"
+#endif
+typedef ICR8600_USB_DEVICE *WINUSB_INTERFACE_HANDLE;
+
 struct USB_DEVICE_DESCRIPTOR
 {
     int idVendor;
@@ -95,31 +126,68 @@ DEFINE_GUID(GUID_DEVINTERFACE_WinUSB1, 0x68D5F5EE, 0xB0E7, 0x49FD, 0xA0,0xD5, 0x
 #define PIPE_RESPONSE_ID	0x88 
 #define PIPE_IQ_ID			0x86 
 
+//
+// Icom IC-R8600 USB IDs and interface, used by the libusb backend
+//
+#define ICR8600_VID			0x0C26
+#define ICR8600_PID			0x0022
+#define ICR8600_INTERFACE	0
+
+//
+// Transfer timeout of the control and response pipes
+//
+#define ICR8600_USB_TIMEOUT_MS	1000
+
+//
+// Age after which the list of radios found on the bus is walked again,
+// unless libusb reports arrivals and removals itself
+//
+#define ICR8600_ENUM_CACHE_MS	1000
+
+//
+// An IC-R8600 on the bus: the serial number string descriptor, empty if it can not
+// be read, and the bus and ports as in sysfs (1-2.3) or the interface path on Windows
+//
+typedef struct _ICR8600_DEVICE_INFO {
+    std::string             Serial;
+    std::string             Path;
+} ICR8600_DEVICE_INFO;
+
 typedef struct _DEVICE_DATA {
     BOOL                    HandlesOpen;
     WINUSB_INTERFACE_HANDLE WinusbHandle;
     HANDLE                  DeviceHandle;
-    TCHAR                   DevicePath[MAX_PATH];
+    ICR8600_DEVICE_INFO     Info;
 } DEVICE_DATA, *PDEVICE_DATA;
 
-BOOL FindICR8600Device();
-HRESULT OpenDevice(_Out_ PDEVICE_DATA DeviceData, _Out_opt_ PBOOL FailureDeviceNotFound);
+BOOL ListICR8600Devices(_Out_ std::vector<ICR8600_DEVICE_INFO> *Devices);
+
+//
+// Opens the first radio with this Serial and Path (NULL or empty for any) that is not in use
+//
+HRESULT OpenDevice(_Out_ PDEVICE_DATA DeviceData, _Out_opt_ PBOOL FailureDeviceNotFound, _In_opt_ const char *Serial, _In_opt_ const char *Path);
 BOOL    GetDeviceDescriptor(_In_ WINUSB_INTERFACE_HANDLE hDeviceHandle, _Out_ USB_DEVICE_DESCRIPTOR *pDeviceDesc);
 VOID	CloseDevice(_Inout_ PDEVICE_DATA DeviceData);
 
-BOOL ICR8600SetRemoteOn(WINUSB_INTERFACE_HANDLE hDeviceHandle);
-BOOL ICR8600SetRemoteOff(WINUSB_INTERFACE_HANDLE hDeviceHandle);
-BOOL ICR8600SetSampleRate(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG sampleRate);
-BOOL ICR8600SetFrequency(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG frequency);
-BOOL ICR8600SetAntenna(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG antennaIndex);
-BOOL ICR8600GetAntenna(WINUSB_INTERFACE_HANDLE hDeviceHandle, PULONG antennaIndex);
-ULONG ICR8600ReadPipe(WINUSB_INTERFACE_HANDLE hDeviceHandle, PUCHAR Buffer, ULONG BufferLength);
-BOOL ICR8600SetPreAmpOn(WINUSB_INTERFACE_HANDLE hDeviceHandle);
-BOOL ICR8600SetPreAmpOff(WINUSB_INTERFACE_HANDLE hDeviceHandle);
-BOOL ICR8600GetPreAmpState(WINUSB_INTERFACE_HANDLE hDeviceHandle, PBOOL on);
-BOOL ICR8600SetGainRF(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG gain);
-BOOL ICR8600GetGainRF(WINUSB_INTERFACE_HANDLE hDeviceHandle, PULONG gain);
-BOOL ICR8600SetAttenuator(WINUSB_INTERFACE_HANDLE hDeviceHandle, ULONG atten);
-BOOL ICR8600GetAttenuator(WINUSB_INTERFACE_HANDLE hDeviceHandle, PULONG gain);
+BOOL    WriteToBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, ULONG* pcbWritten, PUCHAR send, ULONG cbSize);
+ULONG   ReadBufferFromBulkEndpoint(WINUSB_INTERFACE_HANDLE hDeviceHandle, UCHAR ID, PUCHAR szBuffer, ULONG cbSize, ULONG TimeoutMs);
+
+//
+// Synchronous I/Q read, returns what arrived within TimeoutMs (0 waits forever)
+//
+ULONG ICR8600ReadPipe(WINUSB_INTERFACE_HANDLE hDeviceHandle, PUCHAR Buffer, ULONG BufferLength, ULONG TimeoutMs);
+
+//
+// Asynchronous I/Q reads: NumTransfers reads of TransferLength bytes are kept queued
+// on PIPE_IQ_ID and every completed transfer is passed to the callback.
+// The callback returns the buffer the transfer is queued again with, so the caller
+// owns all transfer memory; it is called with Buffer == NULL for the initial buffers.
+// ICR8600ReadPipeAsync blocks until the callback returns NULL or the reads are cancelled.
+// A cancel only stops a read in progress, one started later runs until its callback
+// returns NULL.
+//
+typedef PUCHAR (*ICR8600_IQ_CALLBACK)(PUCHAR Buffer, ULONG Length, PVOID Context);
+BOOL ICR8600ReadPipeAsync(WINUSB_INTERFACE_HANDLE hDeviceHandle, ICR8600_IQ_CALLBACK Callback, PVOID Context, ULONG NumTransfers, ULONG TransferLength);
+VOID ICR8600CancelReadPipeAsync(WINUSB_INTERFACE_HANDLE hDeviceHandle);
 
 #endif // WINUSB_DEFINES
\ No newline at end of file
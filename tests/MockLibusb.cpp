@@ -0,0 +1,393 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#include "MockLibusb.h"
+#include "WinUSBDevice.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <set>
+#include <thread>
+#include <vector>
+
+struct libusb_context
+{
+	int unused;
+};
+
+struct libusb_device
+{
+	uint8_t port;
+	bool claimed;
+};
+
+struct libusb_device_handle
+{
+	libusb_device *device;
+};
+
+static std::mutex mockMutex;
+static libusb_device mockDevices[MOCK_RADIOS];
+static bool mockBusReady = false;
+static MockLibusbStats mockStats;
+static int mockFailTransfer = -1;
+static int mockFailSubmit = -1;
+static bool mockCoalesce = false;
+static uint32_t mockWord = 0;
+static std::deque<libusb_transfer *> mockQueue;
+static std::set<libusb_transfer *> mockCancelled;
+static std::deque<std::vector<unsigned char> > mockReplies;
+
+// called with the mock locked; the address of a radio is its port
+static void mockBus(void)
+{
+	if (mockBusReady) return;
+	mkdir(ICR8600_USBFS_PATH, 0755);
+	mkdir(ICR8600_USBFS_PATH "/001", 0755);
+	for (int i = 0; i < MOCK_RADIOS; i++) {
+		mockDevices[i].port = (uint8_t)(i + 1);
+		mockDevices[i].claimed = false;
+		char node[MAX_PATH];
+		snprintf(node, sizeof(node), "%s/001/%03d", ICR8600_USBFS_PATH, i + 1);
+		int fd = open(node, O_WRONLY | O_CREAT, 0644);
+		if (fd >= 0) close(fd);
+	}
+	mockBusReady = true;
+}
+
+// called with the mock locked
+static void mockFillIQ(unsigned char *buffer, int length)
+{
+	for (int i = 0; i + 4 <= length; i += 4) {
+		std::memcpy(buffer + i, &mockWord, 4);
+		mockWord++;
+	}
+}
+
+void MockLibusbReset(void)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	std::memset(&mockStats, 0, sizeof(mockStats));
+	mockFailTransfer = -1;
+	mockFailSubmit = -1;
+	mockCoalesce = false;
+	mockWord = 0;
+	mockQueue.clear();
+	mockCancelled.clear();
+	mockReplies.clear();
+}
+
+void MockLibusbFailTransfer(int Index)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockFailTransfer = Index;
+}
+
+void MockLibusbFailSubmit(int Index)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockFailSubmit = Index;
+}
+
+void MockLibusbCoalesceReplies(bool Coalesce)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockCoalesce = Coalesce;
+}
+
+MockLibusbStats MockLibusbGetStats(void)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockStats.InFlight = (int)mockQueue.size();
+	return mockStats;
+}
+
+/*******************************************************************
+ * Context and bus
+ ******************************************************************/
+
+int libusb_init(libusb_context **ctx)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockBus();
+	mockStats.Inits++;
+	*ctx = new libusb_context();
+	return LIBUSB_SUCCESS;
+}
+
+void libusb_exit(libusb_context *ctx)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockStats.Exits++;
+	delete ctx;
+}
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x0100010A)
+int libusb_init_context(libusb_context **ctx, const struct libusb_init_option options[], int num_options)
+{
+	return libusb_init(ctx);
+}
+
+// the node the descriptor was opened on tells the radio
+int libusb_wrap_sys_device(libusb_context *ctx, intptr_t sys_dev, libusb_device_handle **dev_handle)
+{
+	char link[64], node[MAX_PATH];
+	snprintf(link, sizeof(link), "/proc/self/fd/%d", (int)sys_dev);
+	ssize_t n = readlink(link, node, sizeof(node) - 1);
+	if (n < 4) return LIBUSB_ERROR_NO_DEVICE;
+	node[n] = '\0';
+	int address = atoi(node + n - 3);
+	if (address < 1 || address > MOCK_RADIOS) return LIBUSB_ERROR_NO_DEVICE;
+	libusb_device_handle *handle = new libusb_device_handle();
+	handle->device = &mockDevices[address - 1];
+	*dev_handle = handle;
+	return LIBUSB_SUCCESS;
+}
+#endif
+
+int libusb_has_capability(uint32_t capability)
+{
+	return 0;
+}
+
+const char *libusb_error_name(int errcode)
+{
+	return "LIBUSB_MOCK_ERROR";
+}
+
+#if defined(LIBUSB_API_VERSION) && (LIBUSB_API_VERSION >= 0x01000108)
+int libusb_hotplug_register_callback(libusb_context *ctx, int events, int flags, int vendor_id, int product_id, int dev_class,
+	libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
+#else
+int libusb_hotplug_register_callback(libusb_context *ctx, libusb_hotplug_event events, libusb_hotplug_flag flags, int vendor_id, int product_id, int dev_class,
+	libusb_hotplug_callback_fn cb_fn, void *user_data, libusb_hotplug_callback_handle *callback_handle)
+#endif
+{
+	return LIBUSB_ERROR_NOT_SUPPORTED;
+}
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockStats.DeviceLists++;
+	libusb_device **devs = (libusb_device **)calloc(MOCK_RADIOS + 1, sizeof(libusb_device *));
+	for (int i = 0; i < MOCK_RADIOS; i++) {
+		devs[i] = &mockDevices[i];
+	}
+	*list = devs;
+	return MOCK_RADIOS;
+}
+
+void libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+	free(list);
+}
+
+libusb_device *libusb_ref_device(libusb_device *dev)
+{
+	return dev;
+}
+
+void libusb_unref_device(libusb_device *dev)
+{
+}
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+	std::memset(desc, 0, sizeof(*desc));
+	desc->bcdUSB = 0x0200;
+	desc->idVendor = ICR8600_VID;
+	desc->idProduct = ICR8600_PID;
+	desc->iSerialNumber = 3;
+	return LIBUSB_SUCCESS;
+}
+
+uint8_t libusb_get_bus_number(libusb_device *dev)
+{
+	return 1;
+}
+
+uint8_t libusb_get_device_address(libusb_device *dev)
+{
+	return dev->port;
+}
+
+int libusb_get_port_numbers(libusb_device *dev, uint8_t *port_numbers, int port_numbers_len)
+{
+	if (port_numbers_len < 1) return LIBUSB_ERROR_OVERFLOW;
+	port_numbers[0] = dev->port;
+	return 1;
+}
+
+libusb_device *libusb_get_device(libusb_device_handle *dev_handle)
+{
+	return dev_handle->device;
+}
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+	libusb_device_handle *handle = new libusb_device_handle();
+	handle->device = dev;
+	*dev_handle = handle;
+	return LIBUSB_SUCCESS;
+}
+
+void libusb_close(libusb_device_handle *dev_handle)
+{
+	delete dev_handle;
+}
+
+int libusb_get_string_descriptor_ascii(libusb_device_handle *dev_handle, uint8_t desc_index, unsigned char *data, int length)
+{
+	return snprintf((char *)data, length, "MOCK%04d", (int)dev_handle->device->port);
+}
+
+int libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable)
+{
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	if (dev_handle->device->claimed) return LIBUSB_ERROR_BUSY;
+	dev_handle->device->claimed = true;
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_release_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	dev_handle->device->claimed = false;
+	return LIBUSB_SUCCESS;
+}
+
+/*******************************************************************
+ * Synchronous transfers
+ ******************************************************************/
+
+int libusb_bulk_transfer(libusb_device_handle *dev_handle, unsigned char endpoint, unsigned char *data, int length, int *actual_length, unsigned int timeout)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	*actual_length = 0;
+	if (endpoint == PIPE_CONTROL_ID) {
+		// FE FE 96 E0 ... FD: FE FE E0 96 FB FD
+		if (length >= 5 && data[0] == 0xFE && data[1] == 0xFE && data[2] == 0x96 && data[3] == 0xE0) {
+			const unsigned char ack[] = { 0xFE, 0xFE, 0xE0, 0x96, 0xFB, 0xFD };
+			mockReplies.push_back(std::vector<unsigned char>(ack, ack + sizeof(ack)));
+		}
+		*actual_length = length;
+		return LIBUSB_SUCCESS;
+	}
+	if (endpoint == PIPE_RESPONSE_ID) {
+		if (mockReplies.empty()) return LIBUSB_ERROR_TIMEOUT;
+		int n = 0;
+		do {
+			int size = (int)mockReplies.front().size();
+			if (n + size > length) break;
+			std::memcpy(data + n, mockReplies.front().data(), size);
+			mockReplies.pop_front();
+			n += size;
+		} while (mockCoalesce && !mockReplies.empty());
+		*actual_length = n;
+		return LIBUSB_SUCCESS;
+	}
+	if (endpoint == PIPE_IQ_ID) {
+		mockFillIQ(data, length);
+		*actual_length = length;
+		return LIBUSB_SUCCESS;
+	}
+	return LIBUSB_ERROR_PIPE;
+}
+
+/*******************************************************************
+ * Asynchronous transfers
+ ******************************************************************/
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockStats.TransfersAllocated++;
+	return (struct libusb_transfer *)calloc(1, sizeof(struct libusb_transfer));
+}
+
+void libusb_free_transfer(struct libusb_transfer *transfer)
+{
+	if (transfer == NULL) return;
+	std::lock_guard<std::mutex> lock(mockMutex);
+	mockStats.TransfersFreed++;
+	free(transfer);
+}
+
+int libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	if (std::find(mockQueue.begin(), mockQueue.end(), transfer) != mockQueue.end()) return LIBUSB_ERROR_BUSY;
+	if (mockStats.Submitted++ == mockFailSubmit) return LIBUSB_ERROR_IO;
+	mockQueue.push_back(transfer);
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+	std::lock_guard<std::mutex> lock(mockMutex);
+	if (std::find(mockQueue.begin(), mockQueue.end(), transfer) == mockQueue.end()) return LIBUSB_ERROR_NOT_FOUND;
+	mockCancelled.insert(transfer);
+	return LIBUSB_SUCCESS;
+}
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+	libusb_transfer *transfer = NULL;
+	{
+		std::lock_guard<std::mutex> lock(mockMutex);
+		if (!mockQueue.empty()) {
+			transfer = mockQueue.front();
+			mockQueue.pop_front();
+			if (mockCancelled.erase(transfer) != 0) {
+				transfer->status = LIBUSB_TRANSFER_CANCELLED;
+				transfer->actual_length = 0;
+				mockStats.Cancelled++;
+			}
+			else if (mockStats.Completed++ == mockFailTransfer) {
+				transfer->status = LIBUSB_TRANSFER_ERROR;
+				transfer->actual_length = 0;
+			}
+			else {
+				transfer->status = LIBUSB_TRANSFER_COMPLETED;
+				transfer->actual_length = transfer->length;
+				mockFillIQ(transfer->buffer, transfer->length);
+			}
+		}
+	}
+	if (transfer == NULL) {
+		// nothing in flight, wait like libusb does for an event that does not come
+		long long us = (long long)tv->tv_sec * 1000000 + tv->tv_usec;
+		std::this_thread::sleep_for(std::chrono::microseconds(std::min(us, 1000LL)));
+		return LIBUSB_SUCCESS;
+	}
+	// delivered without the mock locked, the callback submits the transfer again
+	transfer->callback(transfer);
+	return LIBUSB_SUCCESS;
+}
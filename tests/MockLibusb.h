@@ -0,0 +1,58 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+#pragma once
+
+//
+// The libusb calls of WinUSBDevice.cpp against an in-process bus, linked in place
+// of libusb-1.0. The bus holds MOCK_RADIOS IC-R8600s on bus 1, ports 1 to
+// MOCK_RADIOS, with serials MOCK0001 and up, and no hotplug support.
+//
+//   control pipe   every CI-V command is acknowledged with FB
+//   I/Q pipe       filled with a running 32 bit word count, across transfers
+//   async reads    complete in submission order, one per event handling call
+//   device nodes   with libusb 1.0.27 and later, radios are opened through
+//                  ICR8600_USBFS_PATH/001/00N, which the mock creates as plain files
+//
+#define MOCK_RADIOS 2
+
+struct MockLibusbStats
+{
+	int Inits;
+	int Exits;
+	int DeviceLists;
+	int TransfersAllocated;
+	int TransfersFreed;
+	int Submitted;
+	int Completed;
+	int Cancelled;
+	int InFlight;
+};
+
+// Forget the counters, failures and the I/Q word count, the bus stays as it is
+void MockLibusbReset(void);
+
+// Complete async transfer number Index (from 0, since the reset) with an error, -1 for none
+void MockLibusbFailTransfer(int Index);
+
+// Fail the submission of async transfer number Index (from 0, since the reset), -1 for none
+void MockLibusbFailSubmit(int Index);
+
+// Return every queued CI-V reply in one read of the response pipe, as when
+// replies pile up before they are read
+void MockLibusbCoalesceReplies(bool Coalesce);
+
+MockLibusbStats MockLibusbGetStats(void);
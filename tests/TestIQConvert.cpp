@@ -0,0 +1,135 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+//
+// Every SIMD build of convertCS16ToCF32 and removeSyncWords the CPU runs, held
+// against the scalar one on random input: bit identical output for every tail
+// length, unaligned buffers, and sync words on and around the vector block edges
+//
+
+#include "TestCommon.h"
+#include "IQConvert.h"
+#include <cstring>
+#include <random>
+#include <vector>
+
+#define MAX_VARIANTS 8
+
+// covers every tail of the 16 word AVX-512 block, plus long buffers
+static std::vector<size_t> testLengths(void)
+{
+	std::vector<size_t> lengths;
+	for (size_t n = 0; n <= 80; n++) lengths.push_back(n);
+	lengths.push_back(1023);
+	lengths.push_back(1024);
+	lengths.push_back(1025);
+	lengths.push_back(65536 + 13);
+	return lengths;
+}
+
+static void testConvert(const IQKernelVariant &scalar, const IQKernelVariant &variant, std::mt19937 &rng)
+{
+	std::uniform_int_distribution<int> sample(-32768, 32767);
+	std::vector<size_t> lengths = testLengths();
+	for (size_t l = 0; l < lengths.size(); l++) {
+		const size_t n = lengths[l];
+		// one spare element in front, so odd offsets test unaligned access
+		std::vector<int16_t> in(2 * n + 2);
+		for (size_t i = 0; i < in.size(); i++) in[i] = (int16_t)sample(rng);
+		in[0] = -32768;
+		if (in.size() > 3) in[3] = 32767;
+
+		for (size_t offset = 0; offset < 2; offset++) {
+			std::vector<float> expected(2 * n + 2, -1.0f);
+			std::vector<float> actual(2 * n + 2, -1.0f);
+			scalar.convert(&in[offset], &expected[offset], n);
+			variant.convert(&in[offset], &actual[offset], n);
+			bool same = (std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(float)) == 0);
+			if (!same) fprintf(stderr, "%s convertCS16ToCF32: %zu samples, offset %zu differ\n", variant.name, n, offset);
+			CHECK(same);
+		}
+	}
+}
+
+static void checkRemoveSync(const IQKernelVariant &scalar, const IQKernelVariant &variant, const std::vector<uint32_t> &words, size_t maxMarkers, const char *what)
+{
+	std::vector<uint32_t> expected(words), actual(words);
+	std::vector<size_t> expectedMarkers(maxMarkers + 1, 12345), actualMarkers(maxMarkers + 1, 12345);
+	size_t expectedCount = 0, actualCount = 0;
+	size_t expectedN = scalar.removeSync(expected.data(), expected.size(), expectedMarkers.data(), maxMarkers, &expectedCount);
+	size_t actualN = variant.removeSync(actual.data(), actual.size(), actualMarkers.data(), maxMarkers, &actualCount);
+
+	bool same = (expectedN == actualN && expectedCount == actualCount &&
+		std::memcmp(expected.data(), actual.data(), expectedN * sizeof(uint32_t)) == 0 &&
+		expectedMarkers == actualMarkers);
+	if (!same) fprintf(stderr, "%s removeSyncWords: %zu words, %s differ\n", variant.name, words.size(), what);
+	CHECK(same);
+}
+
+static void testRemoveSync(const IQKernelVariant &scalar, const IQKernelVariant &variant, std::mt19937 &rng)
+{
+	std::uniform_int_distribution<uint32_t> word;
+	std::vector<size_t> lengths = testLengths();
+	for (size_t l = 0; l < lengths.size(); l++) {
+		const size_t n = lengths[l];
+		std::vector<uint32_t> words(n);
+		for (size_t i = 0; i < n; i++) words[i] = word(rng);
+		checkRemoveSync(scalar, variant, words, 16, "no sync words");
+
+		// on both sides of every 4, 8 and 16 word block edge, and the ends
+		std::vector<uint32_t> edges(words);
+		for (size_t i = 0; i < n; i++) {
+			if (i % 4 == 0 || i % 4 == 3 || i + 1 == n) edges[i] = IQ_SYNC_WORD;
+		}
+		checkRemoveSync(scalar, variant, edges, n, "block edges");
+		checkRemoveSync(scalar, variant, edges, 3, "block edges, few markers");
+
+		// runs of sync words and a whole buffer of them
+		std::vector<uint32_t> runs(words);
+		for (size_t i = 5; i < n && i < 5 + 21; i++) runs[i] = IQ_SYNC_WORD;
+		checkRemoveSync(scalar, variant, runs, n, "a run");
+		checkRemoveSync(scalar, variant, std::vector<uint32_t>(n, IQ_SYNC_WORD), n, "all sync");
+
+		// scattered, like the radio's cadence at a random phase
+		std::vector<uint32_t> scattered(words);
+		std::uniform_int_distribution<size_t> gap(1, 40);
+		for (size_t i = gap(rng); i < n; i += gap(rng)) scattered[i] = IQ_SYNC_WORD;
+		checkRemoveSync(scalar, variant, scattered, n, "scattered");
+
+		// half a sync word is a sample
+		std::vector<uint32_t> halves(words);
+		for (size_t i = 0; i < n; i++) halves[i] = (i % 2) ? 0x80000000 : 0x00008000;
+		checkRemoveSync(scalar, variant, halves, n, "half sync words");
+	}
+}
+
+int main(void)
+{
+	IQKernelVariant variants[MAX_VARIANTS];
+	size_t count = iqKernelVariants(variants, MAX_VARIANTS);
+	CHECK(count >= 1);
+	if (count < 1) return TEST_RESULT();
+
+	std::mt19937 rng(8600);
+	for (size_t v = 1; v < count; v++) {
+		printf("%s against %s\n", variants[v].name, variants[0].name);
+		testConvert(variants[0], variants[v], rng);
+		testRemoveSync(variants[0], variants[v], rng);
+	}
+	if (count == 1) printf("only the scalar kernels run on this CPU\n");
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,84 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+//
+// CI-V with the simulated radio: front panel changes it broadcasts reach the
+// getters while nothing else is sent, and a retune with its gain plan costs one
+// round trip
+//
+
+#include "TestCommon.h"
+#include "SoapyICR8600.hpp"
+#include <chrono>
+#include <cmath>
+#include <thread>
+
+#define TEST_DIAL_MS 5
+#define TEST_WAIT_MS 1000
+#define TEST_LATENCY_MS 50
+
+// the dial turns while the application only polls the frequency
+static void testTransceive(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_dial"] = std::to_string(TEST_DIAL_MS);
+	SoapyICR8600 dev(args);
+
+	const double first = dev.getFrequency(SOAPY_SDR_RX, 0, "RF");
+	double now = first;
+	for (int waited = 0; waited < TEST_WAIT_MS && now == first; waited += TEST_DIAL_MS) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(TEST_DIAL_MS));
+		now = dev.getFrequency(SOAPY_SDR_RX, 0, "RF");
+	}
+	CHECK(now > first);
+	CHECK(std::fmod(now - first, 1000.0) == 0.0);
+}
+
+// frequency, pre-amp, attenuator and RF gain, four commands in one batch
+static void testBatchedRetune(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_latency"] = std::to_string(TEST_LATENCY_MS);
+	SoapyICR8600 dev(args);
+	// collects the ack of remote on, sent while opening
+	CHECK(dev.getFrequency(SOAPY_SDR_RX, 0, "RF") > 0);
+
+	SoapySDR::Kwargs tune;
+	tune["gain"] = "-40";
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	dev.setFrequency(SOAPY_SDR_RX, 0, "RF", 100000000.0, tune);
+	double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	CHECK(ms >= TEST_LATENCY_MS);
+	CHECK(ms < 2 * TEST_LATENCY_MS);
+
+	CHECK(dev.getFrequency(SOAPY_SDR_RX, 0, "RF") == 100000000.0);
+	CHECK(dev.getGain(SOAPY_SDR_RX, 0, "PRE-AMP") == 0.0);
+	CHECK(dev.getGain(SOAPY_SDR_RX, 0, "ATTENUATOR") == -30.0);
+	CHECK(dev.getGain(SOAPY_SDR_RX, 0, "RF") == -10.0);
+	CHECK(dev.readSetting("refresh_state") == "true");
+	CHECK(dev.getFrequency(SOAPY_SDR_RX, 0, "RF") == 100000000.0);
+	CHECK(dev.getGain(SOAPY_SDR_RX, 0, "ATTENUATOR") == -30.0);
+	CHECK(dev.getGain(SOAPY_SDR_RX, 0, "RF") == -10.0);
+}
+
+int main(void)
+{
+	testTransceive();
+	testBatchedRetune();
+	return TEST_RESULT();
+}
@@ -0,0 +1,329 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+//
+// Streams from the simulated radio: the stream can be activated again after a
+// deactivate, also when the transfers had already stopped before the cancel,
+// stray buffer releases leave the ring alone, a rate change while streaming
+// keeps the stream time continuous and the buffers are sized for the new rate
+// at the next activate, reads of the MTU run across sync words, and
+// a reader that falls behind gets an overflow and then the samples after it
+//
+
+#include "TestCommon.h"
+#include "SoapyICR8600.hpp"
+#include <SoapySDR/Formats.hpp>
+#include <cmath>
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#define TEST_CYCLES 10
+#define TEST_READS 20
+#define TEST_RATE_READS 100000
+
+struct SimReads
+{
+	std::vector<UCHAR> buffer;
+	int completed;
+	int limit;
+};
+
+static PUCHAR simCallback(PUCHAR Buffer, ULONG Length, PVOID Context)
+{
+	SimReads *reads = (SimReads *)Context;
+	if (Buffer != NULL && ++reads->completed >= reads->limit) return NULL;
+	return reads->buffer.data();
+}
+
+// the reads ended on their own, the cancel that follows must not stop the next ones
+static void testStaleCancel(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim_paced"] = "0";
+	SimTransport sim(args);
+
+	SimReads first = { std::vector<UCHAR>(4096), 0, 5 };
+	CHECK(sim.ReadIQAsync(&simCallback, &first, 1, 4096));
+	CHECK(first.completed == 5);
+	sim.CancelIQAsync();
+
+	SimReads second = { std::vector<UCHAR>(4096), 0, 5 };
+	CHECK(sim.ReadIQAsync(&simCallback, &second, 1, 4096));
+	CHECK(second.completed == 5);
+}
+
+static void testReactivate(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_paced"] = "0";
+	SoapyICR8600 dev(args);
+
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, std::vector<size_t>(1, 0), SoapySDR::Kwargs());
+	std::vector<float> buff(dev.getStreamMTU(stream) * 2);
+	void *buffs[] = { buff.data() };
+
+	for (int cycle = 0; cycle < TEST_CYCLES; cycle++) {
+		CHECK(dev.activateStream(stream) == 0);
+		long long samples = 0;
+		int errors = 0;
+		for (int i = 0; i < TEST_READS; i++) {
+			int flags = 0;
+			long long timeNs = 0;
+			int ret = dev.readStream(stream, buffs, buff.size() / 2, flags, timeNs, 500000);
+			if (ret > 0) samples += ret;
+			else if (ret != SOAPY_SDR_OVERFLOW) errors++;
+		}
+		CHECK(errors == 0);
+		CHECK(samples > 0);
+		CHECK(dev.deactivateStream(stream) == 0);
+	}
+	dev.closeStream(stream);
+}
+
+static int acquireOne(SoapyICR8600 &dev, SoapySDR::Stream *stream, size_t &handle)
+{
+	const void *buffs[1];
+	int flags = 0;
+	long long timeNs = 0;
+	int ret;
+	do {
+		ret = dev.acquireReadBuffer(stream, handle, buffs, flags, timeNs, 500000);
+	} while (ret == SOAPY_SDR_OVERFLOW);
+	return ret;
+}
+
+// a double release, or one after deactivateStream reset the ring, is ignored:
+// the stream keeps handing out buffers
+static void testBadRelease(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_paced"] = "0";
+	SoapyICR8600 dev(args);
+
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CS16, std::vector<size_t>(1, 0), SoapySDR::Kwargs());
+	CHECK(dev.activateStream(stream) == 0);
+	size_t handle = 0;
+	CHECK(acquireOne(dev, stream, handle) > 0);
+	dev.releaseReadBuffer(stream, handle);
+	dev.releaseReadBuffer(stream, handle);
+	CHECK(acquireOne(dev, stream, handle) > 0);
+	dev.releaseReadBuffer(stream, handle);
+	CHECK(dev.deactivateStream(stream) == 0);
+	dev.releaseReadBuffer(stream, handle);
+
+	CHECK(dev.activateStream(stream) == 0);
+	CHECK(acquireOne(dev, stream, handle) > 0);
+	dev.releaseReadBuffer(stream, handle);
+	CHECK(dev.deactivateStream(stream) == 0);
+	dev.closeStream(stream);
+}
+
+// the samples already in the ring keep the old rate, the time runs on without a
+// jump at the first buffer at the new one
+static bool spans(long long gapNs, int elems, double rate)
+{
+	return std::llabs(gapNs - (long long)std::llround(elems * 1e9 / rate)) <= 2;
+}
+
+static void testRateChange(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_paced"] = "0";
+	SoapyICR8600 dev(args);
+	dev.setSampleRate(SOAPY_SDR_RX, 0, 1920000);
+
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CF32, std::vector<size_t>(1, 0), SoapySDR::Kwargs());
+	std::vector<float> buff(dev.getStreamMTU(stream) * 2);
+	void *buffs[] = { buff.data() };
+	CHECK(dev.activateStream(stream) == 0);
+
+	long long lastNs = 0;
+	int lastElems = 0;
+	int atOld = 0, atNew = 0;
+	// the ring holds many reads, read until well past the switch
+	for (int i = 0; i < TEST_RATE_READS && atNew < TEST_READS; i++) {
+		if (i == TEST_READS) {
+			dev.setSampleRate(SOAPY_SDR_RX, 0, 960000);
+			CHECK(dev.getSampleRate(SOAPY_SDR_RX, 0) == 960000);
+		}
+		int flags = 0;
+		long long timeNs = 0;
+		int ret = dev.readStream(stream, buffs, buff.size() / 2, flags, timeNs, 500000);
+		if (ret <= 0) {
+			// dropped transfers count in the stream time, start over after them
+			CHECK(ret == SOAPY_SDR_OVERFLOW);
+			lastElems = 0;
+			continue;
+		}
+		CHECK((flags & SOAPY_SDR_HAS_TIME) != 0);
+		if (lastElems > 0) {
+			// the last read lasted its samples at one rate, the old one until the switch
+			if (atNew == 0 && spans(timeNs - lastNs, lastElems, 1920000)) atOld++;
+			else if (spans(timeNs - lastNs, lastElems, 960000)) atNew++;
+			else CHECK(!"stream time jumped");
+		}
+		lastNs = timeNs;
+		lastElems = ret;
+	}
+	CHECK(atOld > 0);
+	CHECK(atNew > 0);
+	CHECK(dev.deactivateStream(stream) == 0);
+	dev.closeStream(stream);
+}
+
+// buffers sized at setupStream for one rate are sized again for the rate
+// set while streaming when the stream is activated the next time
+static void testRateResize(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_paced"] = "0";
+	SoapyICR8600 dev(args);
+	dev.setSampleRate(SOAPY_SDR_RX, 0, 240000);
+
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CS16, std::vector<size_t>(1, 0), SoapySDR::Kwargs());
+	const size_t slowMTU = dev.getStreamMTU(stream);
+	const size_t slowBuffers = dev.getNumDirectAccessBuffers(stream);
+	std::vector<int16_t> buff(slowMTU * 2);
+	void *buffs[] = { buff.data() };
+	CHECK(dev.activateStream(stream) == 0);
+	dev.setSampleRate(SOAPY_SDR_RX, 0, 5120000);
+	for (int i = 0; i < TEST_READS; i++) {
+		int flags = 0;
+		long long timeNs = 0;
+		CHECK(dev.readStream(stream, buffs, buff.size() / 2, flags, timeNs, 500000) != SOAPY_SDR_TIMEOUT);
+	}
+	// the transfers in flight keep their size
+	CHECK(dev.getStreamMTU(stream) <= slowMTU);
+	CHECK(dev.deactivateStream(stream) == 0);
+
+	CHECK(dev.activateStream(stream) == 0);
+	const size_t fastMTU = dev.getStreamMTU(stream);
+	CHECK(fastMTU > slowMTU);
+	CHECK(dev.getNumDirectAccessBuffers(stream) >= slowBuffers);
+	buff.assign(fastMTU * 2, 0);
+	buffs[0] = buff.data();
+	int reads = 0;
+	for (int i = 0; i < TEST_READS; i++) {
+		int flags = 0;
+		long long timeNs = 0;
+		int ret = dev.readStream(stream, buffs, buff.size() / 2, flags, timeNs, 500000);
+		if (ret > 0) {
+			CHECK((size_t)ret <= fastMTU);
+			reads++;
+		}
+		else CHECK(ret == SOAPY_SDR_OVERFLOW);
+	}
+	CHECK(reads > 0);
+	CHECK(dev.deactivateStream(stream) == 0);
+	dev.closeStream(stream);
+}
+
+// a reader that falls behind loses transfers, each one dropped into a buffer
+// of its own, and the stream goes on after the overflow
+static void testOverflow(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_paced"] = "0";
+	SoapyICR8600 dev(args);
+
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CS16, std::vector<size_t>(1, 0), SoapySDR::Kwargs());
+	std::vector<int16_t> buff(dev.getStreamMTU(stream) * 2);
+	void *buffs[] = { buff.data() };
+	CHECK(dev.activateStream(stream) == 0);
+
+	int overflows = 0, errors = 0;
+	for (int i = 0; i < 4 * TEST_READS; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		int flags = 0;
+		long long timeNs = 0;
+		int ret = dev.readStream(stream, buffs, buff.size() / 2, flags, timeNs, 500000);
+		if (ret == SOAPY_SDR_OVERFLOW) overflows++;
+		else if (ret <= 0) errors++;
+	}
+	CHECK(overflows > 0);
+	CHECK(errors == 0);
+	CHECK(std::stoull(dev.readSetting("dropped_transfers")) > 1);
+	CHECK(dev.deactivateStream(stream) == 0);
+	dev.closeStream(stream);
+}
+
+// one read returns about a buffer, up to the MTU, and says where the sync words were
+static void testSyncOffsets(void)
+{
+	SoapySDR::Kwargs args;
+	args["sim"] = "1";
+	args["sim_paced"] = "0";
+	SoapyICR8600 dev(args);
+
+	SoapySDR::Stream *stream = dev.setupStream(SOAPY_SDR_RX, SOAPY_SDR_CS16, std::vector<size_t>(1, 0), SoapySDR::Kwargs());
+	const size_t mtu = dev.getStreamMTU(stream);
+	std::vector<int16_t> buff(mtu * 2);
+	void *buffs[] = { buff.data() };
+	CHECK(dev.activateStream(stream) == 0);
+
+	size_t longest = 0;
+	int flagged = 0;
+	for (int i = 0; i < TEST_READS; i++) {
+		int flags = 0;
+		long long timeNs = 0;
+		int ret = dev.readStream(stream, buffs, mtu, flags, timeNs, 500000);
+		if (ret <= 0) {
+			CHECK(ret == SOAPY_SDR_OVERFLOW);
+			continue;
+		}
+		longest = std::max(longest, (size_t)ret);
+
+		std::vector<size_t> offsets;
+		std::istringstream list(dev.readSetting("sync_offsets"));
+		std::string offset;
+		while (std::getline(list, offset, ',')) offsets.push_back((size_t)std::stoul(offset));
+		CHECK(((flags & ICR8600_FLAG_SYNC_WORD) != 0) == !offsets.empty());
+		for (size_t k = 0; k < offsets.size(); k++) {
+			CHECK(offsets[k] < (size_t)ret);
+			if (k > 0) CHECK(offsets[k] - offsets[k - 1] == SIM_SYNC_INTERVAL);
+		}
+		if (!offsets.empty()) flagged++;
+	}
+	// the MTU counts the sync words until their cadence was seen
+	CHECK(longest <= mtu);
+	CHECK(longest + mtu / SIM_SYNC_INTERVAL + 1 >= mtu);
+	CHECK(longest > SIM_SYNC_INTERVAL);
+	CHECK(flagged > 0);
+	CHECK(dev.deactivateStream(stream) == 0);
+	dev.closeStream(stream);
+}
+
+int main(void)
+{
+	SoapySDR_setLogLevel(SOAPY_SDR_FATAL);
+
+	testStaleCancel();
+	testReactivate();
+	testBadRelease();
+	testRateChange();
+	testRateResize();
+	testSyncOffsets();
+	testOverflow();
+
+	return TEST_RESULT();
+}
@@ -0,0 +1,227 @@
+/*
+ * Icom ICR8600 SoapySDR Library
+ *
+ * Made in 2018 by D.Eliuseev dmitryelj@gmail.com
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+
+//
+// libusb backend of WinUSBDevice.cpp against the mock bus of MockLibusb.cpp:
+// discovery, opening by serial and path without walking the bus again, CI-V over
+// USBTransport with acks read one at a time or several in one read, and the async
+// I/Q reads with completion, cancel, stale cancel and error paths
+//
+
+#include "MockLibusb.h"
+#include "TestCommon.h"
+#include "ICR8600Transport.h"
+#include "CIVCommands.h"
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#define TEST_TRANSFERS 4
+#define TEST_TRANSFER_LENGTH 1024
+
+//
+// Hands out TEST_TRANSFERS buffers and takes completed ones back, checking the
+// word count runs on across transfers; returns NULL after Limit completions
+//
+struct ReadState
+{
+	std::vector<std::vector<UCHAR> > buffers;
+	size_t handedOut;
+	std::atomic<int> completed;
+	int limit;
+	uint32_t nextWord;
+	bool inOrder;
+
+	ReadState(int Limit) : buffers(TEST_TRANSFERS, std::vector<UCHAR>(TEST_TRANSFER_LENGTH)),
+		handedOut(0), completed(0), limit(Limit), nextWord(0), inOrder(true) {}
+};
+
+static PUCHAR readCallback(PUCHAR Buffer, ULONG Length, PVOID Context)
+{
+	ReadState *state = (ReadState *)Context;
+	if (Buffer == NULL) {
+		return (state->handedOut < state->buffers.size()) ? state->buffers[state->handedOut++].data() : NULL;
+	}
+	for (ULONG i = 0; i + 4 <= Length; i += 4) {
+		uint32_t word;
+		std::memcpy(&word, Buffer + i, 4);
+		if (word != state->nextWord++) state->inOrder = false;
+	}
+	if (++state->completed >= state->limit && state->limit > 0) return NULL;
+	return Buffer;
+}
+
+static void checkNoLeaks(void)
+{
+	MockLibusbStats stats = MockLibusbGetStats();
+	CHECK(stats.TransfersAllocated == stats.TransfersFreed);
+	CHECK(stats.InFlight == 0);
+}
+
+static void testDiscovery(void)
+{
+	std::vector<ICR8600_DEVICE_INFO> devices;
+	CHECK(ListICR8600Devices(&devices));
+	CHECK(devices.size() == MOCK_RADIOS);
+	if (devices.size() == MOCK_RADIOS) {
+		CHECK(devices[0].Serial == "MOCK0001");
+		CHECK(devices[0].Path == "1-1");
+		CHECK(devices[1].Serial == "MOCK0002");
+		CHECK(devices[1].Path == "1-2");
+	}
+
+	// by serial and by path, a radio in use is skipped
+	DEVICE_DATA a, b, c;
+	BOOL noDevice = FALSE;
+	CHECK(SUCCEEDED(OpenDevice(&a, &noDevice, "MOCK0002", NULL)));
+	CHECK(a.Info.Path == "1-2");
+	CHECK(FAILED(OpenDevice(&b, &noDevice, NULL, "1-2")));
+	CHECK(SUCCEEDED(OpenDevice(&b, &noDevice, NULL, NULL)));
+	CHECK(b.Info.Serial == "MOCK0001");
+	CHECK(FAILED(OpenDevice(&c, &noDevice, NULL, NULL)));
+	CHECK(FAILED(OpenDevice(&c, &noDevice, "MOCK9999", NULL)));
+	CHECK(noDevice);
+	CloseDevice(&a);
+	CloseDevice(&b);
+	MockLibusbStats stats = MockLibusbGetStats();
+	// the enumeration context is kept, every radio's own one is released
+	CHECK(stats.Inits == stats.Exits + 1);
+}
+
+// a radio the last walk of the bus found is opened without walking it again
+static void testOpenWithoutScan(void)
+{
+	std::vector<ICR8600_DEVICE_INFO> devices;
+	CHECK(ListICR8600Devices(&devices));
+	MockLibusbReset();
+
+	DEVICE_DATA a, b;
+	BOOL noDevice = FALSE;
+	CHECK(SUCCEEDED(OpenDevice(&a, &noDevice, "MOCK0001", NULL)));
+	CHECK(SUCCEEDED(OpenDevice(&b, &noDevice, NULL, "1-2")));
+	CHECK(MockLibusbGetStats().DeviceLists == 0);
+	CloseDevice(&a);
+	CloseDevice(&b);
+	MockLibusbStats stats = MockLibusbGetStats();
+	CHECK(stats.Inits == stats.Exits);
+}
+
+static void testCIV(USBTransport &usb)
+{
+	USB_DEVICE_DESCRIPTOR desc;
+	CHECK(usb.GetDescriptor(&desc));
+	CHECK(desc.idVendor == ICR8600_VID && desc.idProduct == ICR8600_PID);
+	CHECK(ICR8600PostRemoteOn(&usb));
+	CHECK(ICR8600SetFrequency(&usb, 7100000));
+	CHECK(usb.PendingAcks == 0);
+}
+
+// acks of posted commands that arrive in one read are each matched to their command
+static void testCoalescedAcks(USBTransport &usb)
+{
+	MockLibusbReset();
+	MockLibusbCoalesceReplies(true);
+	CHECK(ICR8600PostRemoteOn(&usb));
+	CHECK(ICR8600PostRemoteOn(&usb));
+	CHECK(ICR8600PostRemoteOn(&usb));
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	CHECK(ICR8600CollectAcks(&usb));
+	CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(CIV_REPLY_TIMEOUT_MS));
+	CHECK(usb.PendingAcks == 0);
+	CHECK(usb.Replies.empty());
+	CHECK(ICR8600SetFrequency(&usb, 7100000));
+	MockLibusbCoalesceReplies(false);
+}
+
+static void testReadToEnd(USBTransport &usb)
+{
+	MockLibusbReset();
+	ReadState state(50);
+	CHECK(usb.ReadIQAsync(&readCallback, &state, TEST_TRANSFERS, TEST_TRANSFER_LENGTH));
+	CHECK(state.completed == 50);
+	CHECK(state.inOrder);
+	checkNoLeaks();
+}
+
+static void testCancel(USBTransport &usb)
+{
+	MockLibusbReset();
+	ReadState state(0);
+	std::thread reader([&]() {
+		CHECK(usb.ReadIQAsync(&readCallback, &state, TEST_TRANSFERS, TEST_TRANSFER_LENGTH));
+	});
+	while (state.completed < 20) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	usb.CancelIQAsync();
+	reader.join();
+	CHECK(state.inOrder);
+	CHECK(MockLibusbGetStats().Cancelled > 0);
+	checkNoLeaks();
+}
+
+// a cancel after the reads already ended must not stop the next ones
+static void testStaleCancel(USBTransport &usb)
+{
+	MockLibusbReset();
+	ReadState first(10);
+	CHECK(usb.ReadIQAsync(&readCallback, &first, TEST_TRANSFERS, TEST_TRANSFER_LENGTH));
+	usb.CancelIQAsync();
+
+	MockLibusbReset();
+	ReadState second(10);
+	CHECK(usb.ReadIQAsync(&readCallback, &second, TEST_TRANSFERS, TEST_TRANSFER_LENGTH));
+	CHECK(second.completed == 10);
+	checkNoLeaks();
+}
+
+static void testErrors(USBTransport &usb)
+{
+	MockLibusbReset();
+	MockLibusbFailTransfer(5);
+	ReadState failed(0);
+	CHECK(!usb.ReadIQAsync(&readCallback, &failed, TEST_TRANSFERS, TEST_TRANSFER_LENGTH));
+	CHECK(failed.completed == 5);
+	checkNoLeaks();
+
+	MockLibusbReset();
+	MockLibusbFailSubmit(2);
+	ReadState rejected(0);
+	CHECK(!usb.ReadIQAsync(&readCallback, &rejected, TEST_TRANSFERS, TEST_TRANSFER_LENGTH));
+	checkNoLeaks();
+}
+
+int main(void)
+{
+	SoapySDR_setLogLevel(SOAPY_SDR_FATAL);
+
+	testDiscovery();
+	testOpenWithoutScan();
+
+	USBTransport usb;
+	BOOL noDevice = FALSE;
+	CHECK(SUCCEEDED(usb.Open(&noDevice, "", "")));
+	testCIV(usb);
+	testCoalescedAcks(usb);
+	testReadToEnd(usb);
+	testCancel(usb);
+	testStaleCancel(usb);
+	testErrors(usb);
+
+	return TEST_RESULT();
+}